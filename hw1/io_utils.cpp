@@ -12,7 +12,16 @@
 #include <unordered_map>
 #include <optional>
 #include <stdexcept>
+#include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 using Eigen::AngleAxisd;
 using Eigen::Matrix3d;
@@ -26,6 +35,34 @@ std::string join_path(const std::string& parent, const std::string& filename) {
     return parent + "/" + filename;
 }
 
+std::vector<edge> uniqueEdges(const std::vector<face>& faces) {
+    // Every face edge keyed by its vertex pair, low index first, then by its place in face
+    // order, so that sorting puts each pair's first use at the head of its run
+    std::vector<std::pair<uint64_t, size_t>> uses(3 * faces.size());
+    for (size_t f = 0; f < faces.size(); ++f) {
+        const unsigned int v[3] = {faces[f].v1, faces[f].v2, faces[f].v3};
+        for (int k = 0; k < 3; ++k) {
+            uint64_t a = v[k], b = v[(k + 1) % 3];
+            uses[3 * f + k] = {a < b ? a << 32 | b : b << 32 | a, 3 * f + k};
+        }
+    }
+    std::sort(uses.begin(), uses.end());
+    std::vector<size_t> first;
+    for (size_t i = 0; i < uses.size(); ++i) {
+        if (i == 0 || uses[i].first != uses[i - 1].first) first.push_back(uses[i].second);
+    }
+    std::sort(first.begin(), first.end());
+
+    std::vector<edge> edges(first.size());
+    for (size_t i = 0; i < first.size(); ++i) {
+        const face& f = faces[first[i] / 3];
+        const unsigned int v[3] = {f.v1, f.v2, f.v3};
+        int k = static_cast<int>(first[i] % 3);
+        edges[i] = edge{v[k], v[(k + 1) % 3]};
+    }
+    return edges;
+}
+
 std::vector<object> loadObjects(const std::vector<std::string>& fpaths, std::string parent_path) {
     std::vector<object> objects;
 
@@ -72,7 +109,8 @@ std::vector<object> loadObjects(const std::vector<std::string>& fpaths, std::str
             }
         }
 
-        objects.push_back({file_path, vertices, faces});
+        std::vector<edge> edges = uniqueEdges(faces);
+        objects.push_back({file_path, std::move(vertices), std::move(faces), std::move(edges)});
     }
 
     return objects;
@@ -345,11 +383,87 @@ ParseSceneFileResult parseSceneFile(std::ifstream& fin, std::string parent_path)
     return ParseSceneFileResult({cam, scene_objects});
 }
 
-void writePPM(const std::vector<uint8_t>& img, size_t xres, size_t yres){
-    std::cout << "P3\n" << xres << " " << yres << "\n255\n";
-    for (size_t i = 0; i < xres * yres * 3; i += 3) {
-        std::cout << static_cast<int>(img[i]) << " "
-                << static_cast<int>(img[i+1]) << " "
-                << static_cast<int>(img[i+2]) << "\n";
+namespace {
+
+// iovec entries per writev call: IOV_MAX on Linux and macOS
+const int kMaxIov = 1024;
+
+// Writes every byte of iov[0..n), resuming after short writes and EINTR.
+bool writeFully(int fd, struct iovec* iov, int n) {
+    while (n > 0) {
+        ssize_t w = ::writev(fd, iov, std::min(n, kMaxIov));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        size_t left = static_cast<size_t>(w);
+        while (n > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            ++iov;
+            --n;
+        }
+        if (n > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
     }
-}
\ No newline at end of file
+    return true;
+}
+
+// The P3 body: "r g b\n" per pixel, formatted from a table of the 256 decimal strings.
+std::string formatP3Pixels(const std::vector<uint8_t>& px, size_t count) {
+    char digits[256][4];
+    uint8_t lengths[256];
+    for (int v = 0; v < 256; ++v) lengths[v] = static_cast<uint8_t>(std::snprintf(digits[v], 4, "%d", v));
+
+    std::string out(count * 12, '\0');
+    char* p = &out[0];
+    for (size_t i = 0; i < count * 3; i += 3) {
+        for (int c = 0; c < 3; ++c) {
+            uint8_t v = px[i + c];
+            std::memcpy(p, digits[v], 4);
+            p += lengths[v];
+            *p++ = c == 2 ? '\n' : ' ';
+        }
+    }
+    out.resize(p - out.data());
+    return out;
+}
+
+} // namespace
+
+void writeOutput(const std::string& path, const OutputPart* parts, size_t count) {
+    bool to_stdout = path.empty() || path == "-";
+    int fd = STDOUT_FILENO;
+    if (!to_stdout) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+    } else {
+        std::cout.flush();
+    }
+
+    std::vector<struct iovec> iov(count);
+    for (size_t i = 0; i < count; ++i) {
+        iov[i].iov_base = const_cast<void*>(parts[i].data);
+        iov[i].iov_len = parts[i].size;
+    }
+    bool ok = writeFully(fd, iov.data(), static_cast<int>(count));
+    int err = errno;
+    if (!to_stdout && ::close(fd) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    if (!ok) throw std::runtime_error("Could not write " + (to_stdout ? std::string("stdout") : path) + ": " + std::strerror(err));
+}
+
+void writePPM(const std::vector<uint8_t>& img, size_t xres, size_t yres, PpmFormat format, const std::string& path){
+    std::string header = (format == PpmFormat::P6 ? "P6\n" : "P3\n") + std::to_string(xres) + " " +
+                         std::to_string(yres) + "\n255\n";
+    std::string text;
+    OutputPart parts[2] = {{header.data(), header.size()}, {img.data(), xres * yres * 3}};
+    if (format == PpmFormat::P3) {
+        text = formatP3Pixels(img, xres * yres);
+        parts[1] = {text.data(), text.size()};
+    }
+    writeOutput(path, parts, 2);
+}
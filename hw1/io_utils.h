@@ -11,6 +11,11 @@
 
 std::string join_path(const std::string& parent, const std::string& filename);
 
+// Each vertex pair joined by an edge of faces, once, in the order and direction of its
+// first use: face by face, edges v1-v2, v2-v3 and v3-v1.
+std::vector<edge> uniqueEdges(const std::vector<face>& faces);
+
+// Loads each mesh along with its unique edges.
 std::vector<object> loadObjects(const std::vector<std::string>& fpaths,
                                 std::string parent_path);
 
@@ -46,6 +51,22 @@ struct ParseSceneFileResult {
 
 ParseSceneFileResult parseSceneFile(std::ifstream& fin, std::string parent_path);
 
-void writePPM(const std::vector<uint8_t>& img, size_t xres, size_t yres);
+// A byte range for writeOutput.
+struct OutputPart {
+    const void* data;
+    size_t size;
+};
+
+// Writes parts[0..count) in order to path, or to stdout when path is empty or "-", with as
+// few writev calls as the system allows. Throws std::runtime_error on failure.
+void writeOutput(const std::string& path, const OutputPart* parts, size_t count);
+
+// PPM encodings: binary (P6) or ASCII (P3), one "r g b" line per pixel.
+enum class PpmFormat { P6, P3 };
+
+// Writes the image to path, or to stdout when path is empty or "-", through writeOutput:
+// the header and pixels go out in one writev.
+void writePPM(const std::vector<uint8_t>& img, size_t xres, size_t yres,
+              PpmFormat format = PpmFormat::P6, const std::string& path = "");
 
 #endif
\ No newline at end of file
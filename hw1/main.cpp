@@ -1,6 +1,7 @@
 #include "scene_types.h"
 #include "io_utils.h"
 #include "transform_utils.h"
+#include "png_utils.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -72,34 +73,64 @@ void draw_line(int x0,int y0,int x1,int y1,
     }
 }
 
-std::vector<uint8_t> drawWireframe(std::vector<object> scene_objects, size_t xres, size_t yres){
+// Draws each object's unique edges, so an edge two faces share is drawn (and blended) once.
+std::vector<uint8_t> drawWireframe(const std::vector<object>& scene_objects, size_t xres, size_t yres){
     std::vector<uint8_t> img(xres*yres*3, 0); // background (black)
     for (const auto& obj: scene_objects){
-        for (const auto& face: obj.faces){
-            int x1 = static_cast<int>(std::lround(obj.vertices[face.v1].x));
-            int y1 = static_cast<int>(std::lround(obj.vertices[face.v1].y));
-            int x2 = static_cast<int>(std::lround(obj.vertices[face.v2].x));
-            int y2 = static_cast<int>(std::lround(obj.vertices[face.v2].y));
-            int x3 = static_cast<int>(std::lround(obj.vertices[face.v3].x));
-            int y3 = static_cast<int>(std::lround(obj.vertices[face.v3].y));
+        for (const auto& e: obj.edges){
+            int x1 = static_cast<int>(std::lround(obj.vertices[e.a].x));
+            int y1 = static_cast<int>(std::lround(obj.vertices[e.a].y));
+            int x2 = static_cast<int>(std::lround(obj.vertices[e.b].x));
+            int y2 = static_cast<int>(std::lround(obj.vertices[e.b].y));
 
             draw_line(x1, y1, x2, y2, 255, 255, 255, xres, yres, img);
-            draw_line(x2, y2, x3, y3, 255, 255, 255, xres, yres, img);
-            draw_line(x3, y3, x1, y1, 255, 255, 255, xres, yres, img);
         }
     }
     return img;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres]\n";
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres] [options]\n"
+                  << "Options:\n"
+                  << "  --output PATH write the image to PATH instead of stdout\n"
+                  << "  --ascii       write ASCII P3 (the default before P6) instead of binary P6, the default\n"
+                  << "  --png         write PNG instead of PPM\n"
+                  << "  --png-level N PNG compression level, 0 (none) to 9 (default 6)\n"
+                  << "  --threads N   PNG encoder threads, 0 = one per core (default 1)\n";
         return 1;
     }
 
     size_t xres = parse_size_t(argv[2]);
     size_t yres = parse_size_t(argv[3]);
 
+    PpmFormat out_format = PpmFormat::P6;
+    std::string out_path;
+    bool out_png = false;
+    PngOptions png_opts;
+    for (int i = 4; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (flag == "--output" && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (flag == "--ascii") {
+            out_format = PpmFormat::P3;
+        } else if (flag == "--png") {
+            out_png = true;
+        } else if (flag == "--png-level" && i + 1 < argc) {
+            out_png = true;
+            png_opts.level = static_cast<int>(parse_size_t(argv[++i]));
+            if (png_opts.level > 9) {
+                std::cerr << "Invalid --png-level " << argv[i] << ", must be 0 to 9\n";
+                return 1;
+            }
+        } else if (flag == "--threads" && i + 1 < argc) {
+            png_opts.threads = static_cast<unsigned>(parse_size_t(argv[++i]));
+        } else {
+            std::cerr << "Unknown option: " << flag << "\n";
+            return 1;
+        }
+    }
+
     std::string parent_path = parse_parent_path(argv[1]);
     std::ifstream fin(argv[1]);
     if (!fin) {
@@ -118,5 +149,14 @@ int main(int argc, char* argv[]) {
 
     std::vector<uint8_t> img = drawWireframe(scene_objects_ndc, xres, yres);
 
-    writePPM(img, xres, yres);
+    try {
+        if (out_png) {
+            writePNG(img, xres, yres, png_opts, out_path);
+        } else {
+            writePPM(img, xres, yres, out_format, out_path);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef PNG_UTILS_H
+#define PNG_UTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct PngOptions {
+    int level = 6; // zlib compression level, 0 (stored) to 9
+    unsigned threads = 1; // encoder threads, 0 = one per hardware thread
+};
+
+// An encoded PNG as consecutive byte ranges, in file order.
+struct PngBuffers {
+    std::vector<std::vector<uint8_t>> parts;
+    size_t size() const;
+};
+
+// Encodes the xres x yres RGB image as an 8-bit RGB PNG. Rows are split into bands that are filtered and deflated
+// independently, pigz-style: each band is primed with the 32 KiB of filtered data before
+// it and ends on a byte boundary, so the bands join into one valid zlib stream. Each band
+// becomes its own IDAT chunk, and the result does not depend on the thread count.
+PngBuffers encodePNG(const std::vector<uint8_t>& img, size_t xres, size_t yres, const PngOptions& opts = PngOptions());
+
+// Encodes the image and writes it to path, or to stdout when path is empty or "-". Throws
+// std::runtime_error on failure.
+void writePNG(const std::vector<uint8_t>& img, size_t xres, size_t yres, const PngOptions& opts = PngOptions(),
+              const std::string& path = "");
+
+#endif
@@ -15,10 +15,16 @@ struct face {
     unsigned int v1, v2, v3;
 };
 
+// An edge between vertices a and b, as the first face to use it runs.
+struct edge {
+    unsigned int a, b;
+};
+
 struct object {
     std::string filename;
     std::vector<vertex> vertices;
     std::vector<face> faces;
+    std::vector<edge> edges; // each vertex pair the faces join, once, from uniqueEdges
     void print() const;
 };
 
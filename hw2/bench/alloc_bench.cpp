@@ -0,0 +1,88 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "shading_utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+int bench_alloc(const std::vector<std::string>& args) {
+    // Heap allocations per frame in every mode, for a fresh shade_by_mode call on a new blank
+    // image and for the fourth iteration of a render loop that clears one image and draws the
+    // same const Scene into it through one FrameArena, with the time of each. The loop is
+    // counted whole. "wireframe (no edges)"
+    // loads the meshes without their edge lists, which the arena then builds and keeps.
+    unsigned threads = args.size() > 0 ? static_cast<unsigned>(std::stoul(args[0])) : 4;
+    size_t xres = args.size() > 1 ? std::stoul(args[1]) : 1920;
+    size_t yres = args.size() > 2 ? std::stoul(args[2]) : 1080;
+    std::vector<std::string> scenes(args.begin() + std::min<size_t>(args.size(), 3), args.end());
+    if (scenes.empty()) {
+        scenes = {"data/scene_kitten.txt", stage_scene("data/scene_armadillo.txt", "../hw5/armadillo.obj")};
+    }
+
+    struct Variant {
+        const char* name;
+        size_t mode;
+        RenderOptions opts;
+        bool edges;
+    };
+    std::vector<Variant> variants = {{"gouraud", 0, {}, true}, {"phong", 1, {}, true}, {"flat", 2, {}, true},
+                                     {"wireframe", 3, {}, true}, {"wireframe (no edges)", 3, {}, false}};
+    variants.push_back({"deferred", 1, {}, true});
+    variants.back().opts.deferred = true;
+    variants.push_back({"front-to-back", 0, {}, true});
+    variants.back().opts.front_to_back = true;
+    variants.push_back({"light-cutoff", 1, {}, true});
+    variants.back().opts.light_cutoff = 1.0 / 255;
+
+    std::cout << xres << "x" << yres << ", " << threads << " threads\n"
+              << std::left << std::setw(24) << "scene" << std::setw(22) << "frame" << std::right << std::setw(14)
+              << "fresh allocs" << std::setw(10) << "ms" << std::setw(14) << "arena allocs" << std::setw(10) << "ms"
+              << "\n";
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        LoadOptions load;
+        load.edges = true;
+        Scene with_edges = parse_scene_file(fin, parse_parent_path(path), load);
+        fin.clear();
+        fin.seekg(0);
+        load.edges = false;
+        Scene without_edges = parse_scene_file(fin, parse_parent_path(path), load);
+        std::string name = path.substr(path.find_last_of('/') + 1);
+
+        for (Variant& v : variants) {
+            v.opts.threads = threads;
+            const Scene& scene = v.edges ? with_edges : without_edges;
+            size_t fresh_allocs = 0, arena_allocs = 0;
+            double fresh = 1e300, reused = 1e300;
+            for (int rep = 0; rep < 4; ++rep) {
+                Image img = blank_image(xres, yres);
+                size_t before = heap_allocations();
+                fresh = std::min(fresh, best_of(1, [&] { shade_by_mode(img, scene, v.mode, v.opts); }));
+                fresh_allocs = heap_allocations() - before;
+            }
+            // A render loop: one image and one arena, cleared and redrawn from the same scene
+            FrameArena arena;
+            Image img = blank_image(xres, yres);
+            for (int rep = 0; rep < 4; ++rep) {
+                size_t before = heap_allocations();
+                reused = std::min(reused, best_of(1, [&] {
+                    std::fill(img.img.begin(), img.img.end(), uint8_t(0));
+                    img.z_buf.clear();
+                    shade_by_mode(img, scene, v.mode, arena, v.opts);
+                }));
+                arena_allocs = heap_allocations() - before;
+            }
+            std::cout << std::left << std::setw(24) << name << std::setw(22) << v.name << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(14) << fresh_allocs << std::setw(10) << fresh * 1000.0
+                      << std::setw(14) << arena_allocs << std::setw(10) << reused * 1000.0 << "\n";
+            std::cout.unsetf(std::ios::fixed);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include "bench.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Every heap allocation the bench binary makes goes through here. Kept apart from the
+// suites so that the compiler never sees these inlined into their containers.
+namespace {
+std::atomic<size_t> g_allocations{0};
+} // namespace
+
+size_t heap_allocations() {
+    return g_allocations;
+}
+
+void* operator new(size_t size) {
+    ++g_allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// The array forms default to these
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
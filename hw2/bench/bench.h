@@ -0,0 +1,62 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "scene_types.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Wall-clock seconds for the best of `reps` runs of fn().
+template <typename Fn>
+double best_of(int reps, Fn&& fn) {
+    double best = 1e300;
+    for (int i = 0; i < reps; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        auto t1 = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(t1 - t0).count();
+        if (s < best) best = s;
+    }
+    return best;
+}
+
+// Black image with an empty depth buffer, as main.cpp starts a frame.
+Image blank_image(size_t xres, size_t yres);
+
+// Returns path, or a /tmp copy rewritten to v//vn form if path is a position-only mesh.
+std::string with_normals(const std::string& path);
+
+// Copies a scene to /tmp next to a link to mesh (rewritten by with_normals), for the
+// hw2 scenes whose meshes only exist position-only elsewhere in the repo. Returns the
+// copied scene's path, or "" on failure.
+std::string stage_scene(const std::string& scene, const std::string& mesh);
+
+// Writes a scene of n randomly turned instances of mesh stacked down the view axis to
+// /tmp, in random order or sorted nearest first. Returns its path, or "" on failure.
+std::string stacked_scene(size_t n, const std::string& mesh, bool nearest_first);
+
+// Calls to operator new so far in this process, counted by bench/alloc_hook.cpp.
+size_t heap_allocations();
+
+// Each suite takes the arguments that follow its name on the command line.
+int bench_obj(const std::vector<std::string>& args);
+int bench_obj_threads(const std::vector<std::string>& args);
+int bench_instances(const std::vector<std::string>& args);
+int bench_shade(const std::vector<std::string>& args);
+int bench_raster(const std::vector<std::string>& args);
+int bench_raster_threads(const std::vector<std::string>& args);
+int bench_deferred(const std::vector<std::string>& args);
+int bench_ppm(const std::vector<std::string>& args);
+int bench_png(const std::vector<std::string>& args);
+int bench_depth(const std::vector<std::string>& args);
+int bench_layout(const std::vector<std::string>& args);
+int bench_hiz(const std::vector<std::string>& args);
+int bench_order(const std::vector<std::string>& args);
+int bench_lighting(const std::vector<std::string>& args);
+int bench_light_culling(const std::vector<std::string>& args);
+int bench_lines(const std::vector<std::string>& args);
+int bench_alloc(const std::vector<std::string>& args);
+
+#endif
@@ -0,0 +1,50 @@
+#include "bench.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Micro-benchmarks for the shaded renderer. Run from the hw2 directory:
+//   ./bench/shaded_bench <suite> [args...]
+
+struct Suite {
+    const char* name;
+    const char* usage;
+    int (*run)(const std::vector<std::string>& args);
+};
+
+static const Suite kSuites[] = {
+    {"obj", "[file.obj ...]   OBJ load throughput in MB/s", bench_obj},
+    {"obj-threads", "[file.obj] [max_threads] [MB]   chunked OBJ parser scaling", bench_obj_threads},
+    {"instances", "[N] [file.obj]   memory of an N-instance generated scene", bench_instances},
+    {"shade", "[xres] [yres] [scene.txt ...]   shade_by_mode faces/sec in modes 0-3", bench_shade},
+    {"raster", "[N]   triangle rasterizer pixels/sec against the per-pixel baseline", bench_raster},
+    {"raster-threads", "[max_threads] [xres] [yres]   tiled renderer scaling, 4K by default", bench_raster_threads},
+    {"deferred", "[xres] [yres] [scene.txt ...]   forward vs deferred Phong lighting calls and time", bench_deferred},
+    {"ppm", "[sink ...]   write_ppm MB/s for P3 and P6 at 1080p, 4K and 8K", bench_ppm},
+    {"png", "[max_threads] [scene.txt]   write_png MB/s by level and threads, against P6 and libpng", bench_png},
+    {"depth", "[xres] [yres] [scene.txt ...]   clear and shade time per depth format, and pixels changed", bench_depth},
+    {"layout", "[xres] [yres] [scene.txt ...]   linear vs tiled framebuffer time and cache misses", bench_layout},
+    {"hiz", "[N] [xres] [yres] [mesh.obj]   Hi-Z culling on N stacked instances, shuffled and front to back", bench_hiz},
+    {"order", "[xres] [yres] [scene.txt ...]   overdraw in file order vs front to back", bench_order},
+    {"lighting", "[points] [xres] [yres] [scene.txt ...]   scalar, exact and fast Phong lighting throughput and error", bench_lighting},
+    {"lights", "[N] [xres] [yres]   tiled light culling on a generated N-light scene (256 by default)", bench_light_culling},
+    {"lines", "[max_threads] [xres] [yres] [scene.txt]   line raster lines/sec and threaded wireframe, 4K scene_bunny1 by default", bench_lines},
+    {"alloc", "[threads] [xres] [yres] [scene.txt ...]   heap allocations per frame, fresh and through a FrameArena", bench_alloc},
+};
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2) {
+        std::vector<std::string> args(argv + 2, argv + argc);
+        for (const auto& s : kSuites) {
+            if (std::strcmp(argv[1], s.name) == 0) return s.run(args);
+        }
+    }
+
+    std::cerr << "Usage: " << argv[0] << " <suite> [args...]\n";
+    for (const auto& s : kSuites) {
+        std::cerr << "  " << s.name << " " << s.usage << "\n";
+    }
+    return 1;
+}
@@ -0,0 +1,54 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "shading_utils.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+int bench_deferred(const std::vector<std::string>& args) {
+    // Forward against deferred Phong on the same frame: lighting() calls, time, and a check
+    // that the images match.
+    size_t xres = args.size() > 0 ? std::stoul(args[0]) : 1920;
+    size_t yres = args.size() > 1 ? std::stoul(args[1]) : 1080;
+    std::vector<std::string> scenes(args.begin() + std::min<size_t>(args.size(), 2), args.end());
+    if (scenes.empty()) {
+        scenes = {"data/scene_kitten.txt", stage_scene("data/scene_bunny1.txt", "../hw5/bunny.obj"),
+                  stage_scene("data/scene_armadillo.txt", "../hw5/armadillo.obj")};
+    }
+
+    std::cout << std::left << std::setw(24) << "scene" << std::setw(10) << "path" << std::right
+              << std::setw(14) << "invocations" << std::setw(10) << "ms" << "\n";
+
+    int status = 0;
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        Scene scene = parse_scene_file(fin, parse_parent_path(path));
+        std::string name = path.substr(path.find_last_of('/') + 1);
+
+        PixelBuffer images[2];
+        for (int deferred = 0; deferred < 2; ++deferred) {
+            RenderOptions opts;
+            opts.deferred = deferred != 0;
+            RenderStats stats;
+            double best = 1e300;
+            for (int rep = 0; rep < 5; ++rep) {
+                Image img = blank_image(xres, yres);
+                best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, 1, opts, &stats); }));
+                images[deferred] = std::move(img.img);
+            }
+            std::cout << std::left << std::setw(24) << name << std::setw(10) << (deferred ? "deferred" : "forward")
+                      << std::right << std::setw(14) << stats.shading_invocations << std::fixed
+                      << std::setprecision(2) << std::setw(10) << best * 1000.0 << "\n";
+        }
+        if (images[0] != images[1]) {
+            std::cerr << name << ": deferred image differs from forward\n";
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,59 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "raster_utils.h"
+#include "shading_utils.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+int bench_depth(const std::vector<std::string>& args) {
+    // Each depth format on the same frames: time to allocate and clear the framebuffer, time
+    // to shade, and how many pixels come out different from the double-depth image.
+    size_t xres = args.size() > 0 ? std::stoul(args[0]) : 3840;
+    size_t yres = args.size() > 1 ? std::stoul(args[1]) : 2160;
+    std::vector<std::string> scenes(args.begin() + std::min<size_t>(args.size(), 2), args.end());
+    if (scenes.empty()) {
+        scenes = {"data/scene_kitten.txt", stage_scene("data/scene_armadillo.txt", "../hw5/armadillo.obj")};
+    }
+
+    std::cout << std::left << std::setw(24) << "scene" << std::right << std::setw(6) << "mode" << std::setw(10)
+              << "depth" << std::setw(10) << "MB" << std::setw(11) << "clear ms" << std::setw(11) << "shade ms"
+              << std::setw(12) << "px differ" << "\n";
+
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        Scene scene = parse_scene_file(fin, parse_parent_path(path));
+        std::string name = path.substr(path.find_last_of('/') + 1);
+
+        for (size_t mode : {0, 2}) {
+            PixelBuffer reference;
+            for (DepthFormat format : {DepthFormat::Double, DepthFormat::Float, DepthFormat::Unorm24}) {
+                double clear = 1e300, shade = 1e300;
+                Image img;
+                for (int rep = 0; rep < 3; ++rep) {
+                    img = Image();
+                    clear = std::min(clear, best_of(1, [&] {
+                        img = Image{PixelBuffer(xres * yres * 3), DepthBuffer(xres * yres, format), xres, yres};
+                    }));
+                    shade = std::min(shade, best_of(1, [&] { shade_by_mode(img, scene, mode); }));
+                }
+                if (format == DepthFormat::Double) reference = img.img;
+                size_t differ = 0;
+                for (size_t i = 0; i < reference.size(); i += 3) {
+                    differ += !std::equal(&reference[i], &reference[i] + 3, &img.img[i]);
+                }
+                double mb = xres * yres * DepthBuffer::bytes_per_pixel(format) / 1e6;
+                std::cout << std::left << std::setw(24) << name << std::right << std::setw(6) << mode
+                          << std::setw(10) << depth_format_name(format) << std::fixed << std::setprecision(1)
+                          << std::setw(10) << mb << std::setprecision(2) << std::setw(11) << clear * 1000.0
+                          << std::setw(11) << shade * 1000.0 << std::setw(12) << differ << "\n";
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "shading_utils.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+
+namespace {
+
+struct Placement {
+    double angle, x, y, z;
+};
+
+// Writes a scene of the given instances of mesh (already linked into /tmp) to path.
+void write_stack(const std::string& path, const std::string& mesh_name, const std::vector<Placement>& stack) {
+    std::ofstream out(path);
+    out << "camera:\nposition 0 0 12\norientation 0 1 0 0\nnear 1\nfar 40\n"
+        << "left -0.5\nright 0.5\ntop 0.5\nbottom -0.5\n\n"
+        << "light 2 2 5 , 1 1 1 , 0\n\nobjects:\nmesh " << mesh_name << "\n\n";
+    for (const Placement& p : stack) {
+        out << "mesh\nambient 0.2 0.2 0.2\ndiffuse 0.6 0.6 0.6\nspecular 0.2 0.2 0.2\nshininess 1\n"
+            << "r 0 1 0 " << p.angle << "\n"
+            << "t " << p.x << " " << p.y << " " << p.z << "\n\n";
+    }
+}
+
+} // namespace
+
+std::string stacked_scene(size_t n, const std::string& mesh, bool nearest_first) {
+    // Object paths are relative to the scene file, so link the mesh next to it
+    std::string mesh_name = mesh.substr(mesh.find_last_of('/') + 1);
+    std::string link = "/tmp/" + mesh_name;
+    char abs_mesh[PATH_MAX];
+    if (!::realpath(with_normals(mesh).c_str(), abs_mesh)) return "";
+    ::unlink(link.c_str());
+    if (::symlink(abs_mesh, link.c_str()) != 0) return "";
+
+    std::mt19937 rng(171);
+    std::uniform_real_distribution<double> ang(-3.14, 3.14), lateral(-1.5, 1.5), depth(-20.0, 4.0);
+    std::vector<Placement> stack(n);
+    for (Placement& p : stack) p = Placement{ang(rng), lateral(rng), lateral(rng), depth(rng)};
+    if (nearest_first) {
+        std::sort(stack.begin(), stack.end(), [](const Placement& a, const Placement& b) { return a.z > b.z; });
+    }
+    std::string path = std::string("/tmp/scene_stack_") + (nearest_first ? "front-to-back" : "shuffled") + ".txt";
+    write_stack(path, mesh_name, stack);
+    return path;
+}
+
+int bench_hiz(const std::vector<std::string>& args) {
+    // N instances of one mesh stacked down the view axis, so most of them hide behind the
+    // nearer ones, rendered with and without Hi-Z culling in shuffled and in front-to-back
+    // submission order: shade_by_mode time and what was culled. Fails if culling changes
+    // the image.
+    size_t n = args.size() > 0 ? std::stoul(args[0]) : 200;
+    size_t xres = args.size() > 1 ? std::stoul(args[1]) : 1920;
+    size_t yres = args.size() > 2 ? std::stoul(args[2]) : 1080;
+    std::string mesh = args.size() > 3 ? args[3] : "data/kitten.obj";
+
+    std::cout << std::left << std::setw(16) << "order" << std::right << std::setw(6) << "mode" << std::setw(8) << "hi-z"
+              << std::setw(10) << "ms" << std::setw(16) << "culled tris" << std::setw(16) << "culled objs" << "\n";
+    for (bool nearest_first : {false, true}) {
+        const char* order = nearest_first ? "front-to-back" : "shuffled";
+        std::string path = stacked_scene(n, mesh, nearest_first);
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Could not stage " << n << " instances of " << mesh << "\n";
+            return 1;
+        }
+        Scene scene = parse_scene_file(fin, parse_parent_path(path));
+
+        for (size_t mode : {0, 1, 2}) {
+            PixelBuffer reference;
+            for (bool hiz : {false, true}) {
+                RenderOptions opts;
+                opts.hiz = hiz;
+                RenderStats stats;
+                Image img;
+                double best = 1e300;
+                for (int rep = 0; rep < 3; ++rep) {
+                    img = blank_image(xres, yres);
+                    best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, mode, opts, &stats); }));
+                }
+                if (!hiz) {
+                    reference = img.img;
+                } else if (img.img != reference) {
+                    std::cerr << "Hi-Z changed the image: " << order << " mode " << mode << "\n";
+                    return 1;
+                }
+                std::cout << std::left << std::setw(16) << order << std::right << std::setw(6) << mode
+                          << std::setw(8) << (hiz ? "on" : "off") << std::fixed << std::setprecision(2)
+                          << std::setw(10) << best * 1000.0 << std::setw(16) << stats.culled_triangles
+                          << std::setw(16) << stats.culled_objects << "\n";
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "bench.h"
+#include "io_utils.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+
+size_t mesh_bytes(const Object& obj) {
+    return obj.vertices.capacity() * sizeof(Vertex) + obj.normals.capacity() * sizeof(Normal) +
+           obj.faces.capacity() * sizeof(Face);
+}
+
+double peak_rss_mb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss / (1024.0 * 1024.0); // bytes
+#else
+    return ru.ru_maxrss / 1024.0; // kilobytes
+#endif
+}
+
+} // namespace
+
+int bench_instances(const std::vector<std::string>& args) {
+    // Writes a scene with N randomly placed instances of one mesh and loads it, reporting
+    // how much mesh memory the instances actually hold compared with one copy each.
+    size_t n = args.size() > 0 ? std::stoul(args[0]) : 1000;
+    std::string mesh = args.size() > 1 ? args[1] : "data/kitten.obj";
+    std::string scene_path = "/tmp/scene_instances_" + std::to_string(n) + ".txt";
+
+    // Object paths are relative to the scene file, so link the mesh next to it
+    std::string mesh_name = mesh.substr(mesh.find_last_of('/') + 1);
+    char abs_mesh[PATH_MAX];
+    if (!::realpath(mesh.c_str(), abs_mesh)) {
+        std::cerr << "Could not find " << mesh << "\n";
+        return 1;
+    }
+    std::string link_path = "/tmp/" + mesh_name;
+    ::unlink(link_path.c_str());
+    if (::symlink(abs_mesh, link_path.c_str()) != 0) {
+        std::cerr << "Could not link " << link_path << "\n";
+        return 1;
+    }
+
+    {
+        std::ofstream out(scene_path);
+        out << "camera:\nposition 0 0 12\norientation 0 1 0 0\nnear 1\nfar 40\n"
+            << "left -0.5\nright 0.5\ntop 0.5\nbottom -0.5\n\n"
+            << "light 2 2 5 , 1 1 1 , 0\n\nobjects:\nmesh " << mesh_name << "\n\n";
+        std::mt19937 rng(171);
+        std::uniform_real_distribution<double> pos(-4.0, 4.0), ang(-3.14, 3.14);
+        for (size_t i = 0; i < n; ++i) {
+            out << "mesh\nambient 0.2 0.2 0.2\ndiffuse 0.6 0.6 0.6\nspecular 0.2 0.2 0.2\nshininess 1\n"
+                << "r 0 1 0 " << ang(rng) << "\n"
+                << "t " << pos(rng) << " " << pos(rng) << " " << pos(rng) - 4.0 << "\n\n";
+        }
+    }
+
+    double rss_before = peak_rss_mb();
+    std::ifstream fin(scene_path);
+    Scene scene;
+    double secs = best_of(1, [&] { scene = parse_scene_file(fin, parse_parent_path(scene_path)); });
+
+    std::set<const Object*> unique;
+    size_t shared_bytes = 0, per_instance_bytes = 0;
+    for (const auto& inst : scene.scene_objects) {
+        if (unique.insert(inst.mesh.get()).second) shared_bytes += mesh_bytes(*inst.mesh);
+        per_instance_bytes += mesh_bytes(*inst.mesh);
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "scene            " << scene_path << "\n"
+              << "instances        " << scene.scene_objects.size() << "\n"
+              << "unique meshes    " << unique.size() << "\n"
+              << "mesh memory      " << shared_bytes / (1024.0 * 1024.0) << " MB\n"
+              << "as deep copies   " << per_instance_bytes / (1024.0 * 1024.0) << " MB\n"
+              << "load time        " << secs * 1000.0 << " ms\n"
+              << "peak RSS growth  " << peak_rss_mb() - rss_before << " MB\n"
+              << "render with      ./shaded_renderer " << scene_path << " 800 800 0\n";
+    return 0;
+}
@@ -0,0 +1,234 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "raster_utils.h"
+#include "shading_utils.h"
+#include "transform_utils.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// One hardware cache event for this thread, or an fd of -1 where perf is unavailable (as
+// in most VMs and containers).
+class CacheCounter {
+public:
+    CacheCounter(uint32_t type, uint64_t config) {
+        perf_event_attr attr = perf_event_attr();
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~CacheCounter() {
+        if (fd_ >= 0) close(fd_);
+    }
+    bool available() const { return fd_ >= 0; }
+    void start() {
+        if (fd_ < 0) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t stop() {
+        uint64_t n = 0;
+        if (fd_ < 0) return n;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd_, &n, sizeof(n)) != sizeof(n)) n = 0;
+        return n;
+    }
+
+private:
+    int fd_;
+};
+
+const uint64_t kL1dReadMiss = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                              PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+
+// Set-associative LRU cache of 64-byte lines, counting misses.
+class CacheModel {
+public:
+    CacheModel(size_t bytes, size_t ways) : ways_(ways), sets_(bytes / 64 / ways), tags_(sets_ * ways, ~uint64_t(0)) {}
+    // True on a hit; a miss brings the line in over the least recently used one
+    bool touch(uint64_t line) {
+        uint64_t* set = &tags_[(line % sets_) * ways_];
+        for (size_t i = 0; i < ways_; ++i) {
+            if (set[i] == line) {
+                for (; i > 0; --i) set[i] = set[i - 1];
+                set[0] = line;
+                return true;
+            }
+        }
+        for (size_t i = ways_ - 1; i > 0; --i) set[i] = set[i - 1];
+        set[0] = line;
+        ++misses;
+        return false;
+    }
+    size_t misses = 0;
+
+private:
+    size_t ways_, sets_;
+    std::vector<uint64_t> tags_;
+};
+
+// A 32 KiB 8-way L1 backed by a 1 MiB 16-way L2, fed byte ranges.
+struct CacheHierarchy {
+    CacheModel l1{32 << 10, 8};
+    CacheModel l2{1 << 20, 16};
+    size_t accesses = 0;
+    void access(uintptr_t addr, size_t bytes) {
+        ++accesses;
+        for (uintptr_t line = addr / 64; line <= (addr + bytes - 1) / 64; ++line) {
+            if (!l1.touch(line)) l2.touch(line);
+        }
+    }
+};
+
+// Screen triangles of the frame in submission order, as the renderer sets them up;
+// faces needing near or guard-band clipping are left out, as they are rare in these scenes.
+std::vector<TriangleSetup> frame_triangles(Scene scene, const Image& img) {
+    world_to_view(scene);
+    std::vector<TriangleSetup> tris;
+    std::vector<Vertex> view;
+    std::vector<ScreenVertex> screen;
+    for (const ObjectInstance& inst : scene.scene_objects) {
+        transform_vertices(inst.mesh->vertices, inst.transform, view);
+        project_to_screen(view, scene.cam_transforms.P, img, screen);
+        for (const Face& f : inst.mesh->faces) {
+            const ScreenVertex &a = screen[f.v1], &b = screen[f.v2], &c = screen[f.v3];
+            if ((a.clip | b.clip | c.clip) & (CLIP_XY | CLIP_NEEDS_CLIPPING | CLIP_FAR)) continue;
+            // The renderer's backface test
+            if ((c.ndc_x - b.ndc_x) * (a.ndc_y - b.ndc_y) - (c.ndc_y - b.ndc_y) * (a.ndc_x - b.ndc_x) < 0) continue;
+            TriangleSetup t;
+            if (setup_triangle(a, b, c, img, t)) tris.push_back(t);
+        }
+    }
+    return tris;
+}
+
+// Replays the framebuffer traffic of a single-threaded binned frame through the cache
+// model: every covered pixel reads its depth, and those passing the test write depth and
+// color. Addresses come from img's own planes and Image::pixel_index.
+void replay_frame(const std::vector<TriangleSetup>& tris, Image& img, CacheHierarchy& cache) {
+    TileBins bins = make_tile_bins(img);
+    for (size_t i = 0; i < tris.size(); ++i) bin_triangle(bins, tris[i], static_cast<uint32_t>(i));
+    std::vector<double> depth(img.z_buf.size(), 1.0);
+    const uintptr_t z_base = reinterpret_cast<uintptr_t>(img.z_buf.data());
+    const uintptr_t c_base = reinterpret_cast<uintptr_t>(img.img.data());
+    const size_t zbytes = DepthBuffer::bytes_per_pixel(img.z_buf.format());
+
+    for (size_t tile = 0; tile < bins.tris.size(); ++tile) {
+        PixelRect clip = tile_rect(bins, tile);
+        for (uint32_t index : bins.tris[tile]) {
+            const TriangleSetup& t = tris[index];
+            int x0 = std::max(t.x_min, clip.x_min), x1 = std::min(t.x_max, clip.x_max);
+            int y0 = std::max(t.y_min, clip.y_min), y1 = std::min(t.y_max, clip.y_max);
+            for (int y = y0; y <= y1; ++y) {
+                for (int x = x0; x <= x1; ++x) {
+                    int64_t e[3];
+                    bool inside = true;
+                    for (int k = 0; k < 3; ++k) {
+                        e[k] = t.row[k] + t.step_x[k] * (x - t.x_min) + t.step_y[k] * (y - t.y_min);
+                        inside &= e[k] >= 0 && t.area[k] - e[k] >= 0;
+                    }
+                    if (!inside) continue;
+                    double z = (e[0] * t.z[0]) / t.area_d[0] + (e[1] * t.z[1]) / t.area_d[1] +
+                               (e[2] * t.z[2]) / t.area_d[2];
+                    size_t i = img.pixel_index(x, y);
+                    cache.access(z_base + i * zbytes, zbytes);
+                    if (z > depth[i]) continue;
+                    depth[i] = z;
+                    cache.access(z_base + i * zbytes, zbytes);
+                    cache.access(c_base + i * 3, 3);
+                }
+            }
+        }
+    }
+}
+
+Image layout_image(size_t xres, size_t yres, PixelLayout layout) {
+    size_t pixels = layout_pixels(xres, yres, layout);
+    Image img{PixelBuffer(pixels * 3), DepthBuffer(pixels), xres, yres};
+    img.layout = layout;
+    return img;
+}
+
+std::string misses(bool available, uint64_t n) {
+    if (!available) return "n/a";
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(2) << n / 1e6;
+    return s.str();
+}
+
+} // namespace
+
+int bench_layout(const std::vector<std::string>& args) {
+    // Linear against Tiled framebuffers on the same frames: shade time and hardware L1D
+    // read misses per mode, then the modelled misses of the frame's depth and color traffic.
+    size_t xres = args.size() > 0 ? std::stoul(args[0]) : 3840;
+    size_t yres = args.size() > 1 ? std::stoul(args[1]) : 2160;
+    std::vector<std::string> scenes(args.begin() + std::min<size_t>(args.size(), 2), args.end());
+    if (scenes.empty()) {
+        scenes = {"data/scene_kitten.txt", stage_scene("data/scene_armadillo.txt", "../hw5/armadillo.obj")};
+    }
+    const PixelLayout layouts[] = {PixelLayout::Linear, PixelLayout::Tiled};
+    CacheCounter l1d(PERF_TYPE_HW_CACHE, kL1dReadMiss);
+    if (!l1d.available()) std::cerr << "Hardware cache counters unavailable, reporting n/a\n";
+
+    std::cout << std::left << std::setw(24) << "scene" << std::right << std::setw(6) << "mode" << std::setw(9)
+              << "layout" << std::setw(11) << "shade ms" << std::setw(14) << "L1D miss M" << "\n";
+    std::vector<std::pair<std::string, Scene>> loaded;
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        loaded.emplace_back(path.substr(path.find_last_of('/') + 1), parse_scene_file(fin, parse_parent_path(path)));
+        const std::string& name = loaded.back().first;
+        const Scene& scene = loaded.back().second;
+
+        for (size_t mode : {0, 1, 2}) {
+            for (PixelLayout layout : layouts) {
+                double best = 1e300;
+                uint64_t miss = ~uint64_t(0);
+                for (int rep = 0; rep < 3; ++rep) {
+                    Image img = layout_image(xres, yres, layout);
+                    l1d.start();
+                    best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, mode); }));
+                    miss = std::min(miss, l1d.stop());
+                }
+                std::cout << std::left << std::setw(24) << name << std::right << std::setw(6) << mode
+                          << std::setw(9) << pixel_layout_name(layout) << std::fixed << std::setprecision(2)
+                          << std::setw(11) << best * 1000.0 << std::setw(14) << misses(l1d.available(), miss)
+                          << "\n";
+            }
+        }
+    }
+
+    std::cout << "\nModelled framebuffer traffic (32 KiB 8-way L1, 1 MiB 16-way L2, 64 B lines)\n"
+              << std::left << std::setw(24) << "scene" << std::right << std::setw(9) << "layout" << std::setw(13)
+              << "accesses M" << std::setw(13) << "L1 miss M" << std::setw(13) << "L2 miss M" << "\n";
+    for (const auto& entry : loaded) {
+        for (PixelLayout layout : layouts) {
+            Image img = layout_image(xres, yres, layout);
+            CacheHierarchy cache;
+            replay_frame(frame_triangles(entry.second, img), img, cache);
+            std::cout << std::left << std::setw(24) << entry.first << std::right << std::setw(9)
+                      << pixel_layout_name(layout) << std::fixed << std::setprecision(2) << std::setw(13)
+                      << cache.accesses / 1e6 << std::setw(13) << cache.l1.misses / 1e6 << std::setw(13)
+                      << cache.l2.misses / 1e6 << "\n";
+        }
+    }
+    return 0;
+}
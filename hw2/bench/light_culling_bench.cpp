@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "raster_utils.h"
+#include "shading_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace {
+
+// Rewrites the staged scene at path with n small, fast-fading lights scattered through the
+// space around its mesh in place of its own. Returns the new scene's path, or "".
+std::string many_light_scene(const std::string& path, size_t n) {
+    std::ifstream in(path);
+    if (path.empty() || !in) return "";
+    std::mt19937 rng(256);
+    std::uniform_real_distribution<double> lateral(-1.5, 1.5), depth(-0.5, 2.5), col(0.05, 0.25),
+        atten(100.0, 400.0);
+    std::ostringstream lights;
+    for (size_t i = 0; i < n; ++i) {
+        double x = lateral(rng), y = lateral(rng), z = depth(rng);
+        double r = col(rng), g = col(rng), b = col(rng);
+        lights << "light " << x << " " << y << " " << z << " , " << r << " " << g << " " << b << " , " << atten(rng)
+               << "\n";
+    }
+
+    std::string out_path = "/tmp/scene_lights_" + std::to_string(n) + ".txt";
+    std::ofstream out(out_path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 6, "light ") == 0) continue;
+        if (line == "objects:") out << lights.str() << "\n";
+        out << line << "\n";
+    }
+    return out_path;
+}
+
+// kTileSize tiles of the frame holding at least one drawn pixel.
+size_t covered_tiles(const Image& img) {
+    const double* z = static_cast<const double*>(img.z_buf.data());
+    size_t n = 0;
+    for (size_t ty = 0; ty < img.yres; ty += kTileSize) {
+        for (size_t tx = 0; tx < img.xres; tx += kTileSize) {
+            bool covered = false;
+            for (size_t y = ty; y < std::min(img.yres, ty + kTileSize) && !covered; ++y) {
+                for (size_t x = tx; x < std::min(img.xres, tx + kTileSize) && !covered; ++x) {
+                    covered = !std::isinf(z[img.pixel_index(int(x), int(y))]);
+                }
+            }
+            n += covered;
+        }
+    }
+    return n;
+}
+
+} // namespace
+
+int bench_light_culling(const std::vector<std::string>& args) {
+    // A generated scene of N lights around scene_kitten.txt's kitten, each fading out within
+    // a fraction of the mesh, rendered in mode 1 with every light on every pixel and with
+    // light culling at a few cutoffs: time, lights listed per covered tile, and how many
+    // pixels the cutoff changed and by how much.
+    size_t n = args.size() > 0 ? std::stoul(args[0]) : 256;
+    size_t xres = args.size() > 1 ? std::stoul(args[1]) : 1920;
+    size_t yres = args.size() > 2 ? std::stoul(args[2]) : 1080;
+    std::string path = many_light_scene(stage_scene("data/scene_kitten.txt", "data/kitten.obj"), n);
+    std::ifstream fin(path);
+    if (path.empty() || !fin) {
+        std::cerr << "Could not write a " << n << "-light scene\n";
+        return 1;
+    }
+    Scene scene = parse_scene_file(fin, parse_parent_path(path));
+
+    std::cout << path << ": " << scene.lights.size() << " lights, " << xres << "x" << yres << "\n"
+              << std::left << std::setw(10) << "pass" << std::right << std::setw(10) << "cutoff" << std::setw(10)
+              << "ms" << std::setw(10) << "speedup" << std::setw(14) << "lights/tile" << std::setw(11) << "differ"
+              << std::setw(10) << "max diff" << "\n";
+    for (bool deferred : {false, true}) {
+        PixelBuffer reference;
+        double base = 0;
+        for (double cutoff : {0.0, 1.0 / 8192, 1.0 / 1024, 1.0 / 255}) {
+            RenderOptions opts;
+            opts.deferred = deferred;
+            opts.light_cutoff = cutoff;
+            RenderStats stats;
+            Image img;
+            double best = 1e300;
+            for (int rep = 0; rep < 3; ++rep) {
+                img = blank_image(xres, yres);
+                best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, 1, opts, &stats); }));
+            }
+            if (cutoff == 0) {
+                reference = img.img;
+                base = best;
+            }
+            size_t differ = 0;
+            int max_diff = 0;
+            for (size_t i = 0; i < img.img.size(); i += 3) {
+                bool same = true;
+                for (int c = 0; c < 3; ++c) {
+                    int d = std::abs(int(img.img[i + c]) - int(reference[i + c]));
+                    max_diff = std::max(max_diff, d);
+                    same &= d == 0;
+                }
+                differ += !same;
+            }
+            size_t tiles = covered_tiles(img);
+            double per_tile = cutoff == 0 ? double(scene.lights.size())
+                                          : double(stats.tile_lights) / std::max<size_t>(tiles, 1);
+            std::cout << std::left << std::setw(10) << (deferred ? "deferred" : "forward") << std::right << std::fixed
+                      << std::setprecision(5) << std::setw(10) << cutoff << std::setprecision(2) << std::setw(10)
+                      << best * 1000.0 << std::setw(9) << base / best << "x" << std::setprecision(1) << std::setw(14)
+                      << per_tile << std::setw(11) << differ << std::setw(10) << max_diff << "\n";
+            std::cout.unsetf(std::ios::fixed);
+        }
+    }
+    return 0;
+}
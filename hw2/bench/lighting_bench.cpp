@@ -0,0 +1,215 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "lighting_kernel.h"
+#include "raster_utils.h"
+#include "shading_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+namespace {
+
+// One float, so PowFast can be checked against std::pow lane by lane: the kernels run the
+// same IEEE single-precision operations, just several at a time.
+struct ScalarFloatLanes {
+    typedef float V;
+    static const int N = 1;
+    static V set1(double x) { return static_cast<float>(x); }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V max(V a, V b) { return a > b ? a : b; }
+    static V min(V a, V b) { return a < b ? a : b; }
+    static V if_positive(V c, V a, V b) { return c > 0 ? a : b; }
+    static V floor(V v) { return std::floor(v); }
+    static V split(V x, V& k) {
+        uint32_t bits;
+        std::memcpy(&bits, &x, 4);
+        k = static_cast<float>(static_cast<int>(bits >> 23) - 127);
+        bits = (bits & 0x007fffffu) | 0x3f800000u;
+        std::memcpy(&x, &bits, 4);
+        return x;
+    }
+    static V exp2_int(V n) {
+        uint32_t bits = static_cast<uint32_t>(static_cast<int>(n) + 127) << 23;
+        float x;
+        std::memcpy(&x, &bits, 4);
+        return x;
+    }
+};
+
+// Points on a unit sphere 4 to 6 units in front of the eye, facing it, with unnormalized
+// normals as interpolation leaves them, in SoA layout.
+struct Points {
+    std::vector<double> attrs;
+    size_t count;
+    double* v[3];
+    double* n[3];
+};
+
+Points random_points(size_t count) {
+    Points p;
+    p.count = count;
+    p.attrs.resize(6 * count);
+    for (int c = 0; c < 3; ++c) {
+        p.v[c] = &p.attrs[c * count];
+        p.n[c] = &p.attrs[(3 + c) * count];
+    }
+    std::mt19937 rng(171);
+    std::normal_distribution<double> gauss;
+    std::uniform_real_distribution<double> scale(0.8, 1.2), depth(-6.0, -4.0);
+    for (size_t i = 0; i < count; ++i) {
+        double d[3] = {gauss(rng), gauss(rng), std::abs(gauss(rng))};
+        double len = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        double s = scale(rng);
+        double z = depth(rng);
+        for (int c = 0; c < 3; ++c) {
+            p.v[c][i] = d[c] / len + (c == 2 ? z : 0.0);
+            p.n[c][i] = d[c] / len * s;
+        }
+    }
+    return p;
+}
+
+std::vector<Light> random_lights(size_t count) {
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<double> pos(-6.0, 6.0), col(0.1, 0.6), atten(0.0, 0.2);
+    std::vector<Light> lights(count);
+    for (Light& l : lights) l = Light{pos(rng), pos(rng), pos(rng) + 2.0, col(rng), col(rng), col(rng), atten(rng)};
+    return lights;
+}
+
+} // namespace
+
+int bench_lighting(const std::vector<std::string>& args) {
+    // The Phong lighting paths on the same points: points lit per second in batches of 64
+    // (a tile row) and how many come out different from lighting(), then PowFast's error
+    // against std::pow, then whole frames in modes 1 forward and deferred.
+    size_t count = args.size() > 0 ? std::stoul(args[0]) : 1 << 18;
+    size_t xres = args.size() > 1 ? std::stoul(args[1]) : 1920;
+    size_t yres = args.size() > 2 ? std::stoul(args[2]) : 1080;
+    std::vector<std::string> scenes(args.begin() + std::min<size_t>(args.size(), 3), args.end());
+    if (scenes.empty()) {
+        scenes = {"data/scene_kitten.txt", stage_scene("data/scene_armadillo.txt", "../hw5/armadillo.obj")};
+    }
+    const LightingPath paths[] = {LightingPath::Scalar, LightingPath::Exact, LightingPath::Fast};
+    // lighting() first, then each batch path on each instruction set here
+    std::vector<std::pair<RasterIsa, LightingPath>> runs = {{RasterIsa::Scalar, LightingPath::Scalar}};
+    const RasterIsa best = raster_isa();
+    for (RasterIsa isa : {RasterIsa::SSE2, RasterIsa::AVX2}) {
+        if (!set_raster_isa(isa)) continue;
+        runs.emplace_back(isa, LightingPath::Exact);
+        runs.emplace_back(isa, LightingPath::Fast);
+    }
+    set_raster_isa(best);
+
+    ObjectInstance material;
+    material.ambient = Vector3d(0.2, 0.2, 0.2);
+    material.diffuse = Vector3d(0.6, 0.6, 0.6);
+    material.specular = Vector3d(0.4, 0.4, 0.4);
+    Points points = random_points(count);
+    const size_t kBatch = 64;
+    std::vector<uint8_t> reference(3 * count), rgb(3 * count);
+
+    std::cout << std::right << std::setw(7) << "lights" << std::setw(11) << "shininess" << std::setw(8) << "isa"
+              << std::setw(8) << "path"
+              << std::setw(12) << "Mpoints/s" << std::setw(10) << "speedup" << std::setw(11) << "differ"
+              << std::setw(10) << "max diff" << "\n";
+    for (size_t n_lights : {1, 4, 16}) {
+        std::vector<Light> lights = random_lights(n_lights);
+        for (int shininess : {5, 100}) {
+            material.shininess = shininess;
+            double scalar_rate = 0;
+            for (const auto& run : runs) {
+                const LightingPath path = run.second;
+                set_raster_isa(run.first);
+                double s = best_of(3, [&] {
+                    for (size_t first = 0; first < count; first += kBatch) {
+                        size_t m = std::min(kBatch, count - first);
+                        const double* v[3] = {points.v[0] + first, points.v[1] + first, points.v[2] + first};
+                        const double* n[3] = {points.n[0] + first, points.n[1] + first, points.n[2] + first};
+                        light_fragments(path, material, lights, v, n, m, &rgb[3 * first]);
+                    }
+                });
+                if (path == LightingPath::Scalar) reference = rgb;
+                size_t differ = 0;
+                int max_diff = 0;
+                for (size_t i = 0; i < count; ++i) {
+                    bool same = true;
+                    for (int c = 0; c < 3; ++c) {
+                        int d = std::abs(int(rgb[3 * i + c]) - int(reference[3 * i + c]));
+                        max_diff = std::max(max_diff, d);
+                        same &= d == 0;
+                    }
+                    differ += !same;
+                }
+                double rate = count / s;
+                if (path == LightingPath::Scalar) scalar_rate = rate;
+                std::cout << std::setw(7) << n_lights << std::setw(11) << shininess << std::setw(8)
+                          << raster_isa_name(run.first) << std::setw(8) << lighting_path_name(path) << std::fixed
+                          << std::setprecision(2) << std::setw(12) << rate / 1e6 << std::setw(9) << rate / scalar_rate << "x" << std::setw(11) << differ
+                          << std::setw(10) << max_diff << "\n";
+                std::cout.unsetf(std::ios::fixed);
+            }
+        }
+    }
+    set_raster_isa(best);
+
+    // Relative error over x in [2^-24, 1], wherever the exact result is not flushed to 0
+    std::cout << "\nPowFast against std::pow\n"
+              << std::setw(11) << "exponent" << std::setw(16) << "max rel error" << "\n";
+    for (int e : {1, 5, 20, 100, 500}) {
+        double worst = 0;
+        for (int i = 0; i <= 1 << 20; ++i) {
+            float x = static_cast<float>(std::exp2(-24.0 * i / (1 << 20)));
+            double exact = std::pow(double(x), e);
+            if (exact < std::exp2(-63.0)) continue;
+            double approx = PowFast::pow<ScalarFloatLanes>(x, double(e));
+            worst = std::max(worst, std::abs(approx - exact) / exact);
+        }
+        std::cout << std::setw(11) << e << std::setw(16) << std::scientific << std::setprecision(2) << worst << "\n";
+        std::cout.unsetf(std::ios::scientific);
+    }
+
+    std::cout << "\n" << std::left << std::setw(24) << "scene" << std::setw(10) << "pass" << std::setw(9) << "path"
+              << std::right << std::setw(10) << "ms" << std::setw(12) << "px differ" << "\n";
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        Scene scene = parse_scene_file(fin, parse_parent_path(path));
+        std::string name = path.substr(path.find_last_of('/') + 1);
+        for (bool deferred : {false, true}) {
+            PixelBuffer frame_reference;
+            for (LightingPath lighting : paths) {
+                RenderOptions opts;
+                opts.deferred = deferred;
+                opts.lighting = lighting;
+                Image img;
+                double best = 1e300;
+                for (int rep = 0; rep < 3; ++rep) {
+                    img = blank_image(xres, yres);
+                    best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, 1, opts); }));
+                }
+                if (lighting == LightingPath::Scalar) frame_reference = img.img;
+                size_t differ = 0;
+                for (size_t i = 0; i < img.img.size(); i += 3) {
+                    differ += !std::equal(&img.img[i], &img.img[i] + 3, &frame_reference[i]);
+                }
+                std::cout << std::left << std::setw(24) << name << std::setw(10) << (deferred ? "deferred" : "forward")
+                          << std::setw(9) << lighting_path_name(lighting) << std::right << std::fixed
+                          << std::setprecision(2) << std::setw(10) << best * 1000.0 << std::setw(12) << differ << "\n";
+                std::cout.unsetf(std::ios::fixed);
+            }
+        }
+    }
+    return 0;
+}
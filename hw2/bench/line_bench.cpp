@@ -0,0 +1,147 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "raster_utils.h"
+#include "shading_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace {
+
+// The original float-stepped line, kept as the baseline to measure against: every step of
+// the whole line is walked, and both pixels go through put_pixel's per-pixel bounds checks
+// and float blend.
+void legacy_put_pixel(int x, int y, uint8_t r, uint8_t g, uint8_t b, Image& img, float a) {
+    size_t W = img.xres, H = img.yres;
+    if ((unsigned)x >= (unsigned)W || (unsigned)y >= (unsigned)H) return;
+    size_t buf_idx = img.pixel_index(x, y);
+    if (!img.z_buf.test_and_set(buf_idx, 0.0)) return;
+    size_t idx = 3 * buf_idx;
+    img.img[idx + 0] = uint8_t((1.f - a) * img.img[idx + 0] + a * r);
+    img.img[idx + 1] = uint8_t((1.f - a) * img.img[idx + 1] + a * g);
+    img.img[idx + 2] = uint8_t((1.f - a) * img.img[idx + 2] + a * b);
+}
+
+void legacy_draw_line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, Image& img) {
+    bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+    if (steep) { std::swap(x0, y0); std::swap(x1, y1); }
+    if (x0 > x1) { std::swap(x0, x1); std::swap(y0, y1); }
+    int dx = x1 - x0, dy_abs = std::abs(y1 - y0);
+    int ystep = (y0 < y1) ? 1 : -1;
+    float errf = 0.0f;
+    float slope = dx ? (float)dy_abs / (float)dx : 0.0f;
+    int y = y0;
+    for (int x = x0; x <= x1; ++x) {
+        if (steep) {
+            legacy_put_pixel(y, x, r, g, b, img, 1.0f - errf);
+            legacy_put_pixel(y + ystep, x, r, g, b, img, errf);
+        } else {
+            legacy_put_pixel(x, y, r, g, b, img, 1.0f - errf);
+            legacy_put_pixel(x, y + ystep, r, g, b, img, errf);
+        }
+        errf += slope;
+        while (errf >= 1.0f) {
+            y += ystep;
+            errf -= 1.0f;
+        }
+    }
+}
+
+struct Line {
+    int x0, y0, x1, y1;
+};
+
+// n random lines of up to `size` pixels, centered anywhere within `spread` of the image
+// (0 keeps every center on it).
+std::vector<Line> random_lines(size_t n, double size, double spread, const Image& img, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> cx(-spread, img.xres + spread), cy(-spread, img.yres + spread);
+    std::uniform_real_distribution<double> off(-size / 2, size / 2);
+    std::vector<Line> lines(n);
+    for (Line& l : lines) {
+        double x = cx(rng), y = cy(rng), ox = off(rng), oy = off(rng);
+        l = Line{int(std::lround(x - ox)), int(std::lround(y - oy)), int(std::lround(x + ox)), int(std::lround(y + oy))};
+    }
+    return lines;
+}
+
+} // namespace
+
+int bench_lines(const std::vector<std::string>& args) {
+    // Lines/sec for the original float line and draw_line on random lines, short ones on
+    // screen and long ones mostly off it, then mode 3 frames of scene_bunny1.txt's unique
+    // edges with 1, 2, 4, ... max_threads threads, each checked against the 1-thread frame.
+    unsigned max_threads = args.size() > 0 ? static_cast<unsigned>(std::stoul(args[0])) : 64;
+    size_t xres = args.size() > 1 ? std::stoul(args[1]) : 3840;
+    size_t yres = args.size() > 2 ? std::stoul(args[2]) : 2160;
+    std::string path = args.size() > 3 ? args[3] : stage_scene("data/scene_bunny1.txt", "../hw5/bunny.obj");
+
+    struct Set {
+        const char* name;
+        size_t n;
+        double size, spread;
+    };
+    const Set sets[] = {{"short", 200000, 20, 0}, {"long", 20000, 4 * double(xres), 2 * double(xres)}};
+    std::cout << xres << "x" << yres << ", Mlines/s\n"
+              << std::left << std::setw(10) << "lines" << std::right << std::setw(10) << "count" << std::setw(10)
+              << "legacy" << std::setw(11) << "draw_line" << std::setw(10) << "speedup" << "\n";
+    for (const Set& set : sets) {
+        Image img = blank_image(xres, yres);
+        std::vector<Line> lines = random_lines(set.n, set.size, set.spread, img, 23);
+        double t_legacy = best_of(3, [&] {
+            for (const Line& l : lines) legacy_draw_line(l.x0, l.y0, l.x1, l.y1, 255, 255, 255, img);
+        });
+        double t_new = best_of(3, [&] {
+            for (const Line& l : lines) draw_line(l.x0, l.y0, l.x1, l.y1, 255, 255, 255, img);
+        });
+        std::cout << std::left << std::setw(10) << set.name << std::right << std::setw(10) << set.n << std::fixed
+                  << std::setprecision(2) << std::setw(10) << set.n / t_legacy / 1e6 << std::setw(11)
+                  << set.n / t_new / 1e6 << std::setw(9) << t_legacy / t_new << "x\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+
+    std::ifstream fin(path);
+    if (path.empty() || !fin) {
+        std::cerr << "Skipping " << path << ": not found\n";
+        return 0;
+    }
+    LoadOptions load;
+    load.edges = true;
+    Scene scene = parse_scene_file(fin, parse_parent_path(path), load);
+    size_t edges = 0;
+    for (const auto& inst : scene.scene_objects) edges += inst.mesh->edges.size();
+    std::string name = path.substr(path.find_last_of('/') + 1);
+
+    std::cout << "\n" << name << ": " << edges << " edges, " << std::thread::hardware_concurrency()
+              << " hardware threads\n"
+              << std::right << std::setw(9) << "threads" << std::setw(10) << "ms" << std::setw(12) << "Mlines/s"
+              << std::setw(10) << "speedup" << "\n";
+    Image ref;
+    double t1 = 0;
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        RenderOptions opts;
+        opts.threads = threads;
+        Image img;
+        double best = 1e300;
+        for (int rep = 0; rep < 5; ++rep) {
+            img = blank_image(xres, yres);
+            best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, 3, opts); }));
+        }
+        if (threads == 1) {
+            ref = img;
+            t1 = best;
+        } else if (img.img != ref.img) {
+            std::cerr << name << ": " << threads << " threads differ from 1\n";
+            return 1;
+        }
+        std::cout << std::setw(9) << threads << std::fixed << std::setprecision(2) << std::setw(10) << best * 1000.0
+                  << std::setw(12) << edges / best / 1e6 << std::setw(9) << t1 / best << "x\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "bench.h"
+#include "io_utils.h"
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace {
+
+// The original getline/istringstream loader, kept as the baseline to measure against.
+Object legacy_load_obj(const std::string& file_path) {
+    std::ifstream file(file_path);
+    if (!file) throw std::runtime_error("Could not open file " + file_path);
+
+    Object obj{file_path, {{0.0, 0.0, 0.0}}, {{0.0, 0.0, 0.0}}, {}, {}};
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string s = line;
+        auto p = s.find_first_not_of(" \t\r\n");
+        if (p == std::string::npos) continue;
+        if (s[p] == '#') continue;
+
+        std::istringstream line_stream(s);
+        std::string type;
+        line_stream >> type;
+
+        if (type == "v" || type == "vn") {
+            double x, y, z;
+            if (!(line_stream >> x >> y >> z)) throw std::runtime_error("Invalid format");
+            if (type == "v") obj.vertices.push_back({Real(x), Real(y), Real(z)});
+            else obj.normals.push_back({Real(x), Real(y), Real(z)});
+        } else if (type == "f") {
+            unsigned int v_idx[3], n_idx[3];
+            for (int i = 0; i < 3; ++i) {
+                std::string token;
+                if (!(line_stream >> token)) throw std::runtime_error("Invalid face format");
+                auto pos = token.find("//");
+                if (pos == std::string::npos) throw std::runtime_error("Expected 'v//vn' format");
+                v_idx[i] = std::stoi(token.substr(0, pos));
+                n_idx[i] = std::stoi(token.substr(pos + 2));
+            }
+            obj.faces.push_back({v_idx[0], v_idx[1], v_idx[2], n_idx[0], n_idx[1], n_idx[2]});
+        } else {
+            throw std::runtime_error("Invalid format: must start with 'v', 'vn', or 'f'");
+        }
+    }
+    return obj;
+}
+
+bool same_object(const Object& a, const Object& b) {
+    if (a.vertices.size() != b.vertices.size() || a.normals.size() != b.normals.size() ||
+        a.faces.size() != b.faces.size()) return false;
+    for (size_t i = 0; i < a.vertices.size(); ++i) {
+        const Vertex &u = a.vertices[i], &v = b.vertices[i];
+        if (u.x != v.x || u.y != v.y || u.z != v.z) return false;
+    }
+    for (size_t i = 0; i < a.normals.size(); ++i) {
+        const Normal &u = a.normals[i], &v = b.normals[i];
+        if (u.x != v.x || u.y != v.y || u.z != v.z) return false;
+    }
+    for (size_t i = 0; i < a.faces.size(); ++i) {
+        const Face &f = a.faces[i], &g = b.faces[i];
+        if (f.v1 != g.v1 || f.v2 != g.v2 || f.v3 != g.v3 ||
+            f.vn1 != g.vn1 || f.vn2 != g.vn2 || f.vn3 != g.vn3) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+std::string with_normals(const std::string& path) {
+    // The bunny and armadillo meshes in this repo are position-only ("f a b c"), which the
+    // hw2 loader rejects. Rewrite them once into v//vn form with area-weighted vertex
+    // normals so they exercise the same code path as kitten.obj.
+    std::ifstream in(path);
+    // Read and written back in double whatever the build's precision
+    std::vector<BasicVertex<double>> verts{{0.0, 0.0, 0.0}};
+    std::vector<unsigned int> tris;
+    std::string line;
+    bool has_normals = false;
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        std::string type;
+        iss >> type;
+        if (type == "vn") { has_normals = true; break; }
+        if (type == "v") {
+            BasicVertex<double> v{};
+            iss >> v.x >> v.y >> v.z;
+            verts.push_back(v);
+        } else if (type == "f") {
+            unsigned int a, b, c;
+            iss >> a >> b >> c;
+            tris.insert(tris.end(), {a, b, c});
+        }
+    }
+    if (has_normals || tris.empty()) return path;
+
+    std::vector<Vector3d> normals(verts.size(), Vector3d::Zero());
+    for (size_t i = 0; i + 2 < tris.size(); i += 3) {
+        Vector3d a = as_vec3d(verts[tris[i]]), b = as_vec3d(verts[tris[i + 1]]), c = as_vec3d(verts[tris[i + 2]]);
+        Vector3d n = (b - a).cross(c - a);
+        for (int k = 0; k < 3; ++k) normals[tris[i + k]] += n;
+    }
+
+    std::string out_path = "/tmp/" + path.substr(path.find_last_of('/') + 1) + ".vn.obj";
+    std::ofstream out(out_path);
+    out << std::setprecision(6);
+    for (size_t i = 1; i < verts.size(); ++i) {
+        out << "v " << verts[i].x << " " << verts[i].y << " " << verts[i].z << "\n";
+    }
+    for (size_t i = 1; i < normals.size(); ++i) {
+        Vector3d n = normals[i].squaredNorm() > 0 ? normals[i].normalized() : Vector3d(0, 0, 1);
+        out << "vn " << n.x() << " " << n.y() << " " << n.z() << "\n";
+    }
+    for (size_t i = 0; i + 2 < tris.size(); i += 3) {
+        out << "f " << tris[i] << "//" << tris[i] << " " << tris[i + 1] << "//" << tris[i + 1]
+            << " " << tris[i + 2] << "//" << tris[i + 2] << "\n";
+    }
+    return out_path;
+}
+
+int bench_obj(const std::vector<std::string>& args) {
+    std::vector<std::string> files = args;
+    if (files.empty()) files = {"../hw5/bunny.obj", "data/kitten.obj", "../hw5/armadillo.obj"};
+
+    std::cout << std::left << std::setw(28) << "file" << std::right
+              << std::setw(10) << "MB" << std::setw(14) << "legacy MB/s"
+              << std::setw(14) << "mmap MB/s" << std::setw(10) << "speedup" << "\n";
+
+    for (const auto& arg : files) {
+        std::string path = with_normals(arg);
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        double mb = static_cast<double>(st.st_size) / (1024.0 * 1024.0);
+
+        try {
+            Object ref, fast;
+            double t_legacy = best_of(5, [&] { ref = legacy_load_obj(path); });
+            double t_fast = best_of(5, [&] { fast = load_objects({path}, "").at(0); });
+            if (!same_object(ref, fast)) {
+                std::cerr << path << ": mmap loader output differs from legacy loader\n";
+                return 1;
+            }
+            std::cout << std::left << std::setw(28) << arg << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(10) << mb
+                      << std::setw(14) << mb / t_legacy << std::setw(14) << mb / t_fast
+                      << std::setw(9) << t_legacy / t_fast << "x\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping " << path << ": " << e.what() << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "bench.h"
+#include "io_utils.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+int bench_obj_threads(const std::vector<std::string>& args) {
+    // Scaling of the chunked OBJ parser from 1..N threads. The mesh is repeated in
+    // memory until it is large enough to split (faces re-indexed per copy), so the
+    // numbers reflect multi-hundred-MB inputs rather than thread start-up cost.
+    std::string path = args.size() > 0 ? args[0] : "data/kitten.obj";
+    unsigned max_threads = args.size() > 1 ? static_cast<unsigned>(std::stoul(args[1]))
+                                           : std::max(1u, std::thread::hardware_concurrency());
+    size_t target_mb = args.size() > 2 ? std::stoul(args[2]) : 256;
+
+    std::vector<Object> base = load_objects({path}, "");
+    if (base.empty()) return 1;
+    const Object& src = base[0];
+
+    std::string text;
+    text.reserve(target_mb << 20);
+    char line[128];
+    for (size_t copy = 0; text.size() < (target_mb << 20); ++copy) {
+        size_t v_off = copy * (src.vertices.size() - 1);
+        size_t n_off = copy * (src.normals.size() - 1);
+        for (size_t i = 1; i < src.vertices.size(); ++i) {
+            const Vertex& v = src.vertices[i];
+            text.append(line, std::snprintf(line, sizeof(line), "v %g %g %g\n", v.x, v.y, v.z));
+        }
+        for (size_t i = 1; i < src.normals.size(); ++i) {
+            const Normal& n = src.normals[i];
+            text.append(line, std::snprintf(line, sizeof(line), "vn %g %g %g\n", n.x, n.y, n.z));
+        }
+        for (const Face& f : src.faces) {
+            text.append(line, std::snprintf(line, sizeof(line), "f %zu//%zu %zu//%zu %zu//%zu\n",
+                f.v1 + v_off, f.vn1 + n_off, f.v2 + v_off, f.vn2 + n_off, f.v3 + v_off, f.vn3 + n_off));
+        }
+    }
+    double mb = static_cast<double>(text.size()) / (1024.0 * 1024.0);
+
+    auto parse = [&](unsigned threads) {
+        Object obj{"", {{0.0, 0.0, 0.0}}, {{0.0, 0.0, 0.0}}, {}, {}};
+        parse_obj_buffer(text.data(), text.data() + text.size(), obj, threads);
+        return obj;
+    };
+
+    Object ref = parse(1);
+    std::cout << path << " x" << (text.size() >> 20) << " MB, " << ref.faces.size() << " faces\n"
+              << std::setw(8) << "threads" << std::setw(12) << "seconds" << std::setw(12) << "MB/s"
+              << std::setw(10) << "speedup" << "\n";
+
+    double t1 = 0;
+    for (unsigned t = 1; t <= max_threads; ++t) {
+        Object out;
+        double s = best_of(3, [&] { out = parse(t); });
+        if (t == 1) t1 = s;
+        bool same = out.vertices.size() == ref.vertices.size() && out.faces.size() == ref.faces.size() &&
+            std::equal(out.faces.begin(), out.faces.end(), ref.faces.begin(), [](const Face& a, const Face& b) {
+                return a.v1 == b.v1 && a.v2 == b.v2 && a.v3 == b.v3 && a.vn1 == b.vn1 && a.vn2 == b.vn2 && a.vn3 == b.vn3;
+            }) &&
+            std::equal(out.vertices.begin(), out.vertices.end(), ref.vertices.begin(), [](const Vertex& a, const Vertex& b) {
+                return a.x == b.x && a.y == b.y && a.z == b.z;
+            });
+        if (!same) {
+            std::cerr << "Output with " << t << " threads differs from serial parse\n";
+            return 1;
+        }
+        std::cout << std::setw(8) << t << std::fixed << std::setprecision(3) << std::setw(12) << s
+                  << std::setprecision(1) << std::setw(12) << mb / s
+                  << std::setprecision(2) << std::setw(9) << t1 / s << "x\n";
+    }
+    return 0;
+}
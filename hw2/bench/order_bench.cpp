@@ -0,0 +1,87 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "shading_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+// Pixels the frame covered: those whose Double depth is no longer the +inf it was cleared to.
+size_t covered_pixels(const Image& img) {
+    const double* z = static_cast<const double*>(img.z_buf.data());
+    size_t n = 0;
+    for (size_t i = 0; i < img.z_buf.size(); ++i) n += !std::isinf(z[i]);
+    return n;
+}
+
+// Pixels that differ between a and b, and the largest channel difference among them.
+size_t differing_pixels(const PixelBuffer& a, const PixelBuffer& b, int& max_diff) {
+    size_t n = 0;
+    max_diff = 0;
+    for (size_t i = 0; i + 2 < a.size(); i += 3) {
+        int d = 0;
+        for (int c = 0; c < 3; ++c) d = std::max(d, std::abs(int(a[i + c]) - int(b[i + c])));
+        n += d != 0;
+        max_diff = std::max(max_diff, d);
+    }
+    return n;
+}
+
+} // namespace
+
+int bench_order(const std::vector<std::string>& args) {
+    // File order against --front-to-back on the same frames: depth test passes against the
+    // pixels covered (the overdraw), lighting() calls, time, and how many pixels the order
+    // changed and by how much. Only exact depth ties change, but in flat mode the faces
+    // meeting at a shared edge have different colors, so there they can change a lot.
+    size_t xres = args.size() > 0 ? std::stoul(args[0]) : 1920;
+    size_t yres = args.size() > 1 ? std::stoul(args[1]) : 1080;
+    std::vector<std::string> scenes(args.begin() + std::min<size_t>(args.size(), 2), args.end());
+    if (scenes.empty()) {
+        scenes = {"data/scene_kitten.txt", stage_scene("data/scene_armadillo.txt", "../hw5/armadillo.obj"),
+                  stacked_scene(200, "data/kitten.obj", false)};
+    }
+
+    std::cout << std::left << std::setw(26) << "scene" << std::right << std::setw(6) << "mode" << std::setw(15)
+              << "order" << std::setw(12) << "passes" << std::setw(10) << "overdraw" << std::setw(14)
+              << "invocations" << std::setw(10) << "ms" << std::setw(10) << "changed" << std::setw(10) << "max diff" << "\n";
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        Scene scene = parse_scene_file(fin, parse_parent_path(path));
+        std::string name = path.substr(path.find_last_of('/') + 1);
+
+        for (size_t mode : {0, 1, 2}) {
+            PixelBuffer reference;
+            for (bool front_to_back : {false, true}) {
+                RenderOptions opts;
+                opts.front_to_back = front_to_back;
+                RenderStats stats;
+                Image img;
+                double best = 1e300;
+                for (int rep = 0; rep < 3; ++rep) {
+                    img = blank_image(xres, yres);
+                    best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, mode, opts, &stats); }));
+                }
+                if (!front_to_back) reference = img.img;
+                size_t covered = covered_pixels(img);
+                int max_diff;
+                size_t changed = differing_pixels(reference, img.img, max_diff);
+                std::cout << std::left << std::setw(26) << name << std::right << std::setw(6) << mode
+                          << std::setw(15) << (front_to_back ? "front-to-back" : "file") << std::setw(12)
+                          << stats.depth_passes << std::fixed << std::setprecision(3) << std::setw(10)
+                          << (covered ? double(stats.depth_passes) / covered : 0.0) << std::setw(14)
+                          << stats.shading_invocations << std::setprecision(2) << std::setw(10) << best * 1000.0
+                          << std::setw(10) << changed << std::setw(10) << max_diff << "\n";
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "png_utils.h"
+#include "shading_utils.h"
+#include "thread_utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <png.h>
+
+namespace {
+
+// libpng's own writer at the given level, into memory: the serial baseline.
+std::vector<uint8_t> libpng_encode(const Image& img, int level) {
+    std::vector<uint8_t> out;
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        return {};
+    }
+    png_set_write_fn(png, &out, [](png_structp p, png_bytep data, png_size_t n) {
+        auto* v = static_cast<std::vector<uint8_t>*>(png_get_io_ptr(p));
+        v->insert(v->end(), data, data + n);
+    }, nullptr);
+    png_set_compression_level(png, level);
+    png_set_IHDR(png, info, static_cast<png_uint_32>(img.xres), static_cast<png_uint_32>(img.yres), 8,
+                 PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (size_t y = 0; y < img.yres; ++y) png_write_row(png, img.img.data() + y * img.xres * 3);
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+    return out;
+}
+
+// Decodes png with libpng and checks it holds img's pixels.
+bool decodes_to(const PngBuffers& png, const Image& img) {
+    std::vector<uint8_t> file;
+    for (const auto& p : png.parts) file.insert(file.end(), p.begin(), p.end());
+    png_image image;
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, file.data(), file.size())) return false;
+    image.format = PNG_FORMAT_RGB;
+    std::vector<uint8_t> pixels(PNG_IMAGE_SIZE(image));
+    bool ok = png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr) && std::equal(pixels.begin(), pixels.end(), img.img.begin(), img.img.end());
+    png_image_free(&image);
+    return ok;
+}
+
+} // namespace
+
+int bench_png(const std::vector<std::string>& args) {
+    // Encode-and-write MB/s of framebuffer for a rendered Phong frame, against P6 and libpng.
+    unsigned max_threads = args.size() > 0 ? std::stoul(args[0]) : std::max(4u, resolve_threads(0));
+    std::string scene_path = args.size() > 1 ? args[1] : "data/scene_kitten.txt";
+    const std::string out_path = "/tmp/png_bench.out";
+    const size_t sizes[][2] = {{1920, 1080}, {3840, 2160}};
+
+    std::ifstream fin(scene_path);
+    if (!fin) {
+        std::cerr << "Could not open " << scene_path << "\n";
+        return 1;
+    }
+    Scene scene = parse_scene_file(fin, parse_parent_path(scene_path));
+
+    std::cout << "hardware threads: " << resolve_threads(0) << "\n";
+    std::cout << std::left << std::setw(12) << "size" << std::setw(16) << "writer" << std::right
+              << std::setw(6) << "level" << std::setw(9) << "threads" << std::setw(10) << "out MB"
+              << std::setw(10) << "ms" << std::setw(10) << "MB/s" << "\n";
+
+    int status = 0;
+    for (const auto& wh : sizes) {
+        Image img = blank_image(wh[0], wh[1]);
+        shade_by_mode(img, scene, 1);
+        double frame_mb = img.img.size() / 1e6;
+        std::string size = std::to_string(wh[0]) + "x" + std::to_string(wh[1]);
+
+        auto row = [&](const char* writer, int level, unsigned threads, double out_mb, double sec) {
+            std::cout << std::left << std::setw(12) << size << std::setw(16) << writer << std::right << std::setw(6);
+            if (level >= 0) std::cout << level; else std::cout << "-";
+            std::cout << std::setw(9) << threads << std::fixed << std::setprecision(2) << std::setw(10) << out_mb
+                      << std::setw(10) << sec * 1000.0 << std::setprecision(0) << std::setw(10) << frame_mb / sec
+                      << "\n";
+        };
+
+        double s6 = best_of(3, [&] { write_ppm(img, PpmFormat::P6, out_path); });
+        row("P6", -1, 1, (img.img.size() + 20) / 1e6, s6);
+
+        for (int level : {1, 6, 9}) {
+            std::vector<uint8_t> ref;
+            double sl = best_of(level == 9 ? 1 : 3, [&] {
+                ref = libpng_encode(img, level);
+                OutputPart part = {ref.data(), ref.size()};
+                write_output(out_path, &part, 1);
+            });
+            row("libpng", level, 1, ref.size() / 1e6, sl);
+
+            for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+                PngOptions opts;
+                opts.level = level;
+                opts.threads = threads;
+                double sp = best_of(level == 9 ? 1 : 3, [&] { write_png(img, opts, out_path); });
+                PngBuffers png = encode_png(img, opts);
+                row("write_png", level, threads, png.size() / 1e6, sp);
+                if (!decodes_to(png, img)) {
+                    std::cerr << size << " level " << level << " threads " << threads << ": PNG does not decode to the frame\n";
+                    status = 1;
+                }
+            }
+        }
+    }
+    std::remove(out_path.c_str());
+    return status;
+}
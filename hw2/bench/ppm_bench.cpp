@@ -0,0 +1,63 @@
+#include "bench.h"
+#include "io_utils.h"
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+// The original write_ppm: three operator<< calls and a "\n" per pixel, here into a file stream.
+void legacy_write_ppm(const Image& img, std::ostream& out) {
+    out << "P3\n" << img.xres << " " << img.yres << "\n255\n";
+    for (size_t i = 0; i < img.xres * img.yres * 3; i += 3) {
+        out << static_cast<int>(img.img[i]) << " "
+            << static_cast<int>(img.img[i+1]) << " "
+            << static_cast<int>(img.img[i+2]) << "\n";
+    }
+}
+
+} // namespace
+
+int bench_ppm(const std::vector<std::string>& args) {
+    // MB/s of framebuffer written, so the three encoders compare on the same frame.
+    std::vector<std::string> sinks = {"/dev/null", "/tmp/ppm_bench.ppm"};
+    if (!args.empty()) sinks.assign(args.begin(), args.end());
+    const size_t sizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+
+    std::cout << std::left << std::setw(12) << "size" << std::setw(22) << "sink" << std::setw(10) << "format"
+              << std::right << std::setw(12) << "out MB" << std::setw(10) << "ms" << std::setw(14) << "MB/s" << "\n";
+
+    for (const auto& wh : sizes) {
+        // A gradient, so the P3 text has a realistic mix of 1-3 digit values
+        Image img = blank_image(wh[0], wh[1]);
+        for (size_t i = 0; i < img.img.size(); ++i) img.img[i] = static_cast<uint8_t>(i * 7 / 3);
+        double frame_mb = img.img.size() / 1e6;
+        std::string size = std::to_string(wh[0]) + "x" + std::to_string(wh[1]);
+
+        for (const auto& sink : sinks) {
+            struct Writer {
+                const char* name;
+                std::function<void()> run;
+            };
+            const Writer writers[] = {
+                {"P3 legacy", [&] { std::ofstream out(sink); legacy_write_ppm(img, out); }},
+                {"P3", [&] { write_ppm(img, PpmFormat::P3, sink); }},
+                {"P6", [&] { write_ppm(img, PpmFormat::P6, sink); }},
+            };
+            for (const auto& w : writers) {
+                double s = best_of(3, w.run);
+                std::ifstream written(sink, std::ios::binary | std::ios::ate);
+                double out_mb = written ? written.tellg() / 1e6 : 0.0;
+                std::cout << std::left << std::setw(12) << size << std::setw(22) << sink << std::setw(10) << w.name
+                          << std::right << std::fixed << std::setprecision(1) << std::setw(12) << out_mb
+                          << std::setprecision(2) << std::setw(10) << s * 1000.0
+                          << std::setprecision(0) << std::setw(14) << frame_mb / s << "\n";
+            }
+        }
+    }
+    std::remove("/tmp/ppm_bench.ppm");
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "bench.h"
+#include "raster_utils.h"
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+namespace {
+
+// Returns whether the pixel is on the image, the depth test aside.
+bool legacy_put_pixel(int x, int y, double z, uint8_t r, uint8_t g, uint8_t b, Image& img) {
+    size_t W = img.xres, H = img.yres;
+    if ((unsigned)x >= (unsigned)W || (unsigned)y >= (unsigned)H) return false;
+    if (z < -1 || z > 1) return true;
+    size_t buf_idx = (H - 1 - size_t(y)) * W + x;
+    if (!img.z_buf.test_and_set(buf_idx, z)) return true;
+    img.img[3 * buf_idx + 0] = r;
+    img.img[3 * buf_idx + 1] = g;
+    img.img[3 * buf_idx + 2] = b;
+    return true;
+}
+
+// The original per-pixel barycentric rasterizer, kept as the baseline to measure against.
+// Returns the number of covered pixels on the image.
+size_t legacy_raster_gouraud(const ScreenVertex& sa, const ScreenVertex& sb, const ScreenVertex& sc,
+                             Image& img, Vector3d col1, Vector3d col2, Vector3d col3) {
+    auto f = [](int xi, int xj, int yi, int yj, int xp, int yp) {
+        return (yi - yj) * xp + (xj - xi) * yp + xi * yj - xj * yi;
+    };
+    int x_a = sa.x, y_a = sa.y, x_b = sb.x, y_b = sb.y, x_c = sc.x, y_c = sc.y;
+    size_t covered = 0;
+    for (int x = std::min({x_a, x_b, x_c}); x <= std::max({x_a, x_b, x_c}); ++x) {
+        for (int y = std::min({y_a, y_b, y_c}); y <= std::max({y_a, y_b, y_c}); ++y) {
+            double alpha = double(f(x_b, x_c, y_b, y_c, x, y)) / f(x_b, x_c, y_b, y_c, x_a, y_a);
+            double beta = double(f(x_a, x_c, y_a, y_c, x, y)) / f(x_a, x_c, y_a, y_c, x_b, y_b);
+            double gamma = double(f(x_a, x_b, y_a, y_b, x, y)) / f(x_a, x_b, y_a, y_b, x_c, y_c);
+            if (alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1 && gamma >= 0 && gamma <= 1) {
+                double z = alpha * sa.z + beta * sb.z + gamma * sc.z;
+                Vector3d col = alpha * col1 + beta * col2 + gamma * col3;
+                covered += legacy_put_pixel(x, y, z, uint8_t(col[0] * 255), uint8_t(col[1] * 255),
+                                            uint8_t(col[2] * 255), img);
+            }
+        }
+    }
+    return covered;
+}
+
+struct Tri {
+    ScreenVertex v[3];
+    Vector3d col[3];
+};
+
+// n random triangles of roughly `size` pixels across, some hanging off the image edges.
+std::vector<Tri> random_triangles(size_t n, double size, const Image& img, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> cx(-size, img.xres + size), cy(-size, img.yres + size);
+    std::uniform_real_distribution<double> off(-size, size), z(-0.9, 0.9), c(0.0, 1.0);
+    std::vector<Tri> tris(n);
+    for (auto& t : tris) {
+        double x = cx(rng), y = cy(rng);
+        for (int k = 0; k < 3; ++k) {
+            double px = x + off(rng), py = y + off(rng);
+            t.v[k] = {0.0, 0.0, z(rng), int(std::lround(px)), int(std::lround(py)), 0};
+            t.col[k] = Vector3d(c(rng), c(rng), c(rng));
+        }
+    }
+    return tris;
+}
+
+} // namespace
+
+int bench_raster(const std::vector<std::string>& args) {
+    // Gouraud-shaded random triangles into a 1080p image. Compares pixels/sec of the original
+    // per-pixel compute_abg loop with the edge-function rasterizer on each instruction set
+    // available here, and checks they all draw the same image.
+    size_t n = args.size() > 0 ? std::stoul(args[0]) : 20000;
+    const size_t xres = 1920, yres = 1080;
+
+    std::vector<RasterIsa> isas;
+    for (RasterIsa isa : {RasterIsa::Scalar, RasterIsa::SSE2, RasterIsa::AVX2}) {
+        if (set_raster_isa(isa)) isas.push_back(isa);
+    }
+
+    std::cout << "Mpixels/s; speedup of " << raster_isa_name(isas.back()) << " over legacy\n"
+              << std::fixed << std::setprecision(2)
+              << std::left << std::setw(10) << "size px" << std::right << std::setw(10) << "Mpixels"
+              << std::setw(10) << "legacy";
+    for (RasterIsa isa : isas) std::cout << std::setw(10) << raster_isa_name(isa);
+    std::cout << std::setw(10) << "speedup" << "\n";
+
+    for (double size : {4.0, 16.0, 64.0, 256.0}) {
+        size_t count = size > 100 ? n / 20 : n;
+        Image probe = blank_image(xres, yres);
+        std::vector<Tri> tris = random_triangles(count, size, probe, 171);
+
+        // Best of 3 draws into a freshly cleared image, clearing outside the clock
+        auto timed = [&](Image& img, const std::function<void()>& draw) {
+            double best = 1e300;
+            for (int rep = 0; rep < 3; ++rep) {
+                img = blank_image(xres, yres);
+                best = std::min(best, best_of(1, draw));
+            }
+            return best;
+        };
+
+        size_t covered = 0;
+        Image ref, out;
+        double t_legacy = timed(ref, [&] {
+            covered = 0;
+            for (const auto& t : tris) covered += legacy_raster_gouraud(t.v[0], t.v[1], t.v[2], ref, t.col[0], t.col[1], t.col[2]);
+        });
+        double mpix = covered / 1e6;
+        std::cout << std::left << std::setw(10) << size << std::right << std::setw(10) << mpix
+                  << std::setw(10) << mpix / t_legacy;
+
+        double t_best = 0;
+        for (RasterIsa isa : isas) {
+            set_raster_isa(isa);
+            t_best = timed(out, [&] {
+                for (const auto& t : tris) {
+                    TriangleSetup setup;
+                    if (setup_triangle(t.v[0], t.v[1], t.v[2], out, setup)) {
+                        raster_triangle_gouraud(setup, full_rect(out), out, t.col[0], t.col[1], t.col[2]);
+                    }
+                }
+            });
+            if (ref.img != out.img || ref.z_buf != out.z_buf) {
+                std::cerr << "\nsize " << size << ": " << raster_isa_name(isa) << " rasterizer output differs from legacy\n";
+                return 1;
+            }
+            std::cout << std::setw(10) << mpix / t_best;
+        }
+        std::cout << std::setw(9) << t_legacy / t_best << "x\n";
+    }
+    set_raster_isa(best_raster_isa());
+    return 0;
+}
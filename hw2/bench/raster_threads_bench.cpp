@@ -0,0 +1,59 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "shading_utils.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+int bench_raster_threads(const std::vector<std::string>& args) {
+    // Renders each scene with 1, 2, 4, ... max_threads raster threads and checks every
+    // image against the single-threaded one, since tiles make the output thread-count
+    // independent. Only shade_by_mode is timed.
+    unsigned max_threads = args.size() > 0 ? static_cast<unsigned>(std::stoul(args[0])) : 64;
+    size_t xres = args.size() > 1 ? std::stoul(args[1]) : 3840;
+    size_t yres = args.size() > 2 ? std::stoul(args[2]) : 2160;
+    std::vector<std::string> scenes = {"data/scene_kitten.txt",
+                                       stage_scene("data/scene_armadillo.txt", "../hw5/armadillo.obj")};
+
+    std::cout << xres << "x" << yres << ", " << std::thread::hardware_concurrency() << " hardware threads\n"
+              << std::left << std::setw(24) << "scene" << std::right << std::setw(6) << "mode"
+              << std::setw(9) << "threads" << std::setw(10) << "ms" << std::setw(10) << "speedup" << "\n";
+
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        Scene scene = parse_scene_file(fin, parse_parent_path(path));
+        std::string name = path.substr(path.find_last_of('/') + 1);
+
+        for (size_t mode : {0, 1, 2}) {
+            Image ref;
+            double t1 = 0;
+            for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+                RenderOptions opts;
+                opts.threads = threads;
+                double best = 1e300;
+                Image img;
+                for (int rep = 0; rep < 3; ++rep) {
+                    img = blank_image(xres, yres);
+                    best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, mode, opts); }));
+                }
+                if (threads == 1) {
+                    ref = img;
+                    t1 = best;
+                } else if (img.img != ref.img || img.z_buf != ref.z_buf) {
+                    std::cerr << name << " mode " << mode << ": " << threads << " threads differ from 1\n";
+                    return 1;
+                }
+                std::cout << std::left << std::setw(24) << name << std::right << std::setw(6) << mode
+                          << std::setw(9) << threads << std::fixed << std::setprecision(2)
+                          << std::setw(10) << best * 1000.0 << std::setw(9) << t1 / best << "x\n";
+            }
+        }
+    }
+    return 0;
+}
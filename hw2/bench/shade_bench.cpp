@@ -0,0 +1,73 @@
+#include "bench.h"
+#include "io_utils.h"
+#include "shading_utils.h"
+
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <unistd.h>
+
+Image blank_image(size_t xres, size_t yres) {
+    return Image{PixelBuffer(xres * yres * 3), DepthBuffer(xres * yres), xres, yres};
+}
+
+std::string stage_scene(const std::string& scene, const std::string& mesh) {
+    std::string name = mesh.substr(mesh.find_last_of('/') + 1);
+    std::string link = "/tmp/" + name;
+    char abs_mesh[PATH_MAX];
+    if (!::realpath(with_normals(mesh).c_str(), abs_mesh)) return "";
+    ::unlink(link.c_str());
+    if (::symlink(abs_mesh, link.c_str()) != 0) return "";
+    std::string out_path = "/tmp/" + scene.substr(scene.find_last_of('/') + 1);
+    std::ifstream in(scene);
+    std::ofstream out(out_path);
+    out << in.rdbuf();
+    return out_path;
+}
+
+int bench_shade(const std::vector<std::string>& args) {
+    // Times shade_by_mode alone; the scene copy and blank image for each run are made outside the clock.
+    size_t xres = args.size() > 0 ? std::stoul(args[0]) : 800;
+    size_t yres = args.size() > 1 ? std::stoul(args[1]) : 800;
+    std::vector<std::string> scenes(args.begin() + std::min<size_t>(args.size(), 2), args.end());
+    if (scenes.empty()) scenes = {"data/scene_kitten.txt", stage_scene("data/scene_bunny1.txt", "../hw5/bunny.obj")};
+
+    std::cout << std::left << std::setw(28) << "scene" << std::right << std::setw(6) << "mode"
+              << std::setw(10) << "faces" << std::setw(10) << "ms" << std::setw(14) << "Mfaces/s" << "\n";
+
+    for (const auto& path : scenes) {
+        std::ifstream fin(path);
+        if (path.empty() || !fin) {
+            std::cerr << "Skipping " << path << ": not found\n";
+            continue;
+        }
+        Scene scene;
+        try {
+            // Mode 3 draws the unique edges main.cpp loads for it
+            LoadOptions opts;
+            opts.edges = true;
+            scene = parse_scene_file(fin, parse_parent_path(path), opts);
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping " << path << ": " << e.what() << "\n";
+            continue;
+        }
+        size_t faces = 0;
+        for (const auto& inst : scene.scene_objects) faces += inst.mesh->faces.size();
+
+        for (size_t mode = 0; mode <= 3; ++mode) {
+            double best = 1e300;
+            for (int rep = 0; rep < 10; ++rep) {
+                Image img = blank_image(xres, yres);
+                best = std::min(best, best_of(1, [&] { shade_by_mode(img, scene, mode); }));
+            }
+            std::string name = path.substr(path.find_last_of('/') + 1);
+            std::cout << std::left << std::setw(28) << name << std::right << std::setw(6) << mode
+                      << std::setw(10) << faces << std::fixed << std::setprecision(2)
+                      << std::setw(10) << best * 1000.0 << std::setw(14) << faces / best / 1e6 << "\n";
+        }
+    }
+    return 0;
+}
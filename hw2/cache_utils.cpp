@@ -0,0 +1,213 @@
+#include "cache_utils.h"
+#include "io_utils.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+const char kMeshCacheMagic[8] = {'H', 'W', '2', 'M', 'E', 'S', 'H', '\0'};
+// Bump whenever the OBJ parser or the cached layout changes meaning.
+const uint32_t kMeshCacheVersion = 1;
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t path_len;
+    uint32_t vertex_size, normal_size, face_size, reserved;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t source_hash;
+    uint64_t vertex_count, normal_count, face_count;
+};
+
+inline size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read_u64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+
+inline uint64_t hash_round(uint64_t acc, uint64_t lane) {
+    return rotl64(acc + lane * kPrime2, 31) * kPrime1;
+}
+
+std::string canonical_path(const std::string& path) {
+    char buf[PATH_MAX];
+    if (::realpath(path.c_str(), buf)) return buf;
+    return path;
+}
+
+bool stat_source(const std::string& path, uint64_t& size, int64_t& mtime_ns) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return false;
+    size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    mtime_ns = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+MeshCacheHeader make_header(const std::string& key, uint64_t size, int64_t mtime_ns, uint64_t hash) {
+    MeshCacheHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMeshCacheMagic, sizeof(h.magic));
+    h.version = kMeshCacheVersion;
+    h.path_len = static_cast<uint32_t>(key.size());
+    h.vertex_size = sizeof(Vertex);
+    h.normal_size = sizeof(Normal);
+    h.face_size = sizeof(Face);
+    h.source_size = size;
+    h.source_mtime_ns = mtime_ns;
+    h.source_hash = hash;
+    return h;
+}
+
+} // namespace
+
+uint64_t hash_bytes(const char* data, size_t size) {
+    // Four independent 64-bit lanes over 32-byte blocks (xxHash64-style rounds), so
+    // hashing runs at memory speed and costs far less than re-parsing the text.
+    const char* p = data;
+    const char* end = data + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t a = kPrime1 + kPrime2, b = kPrime2, c = 0, d = 0 - kPrime1;
+        for (; end - p >= 32; p += 32) {
+            a = hash_round(a, read_u64(p));
+            b = hash_round(b, read_u64(p + 8));
+            c = hash_round(c, read_u64(p + 16));
+            d = hash_round(d, read_u64(p + 24));
+        }
+        h = rotl64(a, 1) + rotl64(b, 7) + rotl64(c, 12) + rotl64(d, 18);
+    } else {
+        h = kPrime3;
+    }
+    h += static_cast<uint64_t>(size);
+
+    for (; end - p >= 8; p += 8) {
+        h ^= hash_round(0, read_u64(p));
+        h = rotl64(h, 27) * kPrime1 + kPrime3;
+    }
+    for (; p < end; ++p) {
+        h ^= static_cast<uint8_t>(*p) * kPrime3;
+        h = rotl64(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string mesh_cache_path(const std::string& obj_path) {
+    return obj_path + (sizeof(Real) == sizeof(float) ? ".meshcache.f32" : ".meshcache.f64");
+}
+
+bool load_mesh_cache(const std::string& obj_path, const char* src, size_t src_size, Object& obj) {
+    MappedFile cache(mesh_cache_path(obj_path));
+    if (!cache.ok() || cache.size() < sizeof(MeshCacheHeader)) return false;
+
+    MeshCacheHeader h;
+    std::memcpy(&h, cache.data(), sizeof(h));
+    if (std::memcmp(h.magic, kMeshCacheMagic, sizeof(h.magic)) != 0 || h.version != kMeshCacheVersion ||
+        h.vertex_size != sizeof(Vertex) || h.normal_size != sizeof(Normal) || h.face_size != sizeof(Face)) {
+        return false;
+    }
+
+    // Cheap checks first, the content hash last
+    uint64_t size;
+    int64_t mtime_ns;
+    if (!stat_source(obj_path, size, mtime_ns)) return false;
+    if (h.source_size != size || h.source_size != src_size || h.source_mtime_ns != mtime_ns) return false;
+
+    // The counts come from the file, so each is held to the bytes left before it is scaled
+    size_t vert_off = 0, norm_off = 0, face_off = 0;
+    size_t off = align8(sizeof(MeshCacheHeader) + h.path_len);
+    auto take = [&](uint64_t count, size_t elem_size, size_t& at) {
+        if (off > cache.size() || count > (cache.size() - off) / elem_size) return false;
+        at = off;
+        off += align8(size_t(count) * elem_size);
+        return true;
+    };
+    if (!take(h.vertex_count, sizeof(Vertex), vert_off) || !take(h.normal_count, sizeof(Normal), norm_off) ||
+        !take(h.face_count, sizeof(Face), face_off) || off != cache.size()) {
+        return false;
+    }
+
+    std::string key = canonical_path(obj_path);
+    if (key.size() != h.path_len || key.compare(0, key.size(), cache.data() + sizeof(h), h.path_len) != 0) {
+        return false;
+    }
+    if (h.source_hash != hash_bytes(src, src_size)) return false;
+
+    // The arrays are stored in Object's in-memory layout, so this is a straight copy
+    const Vertex* v = reinterpret_cast<const Vertex*>(cache.data() + vert_off);
+    const Normal* n = reinterpret_cast<const Normal*>(cache.data() + norm_off);
+    const Face* f = reinterpret_cast<const Face*>(cache.data() + face_off);
+    // The source hash says nothing of the arrays, so faces get the text parser's bounds check
+    for (size_t i = 0; i < h.face_count; ++i) {
+        if (f[i].v1 >= h.vertex_count || f[i].v2 >= h.vertex_count || f[i].v3 >= h.vertex_count ||
+            f[i].vn1 >= h.normal_count || f[i].vn2 >= h.normal_count || f[i].vn3 >= h.normal_count) {
+            return false;
+        }
+    }
+    obj.vertices.assign(v, v + h.vertex_count);
+    obj.normals.assign(n, n + h.normal_count);
+    obj.faces.assign(f, f + h.face_count);
+    return true;
+}
+
+void write_mesh_cache(const std::string& obj_path, const char* src, size_t src_size, const Object& obj) {
+    uint64_t size;
+    int64_t mtime_ns;
+    if (!stat_source(obj_path, size, mtime_ns) || size != src_size) return;
+
+    std::string key = canonical_path(obj_path);
+    MeshCacheHeader h = make_header(key, size, mtime_ns, hash_bytes(src, src_size));
+    h.vertex_count = obj.vertices.size();
+    h.normal_count = obj.normals.size();
+    h.face_count = obj.faces.size();
+
+    // Write to a temporary name and rename, so readers never see a partial file
+    std::string path = mesh_cache_path(obj_path);
+    std::string tmp = path + ".tmp" + std::to_string(::getpid());
+    FILE* out = std::fopen(tmp.c_str(), "wb");
+    if (!out) return;
+
+    const char zeros[8] = {0};
+    auto write_block = [&](const void* data, size_t bytes) {
+        return std::fwrite(data, 1, bytes, out) == bytes &&
+               std::fwrite(zeros, 1, align8(bytes) - bytes, out) == align8(bytes) - bytes;
+    };
+    // The header is a multiple of 8 bytes, so padding each block keeps the arrays aligned
+    static_assert(sizeof(MeshCacheHeader) % 8 == 0, "cache header must keep arrays aligned");
+    bool ok = write_block(&h, sizeof(h)) &&
+              write_block(key.data(), key.size()) &&
+              write_block(obj.vertices.data(), obj.vertices.size() * sizeof(Vertex)) &&
+              write_block(obj.normals.data(), obj.normals.size() * sizeof(Normal)) &&
+              write_block(obj.faces.data(), obj.faces.size() * sizeof(Face));
+    ok = (std::fclose(out) == 0) && ok;
+
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) std::remove(tmp.c_str());
+}
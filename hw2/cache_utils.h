@@ -0,0 +1,26 @@
+#ifndef CACHE_UTILS_H
+#define CACHE_UTILS_H
+
+#include "scene_types.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Binary sidecar cache for parsed OBJ meshes, stored next to the source as
+// "<file>.meshcache.f32" or "<file>.meshcache.f64" after the build's Real, so float and
+// double builds keep separate caches. An entry is only used when the canonical source
+// path, size, mtime and content hash all match, and when it was written with the same
+// format version and struct layout as this build.
+
+uint64_t hash_bytes(const char* data, size_t size);
+
+std::string mesh_cache_path(const std::string& obj_path);
+
+// Fills obj from the cache if a valid entry exists for the given source bytes.
+bool load_mesh_cache(const std::string& obj_path, const char* src, size_t src_size, Object& obj);
+
+// Writes obj's vectors to the sidecar. Failures (e.g. read-only directories) are ignored.
+void write_mesh_cache(const std::string& obj_path, const char* src, size_t src_size, const Object& obj);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef DEPTH_FORMAT_H
+#define DEPTH_FORMAT_H
+
+// Depth buffer formats, shared by DepthBuffer (scene_types.h) and the raster kernels. Plain
+// data only, as raster_kernel.h requires.
+//   Double   NDC z, 8 bytes per pixel, cleared to +infinity. The reference format.
+//   Float    1 - z rounded to float, 4 bytes.
+//   Unorm24  1 - z scaled to [0, 2^24 - 1] and rounded, in the low bits of 4 bytes.
+// The compact formats store depth reversed, so that cleared is 0: all zero bits, which a
+// fresh calloc page or a memset provides. A fragment passes them when its encoded depth is
+// not less than the stored one, as z <= stored z passes Double. Reversal also spends float
+// precision near z = 1, where perspective crowds distant surfaces.
+enum class DepthFormat { Double, Float, Unorm24 };
+const int kDepthFormats = 3;
+
+// Unorm24 stores (1 - z) * kUnorm24Half + 0.5, truncated
+const double kUnorm24Half = 16777215.0 / 2;
+
+// Widest rounding of a stored depth in NDC units: several float ulps of 1 - z (at most
+// 2^-22 each) and several Unorm24 steps. A depth more than this beyond the NDC depth a
+// stored value decodes to (1 - e for Float, 1 - u / kUnorm24Half for Unorm24) always
+// fails that pixel's test, in every format.
+const double kDepthSlack = 1e-6;
+
+#endif
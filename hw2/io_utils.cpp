@@ -1,5 +1,6 @@
 #include "io_utils.h"
 #include "transform_utils.h"
+#include "cache_utils.h"
 
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
@@ -13,6 +14,22 @@
 #include <optional>
 #include <stdexcept>
 #include <cctype>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 using Eigen::AngleAxisd;
 using Eigen::Matrix3d;
@@ -36,79 +53,409 @@ std::string join_path(const std::string& parent, const std::string& filename) {
     return parent + "/" + filename;
 }
 
-std::vector<Object> load_objects(const std::vector<std::string>& fpaths, std::string parent_path) {
-    // Loads objects from a list of obj file paths.
+MappedFile::MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
 
-    std::vector<Object> objects;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) {
+            ok_ = true; // Nothing to map, empty view
+        } else {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, size_, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(p);
+                mapped_ = true;
+                ok_ = true;
+            }
+        }
+    }
 
-    for (const auto& filename : fpaths) {
-        std::string file_path = join_path(parent_path, filename);
-        std::ifstream file(file_path);
-        if (!file) {
-            std::cerr << "Error: Could not open file " << file_path << std::endl;
-            continue;
+    if (!ok_) {
+        // Not mappable, read everything into memory instead
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+            fallback_.insert(fallback_.end(), chunk, chunk + n);
+        }
+        if (n == 0) {
+            data_ = fallback_.data();
+            size_ = fallback_.size();
+            ok_ = true;
+        }
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+}
+
+namespace {
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool at_token_end(const char* p, const char* end) {
+    return p == end || is_blank(*p) || *p == '\n';
+}
+
+inline void skip_blanks(const char*& p, const char* end) {
+    while (p < end && is_blank(*p)) ++p;
+}
+
+inline void skip_line(const char*& p, const char* end) {
+    const void* nl = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    p = nl ? static_cast<const char*>(nl) : end;
+}
+
+const double kPow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+bool scan_double_slow(const char*& p, const char* end, double& out) {
+    // Long mantissas or large exponents: hand the token to strtod so rounding
+    // matches what the stream-based loader produced.
+    // The copy gives strtod its terminator; tokens of any length are accepted.
+    size_t len = 0;
+    while (!at_token_end(p + len, end)) ++len;
+    std::string token(p, len);
+    char* stop = nullptr;
+    out = std::strtod(token.c_str(), &stop);
+    if (stop != token.c_str() + len) return false;
+    p += len;
+    return true;
+}
+
+bool scan_double(const char*& p, const char* end, double& out) {
+    // Decimal fast path: a mantissa below 2^53 scaled by an exact power of ten up to
+    // 1e22 is correctly rounded, so the result is bit-identical to strtod.
+    const char* start = p;
+    const char* q = p;
+    bool neg = false;
+    if (q < end && (*q == '-' || *q == '+')) { neg = (*q == '-'); ++q; }
+
+    uint64_t mant = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool overflow = false;
+    for (; q < end && *q >= '0' && *q <= '9'; ++q, ++digits) {
+        if (mant > (UINT64_MAX - 9) / 10) { overflow = true; ++exp10; continue; }
+        mant = mant * 10 + static_cast<uint64_t>(*q - '0');
+    }
+    if (q < end && *q == '.') {
+        ++q;
+        for (; q < end && *q >= '0' && *q <= '9'; ++q, ++digits) {
+            if (mant > (UINT64_MAX - 9) / 10) { overflow = true; continue; }
+            mant = mant * 10 + static_cast<uint64_t>(*q - '0');
+            --exp10;
         }
+    }
+    if (digits == 0) return false;
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        ++q;
+        bool eneg = false;
+        if (q < end && (*q == '-' || *q == '+')) { eneg = (*q == '-'); ++q; }
+        if (q == end || *q < '0' || *q > '9') return false;
+        int e = 0;
+        for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+            if (e < 100000) e = e * 10 + (*q - '0');
+        }
+        exp10 += eneg ? -e : e;
+    }
+    if (!at_token_end(q, end)) return false;
+
+    if (overflow || mant > (uint64_t(1) << 53) || exp10 < -22 || exp10 > 22) {
+        p = start;
+        return scan_double_slow(p, end, out);
+    }
+
+    double v = static_cast<double>(mant);
+    v = exp10 < 0 ? v / kPow10[-exp10] : v * kPow10[exp10];
+    out = neg ? -v : v;
+    p = q;
+    return true;
+}
 
-        std::vector<Vertex> vertices{{0.0, 0.0, 0.0}};
-        std::vector<Normal> normals{{0.0, 0.0, 0.0}};
-        std::vector<Face> faces;
-        std::string line;
-
-        // Parse all lines in an obj file
-        while (std::getline(file, line)) {
-            std::string s = line;
-            // Skip whitespace, blank lines, and comments
-            auto p = s.find_first_not_of(" \t\r\n");
-            if (p == std::string::npos) continue;
-            if (s[p] == '#') continue;
-
-            std::istringstream line_stream(s);
-            std::string type;
-            line_stream >> type;
-
-            if (type != "v" && type != "vn" && type != "f") {
-                throw std::runtime_error("Invalid format: must start with 'v', 'vn', or 'f'");
+bool scan_uint(const char*& p, const char* end, unsigned int& out) {
+    const char* q = p;
+    uint64_t v = 0;
+    for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+        v = v * 10 + static_cast<uint64_t>(*q - '0');
+        if (v > UINT_MAX) return false;
+    }
+    if (q == p) return false;
+    out = static_cast<unsigned int>(v);
+    p = q;
+    return true;
+}
+
+bool scan_vec3(const char*& p, const char* end, double& x, double& y, double& z) {
+    skip_blanks(p, end);
+    if (!scan_double(p, end, x)) return false;
+    skip_blanks(p, end);
+    if (!scan_double(p, end, y)) return false;
+    skip_blanks(p, end);
+    return scan_double(p, end, z);
+}
+
+// Parse error naming the (1-based) OBJ line it came from. Chunks know the line they start
+// on, so a chunked parse names the same line a serial one would.
+[[noreturn]] void throw_at_line(const char* what, size_t lineno) {
+    throw std::runtime_error(std::string(what) + " at line " + std::to_string(lineno));
+}
+
+// Reads the record type at the start of a line, leaving p just past it.
+enum class ObjRecord { None, Vertex, Normal, Face, Unknown };
+
+inline ObjRecord scan_record_type(const char*& p, const char* end) {
+    const char* type = p;
+    while (!at_token_end(p, end)) ++p;
+    size_t len = static_cast<size_t>(p - type);
+    if (len == 1 && type[0] == 'v') return ObjRecord::Vertex;
+    if (len == 2 && type[0] == 'v' && type[1] == 'n') return ObjRecord::Normal;
+    if (len == 1 && type[0] == 'f') return ObjRecord::Face;
+    return ObjRecord::Unknown;
+}
+
+// Appends records straight onto an Object (serial path).
+struct ObjectSink {
+    Object& obj;
+    size_t vertex_count() const { return obj.vertices.size(); }
+    size_t normal_count() const { return obj.normals.size(); }
+    void add_vertex(const Vertex& v) { obj.vertices.push_back(v); }
+    void add_normal(const Normal& n) { obj.normals.push_back(n); }
+    void add_face(const Face& f) { obj.faces.push_back(f); }
+};
+
+// Writes one chunk's records into its pre-sized slice of the output vectors.
+struct ChunkSink {
+    Vertex* vertices;
+    Normal* normals;
+    Face* faces;
+    size_t v_base, vn_base; // global index of this chunk's first vertex / normal
+    size_t nv = 0, nn = 0, nf = 0;
+    size_t vertex_count() const { return v_base + nv; }
+    size_t normal_count() const { return vn_base + nn; }
+    void add_vertex(const Vertex& v) { vertices[nv++] = v; }
+    void add_normal(const Normal& n) { normals[nn++] = n; }
+    void add_face(const Face& f) { faces[nf++] = f; }
+};
+
+template <typename Sink>
+void parse_obj_range(const char* begin, const char* end, size_t lineno, Sink& out) {
+    // Tokenizes the buffer in place, one record per line, without building any
+    // intermediate strings.
+    const char* p = begin;
+
+    while (p < end) {
+        // Skip whitespace, blank lines, and comments
+        skip_blanks(p, end);
+        if (p == end) break;
+        if (*p == '\n') { ++p; ++lineno; continue; }
+        if (*p == '#') { skip_line(p, end); continue; }
+
+        switch (scan_record_type(p, end)) {
+        case ObjRecord::Vertex: {
+            double x, y, z;
+            if (!scan_vec3(p, end, x, y, z)) throw_at_line("Invalid Vertex format", lineno);
+            skip_blanks(p, end);
+            if (p < end && *p != '\n') throw_at_line("Extra data in Vertex", lineno);
+            out.add_vertex({Real(x), Real(y), Real(z)});
+            break;
+        }
+        case ObjRecord::Normal: {
+            double x, y, z;
+            if (!scan_vec3(p, end, x, y, z)) throw_at_line("Invalid normal format", lineno);
+            skip_blanks(p, end);
+            if (p < end && *p != '\n') throw_at_line("Extra data in normal", lineno);
+            out.add_normal({Real(x), Real(y), Real(z)});
+            break;
+        }
+        case ObjRecord::Face: {
+            unsigned int v_idx[3], n_idx[3];
+            for (int i = 0; i < 3; ++i) {
+                skip_blanks(p, end);
+                if (!scan_uint(p, end, v_idx[i])) throw_at_line("Invalid face format", lineno);
+                if (end - p < 2 || p[0] != '/' || p[1] != '/') throw_at_line("Expected 'v//vn' format", lineno);
+                p += 2;
+                if (!scan_uint(p, end, n_idx[i])) throw_at_line("Invalid face format", lineno);
+                while (!at_token_end(p, end)) ++p; // ignore anything trailing the index pair
             }
 
-            if (type == "v") {
-                double x, y, z;
-                if (!(line_stream >> x >> y >> z)) throw std::runtime_error("Invalid Vertex format");
-                std::string leftover;
-                if (line_stream >> leftover) throw std::runtime_error("Extra data in Vertex");
-                vertices.push_back({x, y, z});
-            } 
-            else if (type == "vn") {
-                double x, y, z;
-                if (!(line_stream >> x >> y >> z)) throw std::runtime_error("Invalid normal format");
-                std::string leftover;
-                if (line_stream >> leftover) throw std::runtime_error("Extra data in normal");
-                normals.push_back({x, y, z});
-            } 
-            else if (type == "f") {
-                unsigned int v_idx[3], n_idx[3];
-                for (int i = 0; i < 3; ++i) {
-                    std::string token;
-                    if (!(line_stream >> token)) throw std::runtime_error("Invalid face format");
-
-                    auto pos = token.find("//");
-                    if (pos == std::string::npos) throw std::runtime_error("Expected 'v//vn' format");
-
-                    v_idx[i] = std::stoi(token.substr(0, pos));
-                    n_idx[i] = std::stoi(token.substr(pos + 2));
+            // check bounds
+            for (int i = 0; i < 3; ++i) {
+                if (v_idx[i] >= out.vertex_count() || n_idx[i] >= out.normal_count()) {
+                    throw_at_line("Face index out of range", lineno);
                 }
+            }
 
-                // check bounds
-                for (int i = 0; i < 3; ++i) {
-                    if (v_idx[i] >= vertices.size() || n_idx[i] >= normals.size()) {
-                        throw std::runtime_error("Face index out of range");
-                    }
-                }
+            out.add_face({v_idx[0], v_idx[1], v_idx[2], n_idx[0], n_idx[1], n_idx[2]});
+            skip_line(p, end);
+            break;
+        }
+        default:
+            throw_at_line("Invalid format: must start with 'v', 'vn', or 'f'", lineno);
+        }
+    }
+}
 
-                faces.push_back({v_idx[0], v_idx[1], v_idx[2], n_idx[0], n_idx[1], n_idx[2]});
+struct ChunkCounts {
+    size_t lines = 0;
+    size_t v = 0, vn = 0, f = 0;
+};
+
+ChunkCounts count_obj_records(const char* begin, const char* end) {
+    // Cheap first pass: classify each line by its record type only.
+    ChunkCounts c;
+    const char* p = begin;
+    while (p < end) {
+        skip_blanks(p, end);
+        if (p < end && *p != '\n' && *p != '#') {
+            switch (scan_record_type(p, end)) {
+            case ObjRecord::Vertex: ++c.v; break;
+            case ObjRecord::Normal: ++c.vn; break;
+            case ObjRecord::Face: ++c.f; break;
+            default: break;
             }
         }
+        skip_line(p, end);
+        if (p < end) { ++p; ++c.lines; }
+    }
+    return c;
+}
+
+constexpr size_t kMinObjChunkBytes = 64 * 1024;
+
+void parse_obj_chunked(const char* begin, const char* end, Object& obj, unsigned threads) {
+    // Splits the buffer at newline boundaries, counts records per chunk, and prefix-sums
+    // the counts so every worker knows where its records land and which line it starts
+    // on. Workers then parse straight into the final vectors, so the result is identical
+    // to a serial parse.
+    size_t size = static_cast<size_t>(end - begin);
+    std::vector<const char*> bounds{begin};
+    for (unsigned t = 1; t < threads; ++t) {
+        const char* cut = begin + size * t / threads;
+        if (cut <= bounds.back()) continue;
+        const void* nl = std::memchr(cut, '\n', static_cast<size_t>(end - cut));
+        if (!nl) break;
+        bounds.push_back(static_cast<const char*>(nl) + 1);
+    }
+    bounds.push_back(end);
+    size_t n_chunks = bounds.size() - 1;
+
+    auto run_workers = [&](const std::function<void(size_t)>& work) {
+        std::vector<std::thread> pool;
+        for (size_t c = 1; c < n_chunks; ++c) pool.emplace_back(work, c);
+        work(0);
+        for (auto& th : pool) th.join();
+    };
+
+    std::vector<ChunkCounts> counts(n_chunks);
+    run_workers([&](size_t c) { counts[c] = count_obj_records(bounds[c], bounds[c + 1]); });
+
+    std::vector<ChunkCounts> base(n_chunks);
+    base[0] = {1, obj.vertices.size(), obj.normals.size(), obj.faces.size()};
+    for (size_t c = 1; c < n_chunks; ++c) {
+        base[c].lines = base[c - 1].lines + counts[c - 1].lines;
+        base[c].v = base[c - 1].v + counts[c - 1].v;
+        base[c].vn = base[c - 1].vn + counts[c - 1].vn;
+        base[c].f = base[c - 1].f + counts[c - 1].f;
+    }
+    obj.vertices.resize(base.back().v + counts.back().v);
+    obj.normals.resize(base.back().vn + counts.back().vn);
+    obj.faces.resize(base.back().f + counts.back().f);
+
+    std::vector<std::exception_ptr> errors(n_chunks);
+    run_workers([&](size_t c) {
+        ChunkSink sink{obj.vertices.data() + base[c].v, obj.normals.data() + base[c].vn,
+                       obj.faces.data() + base[c].f, base[c].v, base[c].vn};
+        try {
+            parse_obj_range(bounds[c], bounds[c + 1], base[c].lines, sink);
+        } catch (...) {
+            errors[c] = std::current_exception();
+        }
+    });
+
+    // Chunks before a failing one parsed completely, so the earliest chunk error is the
+    // error a serial parse would have hit first.
+    for (size_t c = 0; c < n_chunks; ++c) {
+        if (errors[c]) std::rethrow_exception(errors[c]);
+    }
+}
+
+} // namespace
+
+void parse_obj_buffer(const char* begin, const char* end, Object& obj, unsigned threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t max_chunks = static_cast<size_t>(end - begin) / kMinObjChunkBytes;
+    if (threads > max_chunks) threads = static_cast<unsigned>(std::max<size_t>(1, max_chunks));
+
+    if (threads <= 1) {
+        ObjectSink sink{obj};
+        parse_obj_range(begin, end, 1, sink);
+    } else {
+        parse_obj_chunked(begin, end, obj, threads);
+    }
+}
+
+std::vector<Edge> unique_edges(const std::vector<Face>& faces) {
+    // Every face edge keyed by its vertex pair, low index first, then by its place in face
+    // order, so that sorting puts each pair's first use at the head of its run
+    std::vector<std::pair<uint64_t, size_t>> uses(3 * faces.size());
+    for (size_t f = 0; f < faces.size(); ++f) {
+        const unsigned int v[3] = {faces[f].v1, faces[f].v2, faces[f].v3};
+        for (int k = 0; k < 3; ++k) {
+            uint64_t a = v[k], b = v[(k + 1) % 3];
+            uses[3 * f + k] = {a < b ? a << 32 | b : b << 32 | a, 3 * f + k};
+        }
+    }
+    std::sort(uses.begin(), uses.end());
+    std::vector<size_t> first;
+    for (size_t i = 0; i < uses.size(); ++i) {
+        if (i == 0 || uses[i].first != uses[i - 1].first) first.push_back(uses[i].second);
+    }
+    std::sort(first.begin(), first.end());
+
+    std::vector<Edge> edges(first.size());
+    for (size_t i = 0; i < first.size(); ++i) {
+        const Face& face = faces[first[i] / 3];
+        const unsigned int v[3] = {face.v1, face.v2, face.v3};
+        int k = static_cast<int>(first[i] % 3);
+        edges[i] = Edge{v[k], v[(k + 1) % 3]};
+    }
+    return edges;
+}
+
+std::vector<Object> load_objects(const std::vector<std::string>& fpaths, std::string parent_path,
+                                 const LoadOptions& opts) {
+    // Loads objects from a list of obj file paths.
+
+    std::vector<Object> objects;
+
+    for (const auto& filename : fpaths) {
+        std::string file_path = join_path(parent_path, filename);
+        MappedFile file(file_path);
+        if (!file.ok()) {
+            std::cerr << "Error: Could not open file " << file_path << std::endl;
+            continue;
+        }
 
-        objects.push_back({file_path, vertices, normals, faces});
+        Object obj;
+        obj.filename = file_path;
+        if (!opts.use_cache || !load_mesh_cache(file_path, file.data(), file.size(), obj)) {
+            obj.vertices.push_back({0.0, 0.0, 0.0});
+            obj.normals.push_back({0.0, 0.0, 0.0});
+            parse_obj_buffer(file.data(), file.data() + file.size(), obj, opts.threads);
+            if (opts.use_cache) write_mesh_cache(file_path, file.data(), file.size(), obj);
+        }
+        if (opts.edges) obj.edges = unique_edges(obj.faces);
+
+        objects.push_back(std::move(obj));
     }
 
     return objects;
@@ -214,7 +561,7 @@ std::size_t parse_Object_mappings(
 void process_transform_blocks(
     const std::vector<std::string>& lines,
     std::size_t start_idx,
-    std::vector<Object>& objects,
+    const std::vector<std::shared_ptr<const Object>>& objects,
     const std::vector<std::string>& Object_names,
     const std::unordered_map<std::string, std::size_t>& name_to_idx,
     std::vector<ObjectInstance>& out_transformed
@@ -228,7 +575,7 @@ void process_transform_blocks(
         // s 1 1 1
         // t 0.4 -0.9 0
     // This function processes all of those blocks and writes the Object instances into "out_transformed"
-    // with lighting saved and after transforming them from Object space to world coordinates.
+    // with lighting saved. Instances share their base mesh and only store the Object to world transform.
 
     if (objects.size() != Object_names.size()) {
         throw std::runtime_error("Loaded different number of objects and names.");
@@ -254,12 +601,10 @@ void process_transform_blocks(
         try {
             std::size_t base_idx = find_string_idx(current_name, name_to_idx);
             Eigen::Matrix4d M = make_transform_from_lines(current_transform_lines);
-            auto base = objects.at(base_idx); // copy
-            apply_transform_to_object(base, M); // transform the copy
             std::size_t n = ++copy_count[current_name];
             std::string out_name = current_name + "_copy" + std::to_string(n);
             out_transformed.emplace_back(ObjectInstance{
-                std::move(base), out_name,
+                objects.at(base_idx), M, out_name,
                 current_ambient, current_diffuse,
                 current_specular, current_shininess
             });
@@ -343,14 +688,18 @@ void process_transform_blocks(
     flush_instance(); // Process what remains after we run out of lines
 }
 
-std::vector<ObjectInstance> make_transformed_objects_from_lines(const std::vector<std::string>& lines, std::string parent_path) {
+std::vector<ObjectInstance> make_transformed_objects_from_lines(const std::vector<std::string>& lines, std::string parent_path,
+                                                                const LoadOptions& opts) {
     // Parse mapping
     std::vector<std::string> Object_names;
     std::vector<std::string> Object_paths;
     std::size_t next_idx = parse_Object_mappings(lines, Object_names, Object_paths);
 
-    // Load base objects in the same order
-    std::vector<Object> objects = load_objects(Object_paths, parent_path);
+    // Load base objects in the same order, each shared by all of its instances
+    std::vector<std::shared_ptr<const Object>> objects;
+    for (auto& obj : load_objects(Object_paths, parent_path, opts)) {
+        objects.push_back(std::make_shared<const Object>(std::move(obj)));
+    }
 
     // Build name to index mapping
     std::unordered_map<std::string, std::size_t> name_to_idx;
@@ -453,7 +802,7 @@ void read_cam_params_and_lights(CameraParams& cam, std::vector<Light>& lights, s
     }
 }
 
-Scene parse_scene_file(std::ifstream& fin, std::string parent_path){
+Scene parse_scene_file(std::ifstream& fin, std::string parent_path, const LoadOptions& opts){
     CameraParams cam;
     std::vector<std::string> Object_section_lines;
 
@@ -481,16 +830,208 @@ Scene parse_scene_file(std::ifstream& fin, std::string parent_path){
     }
 
     // 4) Get transformed objects from "objects:" section
-    std::vector<ObjectInstance> scene_objects = make_transformed_objects_from_lines(Object_section_lines, parent_path);
+    std::vector<ObjectInstance> scene_objects = make_transformed_objects_from_lines(Object_section_lines, parent_path, opts);
 
     return Scene({make_cam_matrices(cam), scene_objects, lights});
 }
 
-void write_ppm(const Image& img){
-    std::cout << "P3\n" << img.xres << " " << img.yres << "\n255\n";
-    for (size_t i = 0; i < img.xres * img.yres * 3; i += 3) {
-        std::cout << static_cast<int>(img.img[i]) << " "
-                << static_cast<int>(img.img[i+1]) << " "
-                << static_cast<int>(img.img[i+2]) << "\n";
+namespace {
+
+// iovec entries per writev call: IOV_MAX on Linux and macOS
+const int kMaxIov = 1024;
+
+// Writes every byte of iov[0..n), resuming after short writes and EINTR.
+bool write_fully(int fd, struct iovec* iov, int n) {
+    while (n > 0) {
+        ssize_t w = ::writev(fd, iov, std::min(n, kMaxIov));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        size_t left = static_cast<size_t>(w);
+        while (n > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            ++iov;
+            --n;
+        }
+        if (n > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// The P3 body: "r g b\n" per pixel, formatted from a table of the 256 decimal strings.
+std::string format_p3_pixels(const uint8_t* px, size_t count) {
+    char digits[256][4];
+    uint8_t lengths[256];
+    for (int v = 0; v < 256; ++v) lengths[v] = static_cast<uint8_t>(std::snprintf(digits[v], 4, "%d", v));
+
+    std::string out(count * 12, '\0');
+    char* p = &out[0];
+    for (size_t i = 0; i < count * 3; i += 3) {
+        for (int c = 0; c < 3; ++c) {
+            uint8_t v = px[i + c];
+            std::memcpy(p, digits[v], 4);
+            p += lengths[v];
+            *p++ = c == 2 ? '\n' : ' ';
+        }
+    }
+    out.resize(p - out.data());
+    return out;
+}
+
+// P3 pixels formatted per write by PpmWriter, bounding its text buffer
+const size_t kP3ChunkPixels = 64 * 1024;
+
+bool is_stdout_path(const std::string& path) {
+    return path.empty() || path == "-";
+}
+
+// Opens path for writing, or returns stdout after any pending std::cout output.
+int open_output(const std::string& path) {
+    if (is_stdout_path(path)) {
+        std::cout.flush();
+        return STDOUT_FILENO;
+    }
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+    return fd;
+}
+
+void throw_write_error(const std::string& path, int err) {
+    throw std::runtime_error("Could not write " + (is_stdout_path(path) ? std::string("stdout") : path) + ": " +
+                             std::strerror(err));
+}
+
+std::string ppm_header(PpmFormat format, size_t xres, size_t yres) {
+    return (format == PpmFormat::P6 ? "P6\n" : "P3\n") + std::to_string(xres) + " " + std::to_string(yres) +
+           "\n255\n";
+}
+
+} // namespace
+
+void write_output(const std::string& path, const OutputPart* parts, size_t count) {
+    int fd = open_output(path);
+    std::vector<struct iovec> iov(count);
+    for (size_t i = 0; i < count; ++i) {
+        iov[i].iov_base = const_cast<void*>(parts[i].data);
+        iov[i].iov_len = parts[i].size;
+    }
+    bool ok = write_fully(fd, iov.data(), static_cast<int>(count));
+    int err = errno;
+    if (fd != STDOUT_FILENO && ::close(fd) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    if (!ok) throw_write_error(path, err);
+}
+
+void write_ppm(const Image& img, PpmFormat format, const std::string& path) {
+    std::string header = ppm_header(format, img.xres, img.yres);
+    std::string text;
+    OutputPart parts[2] = {{header.data(), header.size()}, {img.img.data(), img.xres * img.yres * 3}};
+    if (format == PpmFormat::P3) {
+        text = format_p3_pixels(img.img.data(), img.xres * img.yres);
+        parts[1] = {text.data(), text.size()};
+    }
+    write_output(path, parts, 2);
+}
+
+PpmWriter::PpmWriter(const std::string& path, size_t xres, size_t yres, PpmFormat format)
+    : path_(path), fd_(open_output(path)), xres_(xres), rows_left_(yres), format_(format) {
+    std::string header = ppm_header(format, xres, yres);
+    try {
+        write(header.data(), header.size());
+    } catch (...) {
+        if (fd_ != STDOUT_FILENO) ::close(fd_);
+        throw;
+    }
+}
+
+PpmWriter::~PpmWriter() {
+    if (fd_ >= 0 && fd_ != STDOUT_FILENO) ::close(fd_);
+}
+
+void PpmWriter::write(const void* data, size_t size) {
+    struct iovec iov = {const_cast<void*>(data), size};
+    if (!write_fully(fd_, &iov, 1)) throw_write_error(path_, errno);
+}
+
+void PpmWriter::write_rows(const uint8_t* px, size_t rows) {
+    if (rows > rows_left_) throw std::runtime_error("PPM rows written past the end of " + path_);
+    rows_left_ -= rows;
+    size_t pixels = rows * xres_;
+    if (format_ == PpmFormat::P6) {
+        write(px, pixels * 3);
+        return;
+    }
+    for (size_t i = 0; i < pixels; i += kP3ChunkPixels) {
+        std::string text = format_p3_pixels(px + 3 * i, std::min(kP3ChunkPixels, pixels - i));
+        write(text.data(), text.size());
+    }
+}
+
+void PpmWriter::close() {
+    if (rows_left_ != 0) throw std::runtime_error("PPM output ended " + std::to_string(rows_left_) + " rows short");
+    int fd = fd_;
+    fd_ = -1;
+    if (fd != STDOUT_FILENO && ::close(fd) != 0) throw_write_error(path_, errno);
+}
+
+PpmMapping::PpmMapping(const std::string& path, size_t xres, size_t yres) : path_(path), stride_(xres * 3) {
+    std::string header = ppm_header(PpmFormat::P6, xres, yres);
+    header_size_ = header.size();
+    size_t total = header_size_ + stride_ * yres;
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+    auto fail = [&](const char* what) {
+        int err = errno;
+        ::close(fd_);
+        throw std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(err));
+    };
+    struct iovec iov = {const_cast<char*>(header.data()), header.size()};
+    if (!write_fully(fd_, &iov, 1)) fail("Could not write");
+    // Reserve the blocks now: running out of space later would be a SIGBUS mid-render.
+    // Filesystems that cannot preallocate still get the right size, zero-filled.
+    int err = ::posix_fallocate(fd_, 0, static_cast<off_t>(total));
+    if (err != 0) {
+        if (err != EOPNOTSUPP && err != EINVAL) {
+            errno = err;
+            fail("Could not reserve space for");
+        }
+        if (::ftruncate(fd_, static_cast<off_t>(total)) != 0) fail("Could not size");
     }
-}
\ No newline at end of file
+}
+
+PpmMapping::~PpmMapping() {
+    ::close(fd_);
+}
+
+PixelBuffer PpmMapping::map_rows(size_t top, size_t count) const {
+    // Mappings start on a page boundary, which may fall in the header or the row above
+    size_t offset = header_size_ + top * stride_;
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t lead = offset % page;
+    size_t size = count * stride_;
+    size_t length = lead + size;
+    void* base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(offset - lead));
+    if (base == MAP_FAILED) throw std::runtime_error("Could not map " + path_ + ": " + std::strerror(errno));
+    std::shared_ptr<void> owner(base, [length](void* p) { ::munmap(p, length); });
+    return PixelBuffer(static_cast<uint8_t*>(base) + lead, size, std::move(owner));
+}
+
+PixelBuffer map_ppm_output(const std::string& path, size_t xres, size_t yres) {
+    return PpmMapping(path, xres, yres).map_rows(0, yres);
+}
+
+void sync_ppm_output(const PixelBuffer& px, const std::string& path) {
+    if (!px.mapped() || px.size() == 0) return;
+    // msync takes whole pages, and the mapping starts on the page holding the first pixel
+    uintptr_t page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+    uintptr_t start = reinterpret_cast<uintptr_t>(px.data()) & ~(page - 1);
+    size_t length = reinterpret_cast<uintptr_t>(px.data() + px.size()) - start;
+    if (::msync(reinterpret_cast<void*>(start), length, MS_SYNC) != 0) throw_write_error(path, errno);
+}
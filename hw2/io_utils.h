@@ -16,8 +16,49 @@ size_t parse_size_t(const char* str);
 
 std::string join_path(const std::string& parent, const std::string& filename);
 
+// Read-only view of a whole file. Regular files are memory-mapped; anything that
+// cannot be mapped (pipes, special files) is read into an owned buffer instead.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool ok() const { return ok_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    bool ok_ = false;
+    std::vector<char> fallback_;
+};
+
+// Options for loading a scene's OBJ files.
+struct LoadOptions {
+    unsigned threads = 1; // OBJ parser threads, 0 = one per hardware thread
+    bool use_cache = true; // read/write "<file>.meshcache.*" sidecars (see cache_utils.h)
+    bool edges = false; // build each mesh's unique edges for the wireframe (mode 3)
+};
+
+// Parses OBJ text in [begin, end) into obj, appending to its vectors. Expects obj to
+// already hold the dummy index-0 vertex and normal. Throws on malformed lines. With
+// threads > 1 large buffers are parsed in chunks; the result is the same as serial.
+void parse_obj_buffer(const char* begin, const char* end, Object& obj, unsigned threads = 1);
+
+// Each vertex pair joined by an edge of faces, once, in the order and direction of its
+// first use: face by face, edges v1-v2, v2-v3 and v3-v1. Drawing these draws every face
+// edge, each shared one once.
+std::vector<Edge> unique_edges(const std::vector<Face>& faces);
+
+// Loads each mesh, from its cache sidecar when valid, and with opts.edges builds its
+// unique edges.
 std::vector<Object> load_objects(const std::vector<std::string>& fpaths,
-                                std::string parent_path);
+                                std::string parent_path,
+                                const LoadOptions& opts = LoadOptions());
 
 Eigen::Matrix4d make_transform_from_lines(const std::vector<std::string>& lines);
 
@@ -30,16 +71,88 @@ std::size_t parse_object_mappings(const std::vector<std::string>& lines,
 
 void process_transform_blocks(const std::vector<std::string>& lines,
     std::size_t start_idx,
-    const std::vector<Object>& objects,
+    const std::vector<std::shared_ptr<const Object>>& objects,
     const std::vector<std::string>& object_names,
     const std::unordered_map<std::string, std::size_t>& name_to_idx,
     std::vector<ObjectInstance>& out_transformed);
 
 std::vector<ObjectInstance> make_transformed_objects_from_lines(const std::vector<std::string>& lines,
-                                                   std::string parent_path);
+                                                   std::string parent_path,
+                                                   const LoadOptions& opts = LoadOptions());
+
+Scene parse_scene_file(std::ifstream& fin, std::string parent_path, const LoadOptions& opts = LoadOptions());
+
+// A byte range for write_output.
+struct OutputPart {
+    const void* data;
+    size_t size;
+};
+
+// Writes parts[0..count) in order to path, or to stdout when path is empty or "-", after any
+// pending std::cout output, with as few writev calls as the system allows. Throws
+// std::runtime_error if the file cannot be opened or written.
+void write_output(const std::string& path, const OutputPart* parts, size_t count);
+
+// PPM encodings: binary (P6) or the original ASCII (P3), one "r g b" line per pixel.
+enum class PpmFormat { P6, P3 };
+
+// Writes img to path, or to stdout when path is empty or "-", through write_output: the
+// header and pixels go out in one writev.
+void write_ppm(const Image& img, PpmFormat format = PpmFormat::P6, const std::string& path = "");
+
+// Writes a PPM to path, or to stdout when path is empty or "-", a band of rows at a time,
+// for frames that are never whole in memory. Throws std::runtime_error on failure.
+class PpmWriter {
+public:
+    // Opens the output and writes the header
+    PpmWriter(const std::string& path, size_t xres, size_t yres, PpmFormat format = PpmFormat::P6);
+    ~PpmWriter();
+    PpmWriter(const PpmWriter&) = delete;
+    PpmWriter& operator=(const PpmWriter&) = delete;
+
+    // Appends rows * xres pixels, 3 bytes each, below the rows already written
+    void write_rows(const uint8_t* px, size_t rows);
+    // Closes the output; throws if rows are missing or the file could not be written
+    void close();
+
+private:
+    void write(const void* data, size_t size);
+
+    std::string path_;
+    int fd_;
+    size_t xres_;
+    size_t rows_left_;
+    PpmFormat format_;
+};
+
+// A P6 file at path, created with its header written and its pixel area reserved (black),
+// whose rows are mapped shared and writable a range at a time: pixels drawn into a mapping
+// land in the file, and a frame can be rendered into it in bands without ever being
+// mapped whole. Throws std::runtime_error if the file cannot be created, sized or mapped.
+class PpmMapping {
+public:
+    PpmMapping(const std::string& path, size_t xres, size_t yres);
+    ~PpmMapping();
+    PpmMapping(const PpmMapping&) = delete;
+    PpmMapping& operator=(const PpmMapping&) = delete;
+
+    // Rows [top, top + count), counted from the top. Releasing the buffer unmaps them;
+    // mappings stay valid after the PpmMapping is gone.
+    PixelBuffer map_rows(size_t top, size_t count) const;
+
+private:
+    std::string path_;
+    int fd_;
+    size_t header_size_;
+    size_t stride_;
+};
 
-Scene parse_scene_file(std::ifstream& fin, std::string parent_path);
+// The whole pixel area of a new PpmMapping at path. Releasing the buffer completes the file.
+PixelBuffer map_ppm_output(const std::string& path, size_t xres, size_t yres);
 
-void write_ppm(const Image& img);
+// Writes the pixels of a buffer from map_rows or map_ppm_output back to the file at path and
+// waits for them, so that a full disk or an I/O error is reported instead of leaving a short
+// or corrupt file behind once the mapping is gone. Throws std::runtime_error on failure.
+void sync_ppm_output(const PixelBuffer& px, const std::string& path);
 
 #endif
\ No newline at end of file
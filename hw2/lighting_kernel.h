@@ -0,0 +1,171 @@
+#ifndef LIGHTING_KERNEL_H
+#define LIGHTING_KERNEL_H
+
+// Batched Blinn-Phong lighting in lanes, for the per-ISA files. The rules of
+// raster_kernel.h apply: only plain data and templates over each file's own lane types.
+
+#include <cstddef>
+#include <cstdint>
+
+// How Phong pixels are lit:
+//   Scalar  lighting() on each pixel
+//   Exact   the raster ISA's batch kernel in double lanes, bit-identical to lighting()
+//   Fast    the batch kernel in float lanes, twice as many per instruction, with an
+//           approximate pow
+// Under the scalar ISA both batch paths fall back to lighting().
+enum class LightingPath { Scalar, Exact, Fast };
+
+// A light as lighting() reads it: position, color, then attenuation
+const int kLightStride = 7;
+
+// An instance's material and the scene's lights, as lighting() takes them.
+struct LightingParams {
+    const double* lights; // kLightStride doubles each
+    size_t n_lights;
+    double ambient[3], diffuse[3], specular[3];
+    double shininess;
+};
+
+// Lights count points from SoA view-space positions v[0..2] and normals n[0..2], with the
+// eye at the origin, writing point i's color as 8-bit RGB to rgb[3 * i..3 * i + 2].
+typedef void (*LightKernel)(const LightingParams& p, const double* const v[3], const double* const n[3],
+                            size_t count, uint8_t* rgb);
+
+// Besides the raster kernels' set1, add, sub, mul, div and trunc_to_int, the lighting
+// kernel needs of a lane type L:
+//   from_double(p)        N doubles from p, rounded to the lane type
+//   sqrt
+//   max(a, b), min(a, b)  a > b ? a : b and a < b ? a : b, as SSE computes them
+//   if_positive(c, a, b)  c > 0 ? a : b
+// and, depending on the pow it is given:
+//   pow(x, e)             std::pow on each lane (PowExact)
+//   split(x, k)           for positive normal x, its mantissa in [1, 2), and its
+//                         exponent into k (PowFast)
+//   floor, exp2_int(n)    2^n for integral n in [-64, 64] (PowFast)
+
+struct PowExact {
+    template <class L> static typename L::V pow(typename L::V x, double e) { return L::pow(x, e); }
+};
+
+// x^e for x in [0, 1] and e >= 0, as 2^(e log2 x): log2 of the mantissa, taken to
+// [sqrt(1/2), sqrt(2)), from its atanh series, and 2^f on [-1/2, 1/2] from its Taylor
+// series, both truncated below float precision. Relative to std::pow of the same float x
+// the error is under 3e-7 for e = 1, growing with e log2 x to under 1e-5 at e = 100 and
+// beyond (the lighting bench measures it). Results below 2^-64, far under an 8-bit step,
+// and x <= 0 give 0 (1 when e is 0), which keeps denormals out of the sums they go into.
+struct PowFast {
+    template <class L> static typename L::V pow(typename L::V x, double e) {
+        typedef typename L::V V;
+        const V one = L::set1(1.0), zero = L::set1(0.0);
+        if (e == 0) return one;
+        V k;
+        V m = L::split(L::max(x, L::set1(1.1754943508222875e-38)), k);
+        V high = L::sub(m, L::set1(1.4142135623730951));
+        m = L::if_positive(high, L::mul(m, L::set1(0.5)), m);
+        k = L::if_positive(high, L::add(k, one), k);
+        // log2 m = 2 / ln 2 (t + t^3 / 3 + t^5 / 5 + ...) with |t| < 0.172
+        V t = L::div(L::sub(m, one), L::add(m, one));
+        V t2 = L::mul(t, t);
+        const double log2_terms[] = {0.32059889797532520, 0.41219858311113240, 0.57707801635558536,
+                                     0.96179669392597560, 2.88539008177792681};
+        V series = L::set1(log2_terms[0]);
+        for (int i = 1; i < 5; ++i) series = L::add(L::mul(series, t2), L::set1(log2_terms[i]));
+        V y = L::mul(L::set1(e), L::add(k, L::mul(t, series)));
+        V keep = L::add(y, L::set1(64.0));
+        y = L::min(L::max(y, L::set1(-64.0)), L::set1(64.0));
+
+        // 2^y = 2^whole e^f, e^f = 1 + f + f^2 / 2 + ... with |f| <= ln 2 / 2
+        V whole = L::floor(L::add(y, L::set1(0.5)));
+        V f = L::mul(L::sub(y, whole), L::set1(0.69314718055994531));
+        const double exp_terms[] = {1.0 / 720, 1.0 / 120, 1.0 / 24, 1.0 / 6, 1.0 / 2, 1.0, 1.0};
+        V r = L::set1(exp_terms[0]);
+        for (int i = 1; i < 7; ++i) r = L::add(L::mul(r, f), L::set1(exp_terms[i]));
+        return L::if_positive(x, L::if_positive(keep, L::mul(r, L::exp2_int(whole)), zero), zero);
+    }
+};
+
+// a . b, summed in index order as Eigen sums a 3-vector
+template <class L>
+inline typename L::V kernel_dot(const typename L::V a[3], const typename L::V b[3]) {
+    return L::add(L::add(L::mul(a[0], b[0]), L::mul(a[1], b[1])), L::mul(a[2], b[2]));
+}
+
+// lighting() over lanes of L with the pow of P, step for step in lighting()'s order
+// with its Eigen vector operations unrolled, so that in double lanes with PowExact it
+// computes the same bits.
+template <class L, class P>
+void kernel_light(const LightingParams& p, const double* const v[3], const double* const n[3], size_t count,
+                  uint8_t* rgb) {
+    typedef typename L::V V;
+    const int N = L::N;
+    const V zero = L::set1(0.0), one = L::set1(1.0);
+    for (size_t first = 0; first < count; first += N) {
+        const size_t m = count - first < size_t(N) ? count - first : size_t(N);
+        V pos[3], nrm[3];
+        if (m == size_t(N)) {
+            for (int c = 0; c < 3; ++c) {
+                pos[c] = L::from_double(v[c] + first);
+                nrm[c] = L::from_double(n[c] + first);
+            }
+        } else {
+            // The last, partial group, padded with points at the origin
+            double tail[6][N];
+            for (int c = 0; c < 3; ++c) {
+                for (int i = 0; i < N; ++i) {
+                    tail[c][i] = size_t(i) < m ? v[c][first + i] : 0.0;
+                    tail[3 + c][i] = size_t(i) < m ? n[c][first + i] : 0.0;
+                }
+                pos[c] = L::from_double(tail[c]);
+                nrm[c] = L::from_double(tail[3 + c]);
+            }
+        }
+
+        // n is normalized unless it is zero; the directions to the eye and half vectors
+        // always are
+        V nn = kernel_dot<L>(nrm, nrm);
+        V n_len = L::sqrt(nn);
+        for (int c = 0; c < 3; ++c) nrm[c] = L::if_positive(nn, L::div(nrm[c], n_len), nrm[c]);
+        V eye[3];
+        for (int c = 0; c < 3; ++c) eye[c] = L::sub(zero, pos[c]);
+        V eye_len = L::sqrt(kernel_dot<L>(eye, eye));
+        for (int c = 0; c < 3; ++c) eye[c] = L::div(eye[c], eye_len);
+
+        V diff[3] = {zero, zero, zero}, spec[3] = {zero, zero, zero};
+        for (size_t k = 0; k < p.n_lights; ++k) {
+            const double* lt = p.lights + kLightStride * k;
+            V l[3];
+            for (int c = 0; c < 3; ++c) l[c] = L::sub(L::set1(lt[c]), pos[c]);
+            V d = L::sqrt(kernel_dot<L>(l, l));
+            for (int c = 0; c < 3; ++c) l[c] = L::if_positive(d, L::div(l[c], d), l[c]);
+            V atten = L::div(one, L::add(one, L::mul(L::mul(L::set1(lt[6]), d), d)));
+            V lambert = L::max(kernel_dot<L>(nrm, l), zero);
+
+            V h[3];
+            for (int c = 0; c < 3; ++c) h[c] = L::add(eye[c], l[c]);
+            V h_len = L::sqrt(kernel_dot<L>(h, h));
+            for (int c = 0; c < 3; ++c) h[c] = L::div(h[c], h_len);
+            V s = P::template pow<L>(L::max(kernel_dot<L>(h, nrm), zero), p.shininess);
+
+            for (int c = 0; c < 3; ++c) {
+                V w = L::mul(L::set1(lt[3 + c]), atten);
+                diff[c] = L::add(diff[c], L::mul(w, lambert));
+                spec[c] = L::add(spec[c], L::mul(w, s));
+            }
+        }
+
+        int out[3][N];
+        for (int c = 0; c < 3; ++c) {
+            V col = L::add(L::add(L::set1(p.ambient[c]), L::mul(diff[c], L::set1(p.diffuse[c]))),
+                           L::mul(spec[c], L::set1(p.specular[c])));
+            L::trunc_to_int(L::mul(L::min(one, col), L::set1(255.0)), out[c]);
+        }
+        uint8_t* px = rgb + 3 * first;
+        for (size_t i = 0; i < m; ++i) {
+            px[3 * i + 0] = static_cast<uint8_t>(out[0][i]);
+            px[3 * i + 1] = static_cast<uint8_t>(out[1][i]);
+            px[3 * i + 2] = static_cast<uint8_t>(out[2][i]);
+        }
+    }
+}
+
+#endif
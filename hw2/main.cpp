@@ -3,6 +3,7 @@
 #include "transform_utils.h"
 #include "raster_utils.h"
 #include "shading_utils.h"
+#include "png_utils.h"
 
 #include <iostream>
 #include <fstream>
@@ -11,22 +12,82 @@
 #include <string>
 #include <limits>
 #include <cmath>
+#include <cstdlib>
 
 
-Image make_blank_image(size_t xres, size_t yres, uint8_t r = 0, uint8_t g = 0, uint8_t b = 0) {
-    std::vector<uint8_t> img(xres * yres * 3);
-    for (size_t i = 0; i < img.size(); i += 3) {
-        img[i] = r;
-        img[i + 1] = g;
-        img[i + 2] = b;
+Image make_blank_image(size_t xres, size_t yres, DepthFormat depth, PixelLayout layout = PixelLayout::Linear,
+                       uint8_t r = 0, uint8_t g = 0, uint8_t b = 0) {
+    size_t pixels = layout_pixels(xres, yres, layout);
+    PixelBuffer img(pixels * 3);
+    if (r || g || b) {
+        for (size_t i = 0; i < img.size(); i += 3) {
+            img[i] = r;
+            img[i + 1] = g;
+            img[i + 2] = b;
+        }
     }
-    std::vector<double> z_buf(xres * yres, std::numeric_limits<double>::infinity());
-    return Image{std::move(img), std::move(z_buf), xres, yres};
+    Image image{std::move(img), DepthBuffer(pixels, depth), xres, yres};
+    image.layout = layout;
+    return image;
+}
+
+// A black frame whose color plane is the pixel area of the P6 file at path.
+Image make_mapped_image(const std::string& path, size_t xres, size_t yres, DepthFormat depth) {
+    return Image{map_ppm_output(path, xres, yres), DepthBuffer(xres * yres, depth), xres, yres};
+}
+
+void print_render_stats(const RenderStats& stats) {
+    std::cerr << "shading invocations: " << stats.shading_invocations << "\n"
+              << "depth test passes: " << stats.depth_passes << "\n"
+              << "hi-z culled triangles: " << stats.culled_triangles << "\n"
+              << "hi-z culled objects: " << stats.culled_objects << "\n"
+              << "tile lights: " << stats.tile_lights << "\n";
+}
+
+// Renders the frame band by band with shade_in_bands, each band going to the output as it
+// is finished: written out, or for mmap drawn straight into its own mapping of the file.
+void render_in_bands(Scene& scene, size_t xres, size_t yres, size_t mode, size_t max_bytes,
+                     const RenderOptions& opts, RenderStats& stats, PpmFormat format, const std::string& path,
+                     bool mmap) {
+    BandOutput out;
+    if (mmap) {
+        PpmMapping file(path, xres, yres);
+        out.pixels = [&](size_t top, size_t rows) { return file.map_rows(top, rows); };
+        out.done = [&](const Image& band) { sync_ppm_output(band.img, path); };
+        shade_in_bands(xres, yres, scene, mode, max_bytes, out, opts, &stats);
+        return;
+    }
+    PpmWriter writer(path, xres, yres, format);
+    out.pixels = [&](size_t, size_t rows) { return PixelBuffer(rows * xres * 3); };
+    out.done = [&](const Image& band) { writer.write_rows(band.img.data(), band.band_rows()); };
+    shade_in_bands(xres, yres, scene, mode, max_bytes, out, opts, &stats);
+    writer.close();
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 5) {
-        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres] [mode]\n";
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres] [mode] [options]\n"
+                  << "Options:\n"
+                  << "  --threads N   loader and raster threads, 0 = one per core (default 1)\n"
+                  << "  --isa NAME    raster kernels: scalar, sse2 or avx2 (default: best supported)\n"
+                  << "  --no-cache    always parse OBJ text, never read or write .meshcache.* files\n"
+                  << "  --depth NAME  depth buffer: double, float or unorm24 (default double)\n"
+                  << "  --layout NAME framebuffer layout: linear, or tiled for 8x8 Z-order micro-tiles (default linear)\n"
+                  << "  --front-to-back  draw instances and clusters of each mesh nearest first\n"
+                  << "  --no-hiz      rasterize every triangle, without Hi-Z occlusion culling\n"
+                  << "  --deferred    Phong (mode 1): resolve visibility first, then light each visible pixel once\n"
+                  << "  --lighting NAME  Phong lighting: scalar (per pixel), exact (batched, identical) or\n"
+                  << "                fast (batched in floats, approximate pow) (default exact)\n"
+                  << "  --light-cutoff X  Phong (mode 1): light each 64x64 tile only with the lights whose\n"
+                  << "                attenuated color reaches X (0 to 1) there (default 0, every light)\n"
+                  << "  --stats       print per-frame counters to stderr\n"
+                  << "  --output PATH write the image to PATH instead of stdout\n"
+                  << "  --ascii       write ASCII P3 (the default before P6) instead of binary P6, the default\n"
+                  << "  --mmap        render straight into the --output P6 file through a shared mapping\n"
+                  << "  --png         write PNG instead of PPM, encoded on --threads threads\n"
+                  << "  --png-level N PNG compression level, 0 (none) to 9 (default 6)\n"
+                  << "  --band-memory MB  render in horizontal bands whose buffers fit in MB MiB, streaming\n"
+                  << "                each band to the PPM output as it is finished\n";
         return 1;
     }
 
@@ -39,7 +100,102 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // Optional flags follow the positional arguments
+    LoadOptions load_opts;
+    RenderOptions render_opts;
+    bool print_stats = false;
+    PpmFormat out_format = PpmFormat::P6;
+    std::string out_path;
+    bool out_png = false;
+    bool out_mmap = false;
+    size_t band_memory = 0;
+    PixelLayout layout = PixelLayout::Linear;
+    PngOptions png_opts;
+    for (int i = 5; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (flag == "--threads" && i + 1 < argc) {
+            load_opts.threads = static_cast<unsigned>(parse_size_t(argv[++i]));
+            render_opts.threads = load_opts.threads;
+        } else if (flag == "--isa" && i + 1 < argc) {
+            RasterIsa isa;
+            if (!parse_raster_isa(argv[++i], isa) || !set_raster_isa(isa)) {
+                std::cerr << "Unsupported --isa " << argv[i] << ", this build and CPU support up to "
+                          << raster_isa_name(best_raster_isa()) << "\n";
+                return 1;
+            }
+        } else if (flag == "--no-cache") {
+            load_opts.use_cache = false;
+        } else if (flag == "--depth" && i + 1 < argc) {
+            if (!parse_depth_format(argv[++i], render_opts.depth)) {
+                std::cerr << "Unknown --depth " << argv[i] << ", must be double, float or unorm24\n";
+                return 1;
+            }
+        } else if (flag == "--layout" && i + 1 < argc) {
+            if (!parse_pixel_layout(argv[++i], layout)) {
+                std::cerr << "Unknown --layout " << argv[i] << ", must be linear or tiled\n";
+                return 1;
+            }
+        } else if (flag == "--front-to-back") {
+            render_opts.front_to_back = true;
+        } else if (flag == "--no-hiz") {
+            render_opts.hiz = false;
+        } else if (flag == "--deferred") {
+            render_opts.deferred = true;
+        } else if (flag == "--lighting" && i + 1 < argc) {
+            if (!parse_lighting_path(argv[++i], render_opts.lighting)) {
+                std::cerr << "Unknown --lighting " << argv[i] << ", must be scalar, exact or fast\n";
+                return 1;
+            }
+        } else if (flag == "--light-cutoff" && i + 1 < argc) {
+            char* end;
+            render_opts.light_cutoff = std::strtod(argv[++i], &end);
+            if (*end || end == argv[i] || !(render_opts.light_cutoff >= 0 && render_opts.light_cutoff < 1)) {
+                std::cerr << "Invalid --light-cutoff " << argv[i] << ", must be at least 0 and below 1\n";
+                return 1;
+            }
+        } else if (flag == "--stats") {
+            print_stats = true;
+        } else if (flag == "--output" && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (flag == "--ascii") {
+            out_format = PpmFormat::P3;
+        } else if (flag == "--mmap") {
+            out_mmap = true;
+        } else if (flag == "--band-memory" && i + 1 < argc) {
+            band_memory = parse_size_t(argv[++i]) << 20;
+            if (band_memory == 0) {
+                std::cerr << "Invalid --band-memory " << argv[i] << ", must be at least 1 MiB\n";
+                return 1;
+            }
+        } else if (flag == "--png") {
+            out_png = true;
+        } else if (flag == "--png-level" && i + 1 < argc) {
+            out_png = true;
+            png_opts.level = static_cast<int>(parse_size_t(argv[++i]));
+            if (png_opts.level > 9) {
+                std::cerr << "Invalid --png-level " << argv[i] << ", must be 0 to 9\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown option: " << flag << "\n";
+            return 1;
+        }
+    }
+    if (out_mmap && (out_path.empty() || out_path == "-" || out_png || out_format != PpmFormat::P6)) {
+        std::cerr << "--mmap needs --output PATH and binary PPM output\n";
+        return 1;
+    }
+    if (band_memory && out_png) {
+        std::cerr << "--band-memory streams PPM output only, not --png\n";
+        return 1;
+    }
+    if (layout == PixelLayout::Tiled && (band_memory || out_mmap)) {
+        std::cerr << "--layout tiled renders the whole frame in memory, not with --band-memory or --mmap\n";
+        return 1;
+    }
+
     // Load file
+    load_opts.edges = mode == 3;
     std::string parent_path = parse_parent_path(argv[1]);
     std::ifstream fin(argv[1]);
     if (!fin) {
@@ -48,10 +204,45 @@ int main(int argc, char* argv[]) {
     }
 
     // Returns camera parameters, lighting, and objects in World Space
-    Scene scene = parse_scene_file(fin, parent_path);
-    
-    Image img = make_blank_image(xres, yres);
-    shade_by_mode(img, scene, mode);
+    Scene scene = parse_scene_file(fin, parent_path, load_opts);
+    RenderStats stats;
+
+    if (band_memory) {
+        try {
+            render_in_bands(scene, xres, yres, mode, band_memory, render_opts, stats, out_format, out_path, out_mmap);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        if (print_stats) print_render_stats(stats);
+        return 0;
+    }
 
-    write_ppm(img);
+    Image img;
+    try {
+        img = out_mmap ? make_mapped_image(out_path, xres, yres, render_opts.depth)
+                       : make_blank_image(xres, yres, render_opts.depth, layout);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    shade_by_mode(img, scene, mode, render_opts, &stats);
+    if (print_stats) print_render_stats(stats);
+
+    try {
+        linearize(img);
+        if (out_mmap) {
+            // The frame is already in the file; once it is written back, unmapping completes it
+            sync_ppm_output(img.img, out_path);
+            img.img = PixelBuffer();
+        } else if (out_png) {
+            png_opts.threads = render_opts.threads;
+            write_png(img, png_opts, out_path);
+        } else {
+            write_ppm(img, out_format, out_path);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
 }
\ No newline at end of file
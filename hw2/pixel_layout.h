@@ -0,0 +1,23 @@
+#ifndef PIXEL_LAYOUT_H
+#define PIXEL_LAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// How an Image orders the pixels of its color and depth planes. Plain data only, as
+// raster_kernel.h requires.
+//   Linear  rows top to bottom, each left to right: file order.
+//   Tiled   64x64 blocks, row-major across the frame, which is padded to whole blocks.
+//           Each block is one raster tile (kTileSize), stored as a contiguous run of
+//           8x8 micro-tiles in Z (Morton) order, each of those row-major. A worker's tile
+//           is then 4096 consecutive pixels, and a tall thin triangle moves to a new
+//           micro-tile row, not a new frame row, at each step down.
+enum class PixelLayout { Linear, Tiled };
+
+const size_t kLayoutBlock = 64;
+const size_t kMicroTile = 8;
+
+// Bits of a 3-bit value spread to every other bit, for the Morton index of a micro-tile
+const uint8_t kMortonSpread3[8] = {0, 1, 4, 5, 16, 17, 20, 21};
+
+#endif
@@ -0,0 +1,209 @@
+#include "png_utils.h"
+#include "io_utils.h"
+#include "thread_utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace {
+
+// Uncompressed bytes per band: large enough that the per-band flush and dictionary
+// priming cost under 1% of the output, small enough to spread a 1080p frame over cores.
+const size_t kBandBytes = 256 * 1024;
+const size_t kWindow = 32 * 1024;
+
+void put_u32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 24));
+    out.push_back(static_cast<uint8_t>(v >> 16));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Appends a chunk whose payload is out[start + 8, end), after reserving its length and
+// type at out[start, start + 8), and its CRC.
+void finish_chunk(std::vector<uint8_t>& out, size_t start) {
+    uint32_t len = static_cast<uint32_t>(out.size() - start - 8);
+    for (int i = 0; i < 4; ++i) out[start + i] = static_cast<uint8_t>(len >> (24 - 8 * i));
+    uLong crc = crc32(0L, out.data() + start + 4, len + 4);
+    put_u32(out, static_cast<uint32_t>(crc));
+}
+
+size_t begin_chunk(std::vector<uint8_t>& out, const char* type) {
+    size_t start = out.size();
+    out.insert(out.end(), 4, 0);
+    out.insert(out.end(), type, type + 4);
+    return start;
+}
+
+// Paeth predictor from the PNG spec
+inline int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Writes row filtered with PNG filter F into out[0..n) and returns the sum of absolute
+// signed residuals. prev is the row above, or all zero bytes for the first row.
+template <int F>
+size_t filter_pass(const uint8_t* row, const uint8_t* prev, size_t n, uint8_t* out) {
+    const size_t bpp = 3;
+    size_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= bpp ? prev[i - bpp] : 0;
+        int pred = F == 0 ? 0 : F == 1 ? a : F == 2 ? b : F == 3 ? (a + b) >> 1 : paeth(a, b, c);
+        uint8_t r = static_cast<uint8_t>(row[i] - pred);
+        out[i] = r;
+        sum += r < 128 ? r : 256 - r;
+    }
+    return sum;
+}
+
+// Filters one row of n bytes into out[0] (filter type) and out[1..n]. Picks the filter
+// with the smallest sum of absolute signed residuals, libpng's default heuristic.
+void filter_row(const uint8_t* row, const uint8_t* prev, size_t n, uint8_t* out, uint8_t* scratch) {
+    typedef size_t (*Pass)(const uint8_t*, const uint8_t*, size_t, uint8_t*);
+    static const Pass passes[5] = {filter_pass<0>, filter_pass<1>, filter_pass<2>, filter_pass<3>, filter_pass<4>};
+    size_t best_sum = passes[0](row, prev, n, out + 1);
+    out[0] = 0;
+    for (int f = 1; f < 5 && best_sum > 0; ++f) {
+        size_t sum = passes[f](row, prev, n, scratch);
+        if (sum < best_sum) {
+            best_sum = sum;
+            out[0] = static_cast<uint8_t>(f);
+            std::memcpy(out + 1, scratch, n);
+        }
+    }
+}
+
+} // namespace
+
+size_t PngBuffers::size() const {
+    size_t n = 0;
+    for (const auto& p : parts) n += p.size();
+    return n;
+}
+
+PngBuffers encode_png(const Image& img, const PngOptions& opts) {
+    const size_t stride = img.xres * 3;
+    const size_t filtered_stride = stride + 1;
+    const size_t rows_per_band = std::max<size_t>(1, kBandBytes / filtered_stride);
+    const size_t n_bands = img.yres ? (img.yres + rows_per_band - 1) / rows_per_band : 0;
+    const int level = std::min(9, std::max(0, opts.level));
+
+    if (img.xres == 0 || img.yres == 0) throw std::runtime_error("PNG images cannot be empty");
+
+    // Filter every row first; each band's dictionary is the filtered data before it
+    std::vector<uint8_t> filtered(filtered_stride * img.yres);
+    const std::vector<uint8_t> zero_row(stride, 0);
+    parallel_for(n_bands, opts.threads, [&](size_t band) {
+        std::vector<uint8_t> scratch(stride);
+        size_t end = std::min(img.yres, (band + 1) * rows_per_band);
+        for (size_t y = band * rows_per_band; y < end; ++y) {
+            const uint8_t* row = img.img.data() + y * stride;
+            filter_row(row, y ? row - stride : zero_row.data(), stride, filtered.data() + y * filtered_stride,
+                       scratch.data());
+        }
+    });
+
+    PngBuffers png;
+    png.parts.resize(n_bands + 2);
+    std::vector<uLong> adlers(n_bands);
+    std::vector<int> errors(n_bands, Z_OK);
+
+    parallel_for(n_bands, opts.threads, [&](size_t band) {
+        size_t begin = band * rows_per_band * filtered_stride;
+        size_t end = std::min(img.yres, (band + 1) * rows_per_band) * filtered_stride;
+        const uint8_t* src = filtered.data() + begin;
+        size_t len = end - begin;
+        adlers[band] = adler32(adler32(0L, Z_NULL, 0), src, static_cast<uInt>(len));
+
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        // Raw deflate: the zlib header and checksum are written once around all bands
+        int err = deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        if (err == Z_OK && band > 0 && level > 0) {
+            size_t dict = std::min(kWindow, begin);
+            err = deflateSetDictionary(&zs, src - dict, static_cast<uInt>(dict));
+        }
+        if (err != Z_OK) {
+            errors[band] = err;
+            return;
+        }
+
+        std::vector<uint8_t>& out = png.parts[band + 1];
+        size_t start = begin_chunk(out, "IDAT");
+        if (band == 0) {
+            // CMF: deflate with a 32K window; FLG: level hint, then FCHECK
+            uint8_t cmf = 0x78;
+            uint8_t flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+            uint8_t flg = static_cast<uint8_t>(flevel << 6);
+            flg = static_cast<uint8_t>(flg + (31 - (cmf * 256 + flg) % 31) % 31);
+            out.push_back(cmf);
+            out.push_back(flg);
+        }
+        // Every band but the last ends with an empty stored block, leaving the stream open
+        // and byte-aligned for the next band to continue
+        bool last = band + 1 == n_bands;
+        zs.next_in = const_cast<Bytef*>(src);
+        zs.avail_in = static_cast<uInt>(len);
+        size_t pos = out.size();
+        out.resize(pos + deflateBound(&zs, len) + 16);
+        for (;;) {
+            zs.next_out = out.data() + pos;
+            zs.avail_out = static_cast<uInt>(out.size() - pos);
+            err = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+            pos = out.size() - zs.avail_out;
+            if (err == Z_STREAM_END || (!last && err == Z_OK && zs.avail_out > 0)) break;
+            if (err != Z_OK && err != Z_BUF_ERROR) {
+                errors[band] = err;
+                break;
+            }
+            out.resize(out.size() * 2);
+        }
+        out.resize(pos);
+        deflateEnd(&zs);
+        finish_chunk(out, start);
+    });
+    for (int err : errors) {
+        if (err != Z_OK) throw std::runtime_error(std::string("PNG deflate failed: ") + zError(err));
+    }
+
+    // Signature and header
+    std::vector<uint8_t>& head = png.parts.front();
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    head.assign(signature, signature + 8);
+    size_t ihdr = begin_chunk(head, "IHDR");
+    put_u32(head, static_cast<uint32_t>(img.xres));
+    put_u32(head, static_cast<uint32_t>(img.yres));
+    const uint8_t ihdr_rest[5] = {8, 2, 0, 0, 0}; // 8-bit RGB, deflate, adaptive filtering, no interlace
+    head.insert(head.end(), ihdr_rest, ihdr_rest + 5);
+    finish_chunk(head, ihdr);
+
+    // The zlib checksum of the whole stream, in a final IDAT of its own, then the end
+    std::vector<uint8_t>& tail = png.parts.back();
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (size_t band = 0; band < n_bands; ++band) {
+        size_t end = std::min(img.yres, (band + 1) * rows_per_band);
+        size_t len = (end - band * rows_per_band) * filtered_stride;
+        adler = adler32_combine(adler, adlers[band], static_cast<z_off_t>(len));
+    }
+    size_t idat = begin_chunk(tail, "IDAT");
+    put_u32(tail, static_cast<uint32_t>(adler));
+    finish_chunk(tail, idat);
+    size_t iend = begin_chunk(tail, "IEND");
+    finish_chunk(tail, iend);
+    return png;
+}
+
+void write_png(const Image& img, const PngOptions& opts, const std::string& path) {
+    PngBuffers png = encode_png(img, opts);
+    std::vector<OutputPart> parts;
+    for (const auto& p : png.parts) parts.push_back({p.data(), p.size()});
+    write_output(path, parts.data(), parts.size());
+}
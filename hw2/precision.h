@@ -0,0 +1,21 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <type_traits>
+
+// The scalar type of the geometry pipeline, chosen at build time: mesh and view-space
+// vertices and normals, their transforms and projection, and the lighting() of Gouraud
+// corners and flat faces. float, the default, halves the memory those arrays take and
+// doubles the lanes their transforms fill; build with PRECISION=double (-DHW2_REAL=double)
+// for the reference pipeline. Triangle setup, clipping, depth and Phong's per-pixel
+// attributes stay in double either way.
+#ifndef HW2_REAL
+#define HW2_REAL float
+#endif
+
+typedef HW2_REAL Real;
+
+static_assert(std::is_same<Real, float>::value || std::is_same<Real, double>::value,
+              "HW2_REAL must be float or double");
+
+#endif
@@ -0,0 +1,109 @@
+#include "raster_kernel.h"
+
+// Built with -mavx2 on x86 (see the Makefile); the rest of the program is not, and only
+// calls into this file after checking the CPU at runtime (raster_utils.cpp).
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+#include <math.h>
+
+namespace {
+
+struct Avx2Lanes {
+    typedef __m256d V;
+    static const int N = 4;
+
+    static V set1(double x) { return _mm256_set1_pd(x); }
+    static V ramp() { return _mm256_set_pd(3.0, 2.0, 1.0, 0.0); }
+    static V load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm256_div_pd(a, b); }
+    static V bit_or(V a, V b) { return _mm256_or_pd(a, b); }
+    static int sign_mask(V v) { return _mm256_movemask_pd(v); }
+    static int depth_pass(V z, V zb) {
+        V in_range = _mm256_and_pd(_mm256_cmp_pd(z, set1(-1.0), _CMP_NLT_UQ),
+                                   _mm256_cmp_pd(z, set1(1.0), _CMP_NGT_UQ));
+        return _mm256_movemask_pd(_mm256_and_pd(in_range, _mm256_cmp_pd(z, zb, _CMP_NGT_UQ)));
+    }
+    static int reverse_depth_pass(V z, V e, V eb) {
+        V in_range = _mm256_and_pd(_mm256_cmp_pd(z, set1(-1.0), _CMP_NLT_UQ),
+                                   _mm256_cmp_pd(z, set1(1.0), _CMP_NGT_UQ));
+        return _mm256_movemask_pd(_mm256_and_pd(in_range, _mm256_cmp_pd(e, eb, _CMP_NLT_UQ)));
+    }
+    static V load_float(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+    static V load_uint(const uint32_t* p) {
+        return _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+    static V round_to_float(V v) { return _mm256_cvtps_pd(_mm256_cvtpd_ps(v)); }
+    static V trunc(V v) { return _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(v)); }
+    static void trunc_to_int(V v, int* out) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_cvttpd_epi32(v));
+    }
+
+    static V from_double(const double* p) { return load(p); }
+    static V sqrt(V v) { return _mm256_sqrt_pd(v); }
+    static V max(V a, V b) { return _mm256_max_pd(a, b); }
+    static V min(V a, V b) { return _mm256_min_pd(a, b); }
+    static V if_positive(V c, V a, V b) {
+        return _mm256_blendv_pd(b, a, _mm256_cmp_pd(c, _mm256_setzero_pd(), _CMP_GT_OQ));
+    }
+    // libm's pow, the one lighting() calls, not an inline copy
+    static V pow(V x, double e) {
+        double lanes[N];
+        store(lanes, x);
+        for (int i = 0; i < N; ++i) lanes[i] = ::pow(lanes[i], e);
+        return load(lanes);
+    }
+};
+
+// Eight floats, for the Fast lighting kernel.
+struct Avx2FloatLanes {
+    typedef __m256 V;
+    static const int N = 8;
+
+    static V set1(double x) { return _mm256_set1_ps(static_cast<float>(x)); }
+    static V from_double(const double* p) {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_loadu_pd(p))),
+                                    _mm256_cvtpd_ps(_mm256_loadu_pd(p + 4)), 1);
+    }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm256_div_ps(a, b); }
+    static V sqrt(V v) { return _mm256_sqrt_ps(v); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static V if_positive(V c, V a, V b) {
+        return _mm256_blendv_ps(b, a, _mm256_cmp_ps(c, _mm256_setzero_ps(), _CMP_GT_OQ));
+    }
+    static V floor(V v) { return _mm256_floor_ps(v); }
+    static V split(V x, V& k) {
+        __m256i bits = _mm256_castps_si256(x);
+        k = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+        return _mm256_castsi256_ps(
+            _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+    }
+    static V exp2_int(V n) {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+    }
+    static void trunc_to_int(V v, int* out) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvttps_epi32(v));
+    }
+};
+
+} // namespace
+
+const RasterKernels* raster_kernels_avx2() {
+    return make_raster_kernels<Avx2Lanes, Avx2FloatLanes>("avx2");
+}
+
+#else
+
+const RasterKernels* raster_kernels_avx2() {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef RASTER_KERNEL_H
+#define RASTER_KERNEL_H
+
+// Lane-parallel raster kernels, shared by the per-ISA files (raster_sse2.cpp, raster_avx2.cpp).
+// raster_avx2.cpp is compiled with AVX2 enabled, so nothing here may pull in inline
+// functions or templates that other files also instantiate (Eigen, the standard library):
+// the linker could keep the AVX2 copy for the whole program. Only plain data and
+// templates over each file's own lane type belong in this header.
+
+#include "depth_format.h"
+#include "lighting_kernel.h"
+#include "pixel_layout.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// One triangle clipped to a rect, with its integer edge functions held as doubles. The
+// caller only builds one when every edge value in the rect is below 2^52, so adding the
+// steps stays exact and the kernels reproduce the scalar rasterizer bit for bit.
+struct KernelTriangle {
+    double row[3]; // edge functions at (x_min, y_min)
+    double step_x[3], step_y[3];
+    double area[3];
+    double z[3];
+    int x_min, x_max, y_min, y_max;
+};
+
+struct KernelTarget {
+    void* z_buf; // in the format the kernels were picked for
+    uint8_t* img;
+    size_t width, height;
+    size_t blocks_x; // 0 for a Linear image, else the 64-pixel blocks per row of a Tiled one
+};
+
+// The Phong pixels of one row that passed the depth test, in SoA layout for the lighting
+// kernels: pixel i is (x[i], y), with interpolated view-space position v[0..2][i] and
+// normal n[0..2][i].
+struct PhongFragments {
+    int y;
+    int* x;
+    double* v[3];
+    double* n[3];
+};
+
+// Called after each row with that row's count fragments; ctx is passed through.
+typedef void (*PhongShadeFn)(void* ctx, const PhongFragments& frags, size_t count);
+
+// The kernels for one depth buffer format.
+// All but phong return the number of pixels written.
+struct DepthKernels {
+    size_t (*flat)(const KernelTriangle& t, const KernelTarget& dst, const uint8_t rgb[3]);
+    size_t (*gouraud)(const KernelTriangle& t, const KernelTarget& dst, const double col[3][3]);
+    // Writes z only; frags needs room for one row of the rect.
+    void (*phong)(const KernelTriangle& t, const KernelTarget& dst, const double attr[3][6],
+                  const PhongFragments& frags, PhongShadeFn shade, void* ctx);
+    // Writes z, and id into ids (laid out like z_buf), for deferred shading.
+    size_t (*visibility)(const KernelTriangle& t, const KernelTarget& dst, uint32_t id, uint32_t* ids);
+};
+
+struct RasterKernels {
+    const char* name;
+    DepthKernels depth[kDepthFormats]; // indexed by DepthFormat
+    LightKernel light_exact; // LightingPath::Exact, in double lanes
+    LightKernel light_fast; // LightingPath::Fast, in float lanes
+};
+
+// nullptr when the build lacks the instruction set. The caller checks the CPU.
+const RasterKernels* raster_kernels_sse2();
+const RasterKernels* raster_kernels_avx2();
+
+// The kernels below are written against a lane type L providing:
+//   V, N            vector of N doubles
+//   set1, ramp      broadcast, and {0, 1, ..., N-1}
+//   load, store     unaligned
+//   add, sub, mul, div, bit_or
+//   sign_mask(v)    bit i set when lane i has its sign bit set
+//   depth_pass(z, zb)  bit i set when put_pixel would accept z over zb:
+//                      !(z < -1) && !(z > 1) && !(z > zb), so NaN behaves the same
+//   reverse_depth_pass(z, e, eb)  the same range test on z, and !(e < eb) for encoded depths
+//   load_float, load_uint  N floats or N uint32s (below 2^31), widened
+//   round_to_float(v)  each lane rounded to float precision
+//   trunc(v)           each lane truncated to an integer, via int32
+//   trunc_to_int(v, out)  truncating conversion of each lane into out[0..N-1]
+// Arithmetic follows the scalar expressions' evaluation order with no fused multiply-add.
+
+// Depth codecs, one per DepthFormat, matching DepthBuffer::test_and_set bit for bit. T is
+// the stored type; encode turns NDC z lanes into stored values, held exactly as doubles.
+struct DepthDouble {
+    typedef double T;
+    template <class L> static typename L::V load(const T* p) { return L::load(p); }
+    template <class L> static typename L::V encode(typename L::V z) { return z; }
+    template <class L> static int pass(typename L::V z, typename L::V, typename L::V zb) {
+        return L::depth_pass(z, zb);
+    }
+};
+
+struct DepthFloat {
+    typedef float T;
+    template <class L> static typename L::V load(const T* p) { return L::load_float(p); }
+    template <class L> static typename L::V encode(typename L::V z) {
+        return L::round_to_float(L::sub(L::set1(1.0), z));
+    }
+    template <class L> static int pass(typename L::V z, typename L::V e, typename L::V eb) {
+        return L::reverse_depth_pass(z, e, eb);
+    }
+};
+
+struct DepthUnorm24 {
+    typedef uint32_t T;
+    template <class L> static typename L::V load(const T* p) { return L::load_uint(p); }
+    // NaN truncates to INT_MIN and never passes, as in the scalar test
+    template <class L> static typename L::V encode(typename L::V z) {
+        return L::trunc(L::add(L::mul(L::sub(L::set1(1.0), z), L::set1(kUnorm24Half)), L::set1(0.5)));
+    }
+    template <class L> static int pass(typename L::V z, typename L::V e, typename L::V eb) {
+        return L::reverse_depth_pass(z, e, eb);
+    }
+};
+
+// Offset of pixel (x, y) in dst's planes, as Image::pixel_index computes it.
+template <class L>
+inline size_t kernel_offset(const KernelTarget& dst, int x, int y) {
+    size_t r = dst.height - 1 - size_t(y);
+    if (!dst.blocks_x) return r * dst.width + size_t(x);
+    size_t block = (r / kLayoutBlock) * dst.blocks_x + size_t(x) / kLayoutBlock;
+    size_t micro = kMortonSpread3[(x / kMicroTile) % 8] | kMortonSpread3[(r / kMicroTile) % 8] << 1;
+    return (block * 64 + micro) * 64 + (r % kMicroTile) * kMicroTile + size_t(x) % kMicroTile;
+}
+
+// Visits every L::N-pixel group of the rect holding at least one pixel that is inside
+// the triangle and passes the depth test, with pass as a lane bitmask, the depths to
+// store encoded by D, and the offset of the group's first pixel in dst's planes.
+// Groups start on multiples of N, so their pixels are consecutive in either layout (a
+// micro-tile row is 8 wide) and stay inside any rect with N-aligned x bounds, such as a
+// tile; lanes outside the triangle's rect are masked off.
+template <class L, class D, class Visit>
+inline void kernel_walk(const KernelTriangle& t, const KernelTarget& dst, Visit&& visit) {
+    typedef typename L::V V;
+    typedef typename D::T T;
+    const int N = L::N;
+    const int full = (1 << N) - 1;
+    const int x_start = t.x_min & ~(N - 1);
+    const int lead = t.x_min - x_start;
+    const int first_valid = full & ~((1 << lead) - 1);
+
+    V lane_off[3], group_step[3], area[3];
+    for (int k = 0; k < 3; ++k) {
+        lane_off[k] = L::mul(L::ramp(), L::set1(t.step_x[k]));
+        group_step[k] = L::set1(t.step_x[k] * N);
+        area[k] = L::set1(t.area[k]);
+    }
+    const V z0 = L::set1(t.z[0]), z1 = L::set1(t.z[1]), z2 = L::set1(t.z[2]);
+
+    double row[3];
+    for (int k = 0; k < 3; ++k) row[k] = t.row[k] - t.step_x[k] * lead;
+    for (int y = t.y_min; y <= t.y_max; ++y) {
+        V e0 = L::add(L::set1(row[0]), lane_off[0]);
+        V e1 = L::add(L::set1(row[1]), lane_off[1]);
+        V e2 = L::add(L::set1(row[2]), lane_off[2]);
+
+        for (int x = x_start; x <= t.x_max; x += N) {
+            int n = t.x_max - x + 1;
+            int valid = n >= N ? full : (1 << n) - 1;
+            if (x == x_start) valid &= first_valid;
+            V outside = L::bit_or(L::bit_or(L::bit_or(e0, e1), L::bit_or(e2, L::sub(area[0], e0))),
+                                  L::bit_or(L::sub(area[1], e1), L::sub(area[2], e2)));
+            int inside = ~L::sign_mask(outside) & valid;
+            if (inside) {
+                V alpha = L::div(e0, area[0]);
+                V beta = L::div(e1, area[1]);
+                V gamma = L::div(e2, area[2]);
+                V z = L::add(L::add(L::mul(alpha, z0), L::mul(beta, z1)), L::mul(gamma, z2));
+                V ze = D::template encode<L>(z);
+                size_t off = kernel_offset<L>(dst, x, y);
+                const T* zp = static_cast<const T*>(dst.z_buf) + off;
+                V zb;
+                if (dst.blocks_x || x + N <= static_cast<int>(dst.width)) {
+                    zb = D::template load<L>(zp);
+                } else {
+                    // The last group of a Linear row, which may end mid-group
+                    T tail[N];
+                    for (int i = 0; i < N; ++i) tail[i] = i < n ? zp[i] : T(0);
+                    zb = D::template load<L>(tail);
+                }
+                int pass = inside & D::template pass<L>(z, ze, zb);
+                if (pass) visit(x, y, pass, alpha, beta, gamma, ze, off);
+            }
+            e0 = L::add(e0, group_step[0]);
+            e1 = L::add(e1, group_step[1]);
+            e2 = L::add(e2, group_step[2]);
+        }
+        row[0] += t.step_y[0];
+        row[1] += t.step_y[1];
+        row[2] += t.step_y[2];
+    }
+}
+
+// a * p[0] + b * p[1] + c * p[2], in that order
+template <class L>
+inline typename L::V kernel_lerp(typename L::V a, typename L::V b, typename L::V c, double p0, double p1, double p2) {
+    return L::add(L::add(L::mul(a, L::set1(p0)), L::mul(b, L::set1(p1))), L::mul(c, L::set1(p2)));
+}
+
+template <class L, class D>
+size_t kernel_flat(const KernelTriangle& t, const KernelTarget& dst, const uint8_t rgb[3]) {
+    typedef typename L::V V;
+    typedef typename D::T T;
+    size_t written = 0;
+    kernel_walk<L, D>(t, dst, [&](int, int, int pass, V, V, V, V z, size_t off) {
+        written += __builtin_popcount(pass);
+        double zs[L::N];
+        L::store(zs, z);
+        T* zp = static_cast<T*>(dst.z_buf) + off;
+        uint8_t* px = dst.img + 3 * off;
+        for (int i = 0; i < L::N; ++i) {
+            if (!(pass >> i & 1)) continue;
+            zp[i] = static_cast<T>(zs[i]);
+            px[3 * i + 0] = rgb[0];
+            px[3 * i + 1] = rgb[1];
+            px[3 * i + 2] = rgb[2];
+        }
+    });
+    return written;
+}
+
+template <class L, class D>
+size_t kernel_gouraud(const KernelTriangle& t, const KernelTarget& dst, const double col[3][3]) {
+    typedef typename L::V V;
+    typedef typename D::T T;
+    const V scale = L::set1(255.0);
+    size_t written = 0;
+    kernel_walk<L, D>(t, dst, [&](int, int, int pass, V alpha, V beta, V gamma, V z, size_t off) {
+        written += __builtin_popcount(pass);
+        double zs[L::N];
+        int rgb[3][L::N];
+        L::store(zs, z);
+        for (int c = 0; c < 3; ++c) {
+            V v = kernel_lerp<L>(alpha, beta, gamma, col[0][c], col[1][c], col[2][c]);
+            L::trunc_to_int(L::mul(v, scale), rgb[c]);
+        }
+        T* zp = static_cast<T*>(dst.z_buf) + off;
+        uint8_t* px = dst.img + 3 * off;
+        for (int i = 0; i < L::N; ++i) {
+            if (!(pass >> i & 1)) continue;
+            zp[i] = static_cast<T>(zs[i]);
+            px[3 * i + 0] = static_cast<uint8_t>(rgb[0][i]);
+            px[3 * i + 1] = static_cast<uint8_t>(rgb[1][i]);
+            px[3 * i + 2] = static_cast<uint8_t>(rgb[2][i]);
+        }
+    });
+    return written;
+}
+
+template <class L, class D>
+void kernel_phong(const KernelTriangle& t, const KernelTarget& dst, const double attr[3][6],
+                  const PhongFragments& frags, PhongShadeFn shade, void* ctx) {
+    typedef typename L::V V;
+    typedef typename D::T T;
+    size_t count = 0;
+    PhongFragments row = frags;
+    row.y = t.y_min;
+    kernel_walk<L, D>(t, dst, [&](int x, int y, int pass, V alpha, V beta, V gamma, V z, size_t off) {
+        if (y != row.y) {
+            if (count) shade(ctx, row, count);
+            count = 0;
+            row.y = y;
+        }
+        double zs[L::N];
+        double a[6][L::N];
+        L::store(zs, z);
+        for (int c = 0; c < 6; ++c) {
+            L::store(a[c], kernel_lerp<L>(alpha, beta, gamma, attr[0][c], attr[1][c], attr[2][c]));
+        }
+        T* zp = static_cast<T*>(dst.z_buf) + off;
+        for (int i = 0; i < L::N; ++i) {
+            if (!(pass >> i & 1)) continue;
+            zp[i] = static_cast<T>(zs[i]);
+            row.x[count] = x + i;
+            for (int c = 0; c < 3; ++c) {
+                row.v[c][count] = a[c][i];
+                row.n[c][count] = a[3 + c][i];
+            }
+            ++count;
+        }
+    });
+    if (count) shade(ctx, row, count);
+}
+
+template <class L, class D>
+size_t kernel_visibility(const KernelTriangle& t, const KernelTarget& dst, uint32_t id, uint32_t* ids) {
+    typedef typename L::V V;
+    typedef typename D::T T;
+    size_t written = 0;
+    kernel_walk<L, D>(t, dst, [&](int, int, int pass, V, V, V, V z, size_t off) {
+        written += __builtin_popcount(pass);
+        double zs[L::N];
+        L::store(zs, z);
+        T* zp = static_cast<T*>(dst.z_buf) + off;
+        for (int i = 0; i < L::N; ++i) {
+            if (!(pass >> i & 1)) continue;
+            zp[i] = static_cast<T>(zs[i]);
+            ids[off + i] = id;
+        }
+    });
+    return written;
+}
+
+template <class L, class D>
+DepthKernels make_depth_kernels() {
+    return DepthKernels{kernel_flat<L, D>, kernel_gouraud<L, D>, kernel_phong<L, D>, kernel_visibility<L, D>};
+}
+
+// L is the file's double lanes, F its float lanes for the Fast lighting kernel.
+template <class L, class F>
+const RasterKernels* make_raster_kernels(const char* name) {
+    static const RasterKernels kernels = {name,
+                                          {make_depth_kernels<L, DepthDouble>(), make_depth_kernels<L, DepthFloat>(),
+                                           make_depth_kernels<L, DepthUnorm24>()},
+                                          kernel_light<L, PowExact>,
+                                          kernel_light<F, PowFast>};
+    return &kernels;
+}
+
+#endif
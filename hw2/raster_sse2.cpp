@@ -0,0 +1,113 @@
+#include "raster_kernel.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+#include <math.h>
+
+namespace {
+
+struct Sse2Lanes {
+    typedef __m128d V;
+    static const int N = 2;
+
+    static V set1(double x) { return _mm_set1_pd(x); }
+    static V ramp() { return _mm_set_pd(1.0, 0.0); }
+    static V load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, V v) { _mm_storeu_pd(p, v); }
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm_div_pd(a, b); }
+    static V bit_or(V a, V b) { return _mm_or_pd(a, b); }
+    static int sign_mask(V v) { return _mm_movemask_pd(v); }
+    static int depth_pass(V z, V zb) {
+        V in_range = _mm_and_pd(_mm_cmpnlt_pd(z, set1(-1.0)), _mm_cmpngt_pd(z, set1(1.0)));
+        return _mm_movemask_pd(_mm_and_pd(in_range, _mm_cmpngt_pd(z, zb)));
+    }
+    static int reverse_depth_pass(V z, V e, V eb) {
+        V in_range = _mm_and_pd(_mm_cmpnlt_pd(z, set1(-1.0)), _mm_cmpngt_pd(z, set1(1.0)));
+        return _mm_movemask_pd(_mm_and_pd(in_range, _mm_cmpnlt_pd(e, eb)));
+    }
+    static V load_float(const float* p) {
+        return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    }
+    static V load_uint(const uint32_t* p) {
+        return _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    }
+    static V round_to_float(V v) { return _mm_cvtps_pd(_mm_cvtpd_ps(v)); }
+    static V trunc(V v) { return _mm_cvtepi32_pd(_mm_cvttpd_epi32(v)); }
+    static void trunc_to_int(V v, int* out) {
+        __m128i i = _mm_cvttpd_epi32(v);
+        out[0] = _mm_cvtsi128_si32(i);
+        out[1] = _mm_cvtsi128_si32(_mm_shuffle_epi32(i, 1));
+    }
+
+    static V from_double(const double* p) { return load(p); }
+    static V sqrt(V v) { return _mm_sqrt_pd(v); }
+    static V max(V a, V b) { return _mm_max_pd(a, b); }
+    static V min(V a, V b) { return _mm_min_pd(a, b); }
+    static V if_positive(V c, V a, V b) {
+        V mask = _mm_cmpgt_pd(c, _mm_setzero_pd());
+        return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+    }
+    // libm's pow, the one lighting() calls
+    static V pow(V x, double e) {
+        double lanes[N];
+        store(lanes, x);
+        for (int i = 0; i < N; ++i) lanes[i] = ::pow(lanes[i], e);
+        return load(lanes);
+    }
+};
+
+// Four floats, for the Fast lighting kernel.
+struct Sse2FloatLanes {
+    typedef __m128 V;
+    static const int N = 4;
+
+    static V set1(double x) { return _mm_set1_ps(static_cast<float>(x)); }
+    static V from_double(const double* p) {
+        return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(p)), _mm_cvtpd_ps(_mm_loadu_pd(p + 2)));
+    }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V sqrt(V v) { return _mm_sqrt_ps(v); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V if_positive(V c, V a, V b) {
+        V mask = _mm_cmpgt_ps(c, _mm_setzero_ps());
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+    // SSE2 has no floor: truncate, then step down where that rounded up
+    static V floor(V v) {
+        V t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+    }
+    static V split(V x, V& k) {
+        __m128i bits = _mm_castps_si128(x);
+        k = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+        return _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+    }
+    static V exp2_int(V n) {
+        return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+    }
+    static void trunc_to_int(V v, int* out) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_cvttps_epi32(v));
+    }
+};
+
+} // namespace
+
+const RasterKernels* raster_kernels_sse2() {
+    return make_raster_kernels<Sse2Lanes, Sse2FloatLanes>("sse2");
+}
+
+#else
+
+const RasterKernels* raster_kernels_sse2() {
+    return nullptr;
+}
+
+#endif
@@ -2,8 +2,13 @@
 #include "scene_types.h"
 #include "transform_utils.h"
 #include "shading_utils.h"
+#include "raster_kernel.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
 #include <vector>
 #include <random>
 #include <Eigen/Dense>
@@ -11,199 +16,662 @@
 using Eigen::Vector3d;
 
 
-inline void put_pixel(int x, int y, double z, uint8_t r, uint8_t g, uint8_t b,
+inline bool put_pixel(int x, int y, double z, uint8_t r, uint8_t g, uint8_t b,
                          Image& img, float a) {
     size_t W = img.xres;
     size_t H = img.yres;
-    if ((unsigned)x >= (unsigned)W || (unsigned)y >= (unsigned)H) return;
-    if (z < -1 || z > 1) return;
-    size_t py = (size_t)H - 1 - size_t(y);
-    size_t buf_idx = (py*W + x);
+    if ((unsigned)x >= (unsigned)W || (unsigned)y >= (unsigned)H) return false;
+    if (z < -1 || z > 1) return false;
+    // Row within the band; wraps past H for rows above it, and lands past z_buf below it
+    size_t py = (size_t)H - 1 - size_t(y) - img.band_top;
+    if (py >= H) return false;
+    size_t buf_idx = img.pixel_index(x, y);
+    if (buf_idx >= img.z_buf.size()) return false;
     size_t idx = 3ull*buf_idx;
-    if (z > img.z_buf[buf_idx]) return;
+    if (!img.z_buf.test_and_set(buf_idx, z)) return false;
     img.img[idx+0] = uint8_t((1.f - a)*img.img[idx+0] + a*r);
     img.img[idx+1] = uint8_t((1.f - a)*img.img[idx+1] + a*g);
     img.img[idx+2] = uint8_t((1.f - a)*img.img[idx+2] + a*b);
-    img.z_buf[buf_idx] = z;
+    return true;
 }
 
+namespace {
+
+// floor(a / b) for b > 0
+int64_t floor_div(int64_t a, int64_t b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Blends color c over pixel (x, y) of img with weight a / 256, behind put_pixel's depth
+// test at depth 0.
+inline void blend_line_pixel(int x, int y, uint32_t a, const uint8_t c[3], Image& img) {
+    size_t i = img.pixel_index(x, y);
+    if (!img.z_buf.test_and_set(i, 0.0)) return;
+    uint8_t* px = &img.img[3 * i];
+    for (int k = 0; k < 3; ++k) px[k] = static_cast<uint8_t>((px[k] * (256 - a) + c[k] * a) >> 8);
+}
+
+} // namespace
+
 void draw_line(int x0,int y0,int x1,int y1,
                uint8_t r,uint8_t g,uint8_t b,
                Image& img)
 {
-    // NOTE: Uncomment to avoid drawing lines to points that are offscreen
-    // if ((unsigned)x0 > (unsigned)W || (unsigned)y0 > (unsigned)H ||
-    //         (unsigned)x1 > (unsigned)W || (unsigned)y1 > (unsigned)H) return;
-    
-    bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+    draw_line(x0, y0, x1, y1, r, g, b, full_rect(img), img);
+}
+
+void draw_line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, const PixelRect& clip, Image& img) {
+    // Step along the major axis u, left to right, with v the minor axis (Bresenham's
+    // octant symmetries, see hw1's README)
+    bool steep = std::abs(int64_t(y1) - y0) > std::abs(int64_t(x1) - x0);
     if (steep) { std::swap(x0, y0); std::swap(x1, y1); }
     if (x0 > x1) { std::swap(x0, x1); std::swap(y0, y1); }
+    const int u_lo = steep ? clip.y_min : clip.x_min, u_hi = steep ? clip.y_max : clip.x_max;
+    const int v_lo = steep ? clip.x_min : clip.y_min, v_hi = steep ? clip.x_max : clip.y_max;
 
-    int dx = x1 - x0;
-    int dy_abs = std::abs(y1 - y0);
-    int ystep = (y0 < y1) ? 1 : -1;
-
-    // fractional error in [0,1), how far the true line is toward the next y
-    float errf = 0.0f;
-    float slope = dx ? (float)dy_abs / (float)dx : 0.0f;
+    // Step t, at u = x0 + t, has the line at v = y0 + vstep (q + num / dx), with q and num
+    // the quotient and remainder of t dy / dx. Pixel v0 = y0 + vstep q gets weight
+    // 1 - num / dx and its neighbor v0 + vstep num / dx.
+    const int64_t dx = int64_t(x1) - x0, dy = std::abs(int64_t(y1) - y0);
+    const int vstep = y0 < y1 ? 1 : -1;
+    int64_t t_first = std::max<int64_t>(0, int64_t(u_lo) - x0);
+    int64_t t_last = std::min<int64_t>(dx, int64_t(u_hi) - x0);
+    // Liang-Barsky in integers: the steps whose v0 or neighbor falls within [v_lo, v_hi]
+    int64_t q_lo = vstep > 0 ? int64_t(v_lo) - y0 - 1 : int64_t(y0) - v_hi - 1;
+    int64_t q_hi = vstep > 0 ? int64_t(v_hi) - y0 : int64_t(y0) - v_lo;
+    if (dy == 0) {
+        // Level: the neighbor has weight 0
+        if (q_hi < 0 || q_lo >= 0) return;
+    } else {
+        if (q_hi < 0) return;
+        if (q_lo > 0) t_first = std::max(t_first, -floor_div(-q_lo * dx, dy));
+        t_last = std::min(t_last, -floor_div(-(q_hi + 1) * dx, dy) - 1);
+    }
+    if (t_first > t_last) return;
 
-    int y = y0;
-    for (int x = x0; x <= x1; ++x) {
-        // Nearer pixel gets weight 1-errf, the other gets errf
-        float w0 = 1.0f - errf; // current y
-        float w1 = errf; // neighbor at y + ystep
+    // num and the weight w = floor(256 num / dx) are stepped as Bresenham error terms
+    int64_t num = dx ? t_first * dy % dx : 0;
+    int64_t v = y0 + vstep * (dx ? t_first * dy / dx : 0);
+    int64_t w = dx ? 256 * num / dx : 0, w_err = dx ? 256 * num % dx : 0;
+    const int64_t w_step = dx ? 256 * dy / dx : 0, w_step_err = dx ? 256 * dy % dx : 0;
+    const uint8_t c[3] = {r, g, b};
+    for (int64_t t = t_first; t <= t_last; ++t) {
+        int u = static_cast<int>(x0 + t);
+        if (v >= v_lo && v <= v_hi) {
+            if (steep) blend_line_pixel(int(v), u, uint32_t(256 - w), c, img);
+            else blend_line_pixel(u, int(v), uint32_t(256 - w), c, img);
+        }
+        int64_t vn = v + vstep;
+        if (w > 0 && vn >= v_lo && vn <= v_hi) {
+            if (steep) blend_line_pixel(int(vn), u, uint32_t(w), c, img);
+            else blend_line_pixel(u, int(vn), uint32_t(w), c, img);
+        }
 
-        if (steep) {
-            put_pixel(y,x,0.0, r,g,b, img, w0);
-            put_pixel(y+ystep,x,0.0, r,g,b, img, w1);
-        } else {
-            put_pixel(x,y,0.0, r,g,b, img, w0);
-            put_pixel(x,y+ystep,0.0, r,g,b, img, w1);
+        num += dy;
+        w += w_step;
+        w_err += w_step_err;
+        if (w_err >= dx) {
+            w_err -= dx;
+            ++w;
+        }
+        if (num >= dx) {
+            num -= dx;
+            v += vstep;
+            w -= 256;
         }
+    }
+}
+
+bool setup_triangle(const ScreenVertex& sa, const ScreenVertex& sb, const ScreenVertex& sc,
+                    const Image& img, TriangleSetup& t) {
+    const ScreenVertex* v[3] = {&sa, &sb, &sc};
+
+    t.x_min = std::max(0, std::min({sa.x, sb.x, sc.x}));
+    t.x_max = std::min(static_cast<int>(img.xres) - 1, std::max({sa.x, sb.x, sc.x}));
+    t.y_min = std::max(0, std::min({sa.y, sb.y, sc.y}));
+    t.y_max = std::min(static_cast<int>(img.yres) - 1, std::max({sa.y, sb.y, sc.y}));
+    if (t.x_min > t.x_max || t.y_min > t.y_max) return false;
 
-        errf += slope;
-        while (errf >= 1.0f) {
-            y += ystep;
-            errf -= 1.0f;
+    for (int k = 0; k < 3; ++k) {
+        const ScreenVertex& p = *v[(k + 1) % 3];
+        const ScreenVertex& q = *v[(k + 2) % 3];
+        const ScreenVertex& o = *v[k];
+        // f(x, y) = (p.y - q.y) x + (q.x - p.x) y + p.x q.y - q.x p.y
+        int64_t dx = int64_t(p.y) - q.y;
+        int64_t dy = int64_t(q.x) - p.x;
+        int64_t c = int64_t(p.x) * q.y - int64_t(q.x) * p.y;
+        int64_t area = dx * o.x + dy * o.y + c;
+        if (area == 0) return false;
+        // Flip the sign so a pixel is inside when 0 <= f <= area for all three edges
+        int64_t sign = area < 0 ? -1 : 1;
+        t.step_x[k] = sign * dx;
+        t.step_y[k] = sign * dy;
+        t.row[k] = sign * (dx * t.x_min + dy * t.y_min + c);
+        t.area[k] = sign * area;
+        t.area_d[k] = static_cast<double>(t.area[k]);
+        t.z[k] = o.z;
+    }
+    return true;
+}
+
+// Calls shade(x, y, alpha, beta, gamma) for every pixel of the triangle inside clip.
+// Coverage is decided on the integer edge functions. The barycentrics are still divided
+// rather than multiplied by a reciprocal area, which would move z by an ulp and flip
+// which of two coplanar faces wins the depth test.
+template <typename Shade>
+void raster_triangle(const TriangleSetup& t, const PixelRect& clip, Shade&& shade) {
+    int x_min = std::max(t.x_min, clip.x_min), x_max = std::min(t.x_max, clip.x_max);
+    int y_min = std::max(t.y_min, clip.y_min), y_max = std::min(t.y_max, clip.y_max);
+    if (x_min > x_max || y_min > y_max) return;
+
+    int64_t row[3];
+    for (int k = 0; k < 3; ++k) {
+        row[k] = t.row[k] + t.step_x[k] * (x_min - t.x_min) + t.step_y[k] * (y_min - t.y_min);
+    }
+    for (int y = y_min; y <= y_max; ++y) {
+        int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+        for (int x = x_min; x <= x_max; ++x) {
+            // Inside when every e_k and area_k - e_k is non-negative, tested with one sign bit
+            if ((e0 | e1 | e2 | (t.area[0] - e0) | (t.area[1] - e1) | (t.area[2] - e2)) >= 0) {
+                shade(x, y, e0 / t.area_d[0], e1 / t.area_d[1], e2 / t.area_d[2]);
+            }
+            e0 += t.step_x[0];
+            e1 += t.step_x[1];
+            e2 += t.step_x[2];
         }
+        row[0] += t.step_y[0];
+        row[1] += t.step_y[1];
+        row[2] += t.step_y[2];
     }
 }
 
-struct ComputeABGResult {
-    double alpha, beta, gamma;
+namespace {
+
+const RasterKernels* kernels_for(RasterIsa isa) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (isa == RasterIsa::AVX2 && __builtin_cpu_supports("avx2")) return raster_kernels_avx2();
+    if (isa == RasterIsa::SSE2 && __builtin_cpu_supports("sse2")) return raster_kernels_sse2();
+#endif
+    return nullptr;
+}
+
+struct IsaSelection {
+    RasterIsa isa;
+    const RasterKernels* kernels; // nullptr for the scalar loops
 };
 
-ComputeABGResult compute_abg(int x_a, int x_b, int x_c, int y_a, int y_b, int y_c, int x, int y){
-    auto f = [] (int xi, int xj, int yi, int yj, int xp, int yp) { 
-        return (yi - yj) * xp + (xj - xi) * yp + xi * yj - xj * yi; 
-    };
-    
-    double alpha_num = f(x_b, x_c, y_b, y_c, x, y);
-    double alpha_denom = f(x_b, x_c, y_b, y_c, x_a, y_a);
-    double alpha = alpha_num / alpha_denom;
+IsaSelection& isa_selection() {
+    static IsaSelection selection{best_raster_isa(), kernels_for(best_raster_isa())};
+    return selection;
+}
+
+// Edge values handed to the lane kernels stay below this, so they are exact as doubles
+const double kMaxExactEdge = 4503599627370496.0; // 2^52
 
-    double beta_num = f(x_a, x_c, y_a, y_c, x, y);
-    double beta_denom = f(x_a, x_c, y_a, y_c, x_b, y_b);
-    double beta = beta_num / beta_denom;
+// Converts t, clipped to clip, for the lane kernels. False if nothing is left after
+// clipping or the edge functions could grow too large to step exactly in doubles.
+bool make_kernel_triangle(const TriangleSetup& t, const PixelRect& clip, KernelTriangle& kt) {
+    kt.x_min = std::max(t.x_min, clip.x_min);
+    kt.x_max = std::min(t.x_max, clip.x_max);
+    kt.y_min = std::max(t.y_min, clip.y_min);
+    kt.y_max = std::min(t.y_max, clip.y_max);
+    if (kt.x_min > kt.x_max || kt.y_min > kt.y_max) return false;
+
+    // lane groups are aligned, so lanes may start before x_min and step past x_max before being masked
+    double w = kt.x_max - kt.x_min + 8.0;
+    double h = kt.y_max - kt.y_min + 1.0;
+    for (int k = 0; k < 3; ++k) {
+        int64_t row = t.row[k] + t.step_x[k] * (kt.x_min - t.x_min) + t.step_y[k] * (kt.y_min - t.y_min);
+        double bound = std::abs(double(row)) + std::abs(double(t.step_x[k])) * w +
+                       std::abs(double(t.step_y[k])) * h + t.area_d[k];
+        if (!(bound < kMaxExactEdge)) return false;
+        kt.row[k] = static_cast<double>(row);
+        kt.step_x[k] = static_cast<double>(t.step_x[k]);
+        kt.step_y[k] = static_cast<double>(t.step_y[k]);
+        kt.area[k] = t.area_d[k];
+        kt.z[k] = t.z[k];
+    }
+    return true;
+}
 
-    double gamma_num = f(x_a, x_b, y_a, y_b, x, y);
-    double gamma_denom = f(x_a, x_b, y_a, y_b, x_c, y_c);
-    double gamma = gamma_num / gamma_denom;
+// The selected kernels for img's depth format, or nullptr for the scalar loops.
+const DepthKernels* depth_kernels(const Image& img) {
+    const RasterKernels* kernels = isa_selection().kernels;
+    return kernels ? &kernels->depth[static_cast<int>(img.z_buf.format())] : nullptr;
+}
 
-    return ComputeABGResult({alpha, beta, gamma});
+KernelTarget kernel_target(Image& img) {
+    // The kernels find row y at height - 1 - y, so a band is a frame whose top rows are cut off
+    // A Tiled image is never banded
+    size_t blocks_x = img.layout == PixelLayout::Tiled ? (img.xres + kLayoutBlock - 1) / kLayoutBlock : 0;
+    return KernelTarget{img.z_buf.data(), img.img.data(), img.xres, img.yres - img.band_top, blocks_x};
 }
 
-void raster_triangle_flat(std::vector<Vertex>& verts, Image& img, Vector3d col) {
-    ndc_to_screen(img, verts);
+// Light lays out its fields as the kernels' kLightStride doubles
+static_assert(sizeof(Light) == kLightStride * sizeof(double) && offsetof(Light, r) == 3 * sizeof(double) &&
+                  offsetof(Light, atten) == 6 * sizeof(double),
+              "Light does not match LightingParams::lights");
+
+LightingParams lighting_params(const ObjectInstance& obj_inst, const std::vector<Light>& lights) {
+    LightingParams p;
+    p.lights = lights.empty() ? nullptr : &lights[0].x;
+    p.n_lights = lights.size();
+    for (int c = 0; c < 3; ++c) {
+        p.ambient[c] = obj_inst.ambient[c];
+        p.diffuse[c] = obj_inst.diffuse[c];
+        p.specular[c] = obj_inst.specular[c];
+    }
+    p.shininess = obj_inst.shininess;
+    return p;
+}
+
+struct PhongShadeCtx {
+    Image* img;
+    const std::vector<Light>* lights;
+    const ObjectInstance* obj_inst;
+    LightingPath path;
+    size_t shaded;
+};
+
+// Lights the fragments a Phong kernel emitted; their depth is already written.
+void shade_phong_fragments(void* ctx, const PhongFragments& frags, size_t count) {
+    PhongShadeCtx& c = *static_cast<PhongShadeCtx*>(ctx);
+    c.shaded += count;
+    Image& img = *c.img;
+    static thread_local std::vector<uint8_t> rgb;
+    rgb.resize(std::max(rgb.size(), 3 * count));
+    light_fragments(c.path, *c.obj_inst, *c.lights, frags.v, frags.n, count, rgb.data());
+    for (size_t i = 0; i < count; ++i) {
+        size_t idx = 3 * img.pixel_index(frags.x[i], frags.y);
+        img.img[idx + 0] = rgb[3 * i + 0];
+        img.img[idx + 1] = rgb[3 * i + 1];
+        img.img[idx + 2] = rgb[3 * i + 2];
+    }
+}
+
+} // namespace
+
+RasterIsa best_raster_isa() {
+    if (kernels_for(RasterIsa::AVX2)) return RasterIsa::AVX2;
+    if (kernels_for(RasterIsa::SSE2)) return RasterIsa::SSE2;
+    return RasterIsa::Scalar;
+}
+
+bool set_raster_isa(RasterIsa isa) {
+    const RasterKernels* kernels = kernels_for(isa);
+    if (isa != RasterIsa::Scalar && !kernels) return false;
+    isa_selection() = IsaSelection{isa, kernels};
+    return true;
+}
+
+RasterIsa raster_isa() {
+    return isa_selection().isa;
+}
+
+const char* raster_isa_name(RasterIsa isa) {
+    switch (isa) {
+        case RasterIsa::AVX2: return "avx2";
+        case RasterIsa::SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+bool parse_raster_isa(const std::string& name, RasterIsa& isa) {
+    for (RasterIsa candidate : {RasterIsa::Scalar, RasterIsa::SSE2, RasterIsa::AVX2}) {
+        if (name == raster_isa_name(candidate)) {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* depth_format_name(DepthFormat format) {
+    switch (format) {
+        case DepthFormat::Float: return "float";
+        case DepthFormat::Unorm24: return "unorm24";
+        default: return "double";
+    }
+}
+
+bool parse_depth_format(const std::string& name, DepthFormat& format) {
+    for (DepthFormat candidate : {DepthFormat::Double, DepthFormat::Float, DepthFormat::Unorm24}) {
+        if (name == depth_format_name(candidate)) {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* pixel_layout_name(PixelLayout layout) {
+    return layout == PixelLayout::Tiled ? "tiled" : "linear";
+}
+
+bool parse_pixel_layout(const std::string& name, PixelLayout& layout) {
+    for (PixelLayout candidate : {PixelLayout::Linear, PixelLayout::Tiled}) {
+        if (name == pixel_layout_name(candidate)) {
+            layout = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* lighting_path_name(LightingPath path) {
+    switch (path) {
+        case LightingPath::Scalar: return "scalar";
+        case LightingPath::Fast: return "fast";
+        default: return "exact";
+    }
+}
+
+bool parse_lighting_path(const std::string& name, LightingPath& path) {
+    for (LightingPath candidate : {LightingPath::Scalar, LightingPath::Exact, LightingPath::Fast}) {
+        if (name == lighting_path_name(candidate)) {
+            path = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void light_fragments(LightingPath path, const ObjectInstance& obj_inst, const std::vector<Light>& lights,
+                     const double* const v[3], const double* const n[3], size_t count, uint8_t* rgb) {
+    const RasterKernels* kernels = isa_selection().kernels;
+    if (kernels && path != LightingPath::Scalar) {
+        LightKernel light = path == LightingPath::Fast ? kernels->light_fast : kernels->light_exact;
+        light(lighting_params(obj_inst, lights), v, n, count, rgb);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        Vector3d col = lighting(Vector3d(v[0][i], v[1][i], v[2][i]), Vector3d(n[0][i], n[1][i], n[2][i]), obj_inst,
+                                lights);
+        rgb[3 * i + 0] = static_cast<uint8_t>(col[0] * 255);
+        rgb[3 * i + 1] = static_cast<uint8_t>(col[1] * 255);
+        rgb[3 * i + 2] = static_cast<uint8_t>(col[2] * 255);
+    }
+}
+
+void linearize(Image& img) {
+    if (img.layout == PixelLayout::Linear) return;
+    const size_t blocks_x = (img.xres + kLayoutBlock - 1) / kLayoutBlock;
+    PixelBuffer pixels(img.xres * img.yres * 3);
+    // A micro-tile row is kMicroTile consecutive pixels in both layouts
+    for (size_t r = 0; r < img.yres; ++r) {
+        for (size_t x = 0; x < img.xres; x += kMicroTile) {
+            size_t n = std::min<size_t>(kMicroTile, img.xres - x);
+            std::memcpy(pixels.data() + 3 * (r * img.xres + x), img.img.data() + 3 * tiled_pixel_offset(x, r, blocks_x),
+                        3 * n);
+        }
+    }
+    img.img = std::move(pixels);
+    img.z_buf = DepthBuffer(0, img.z_buf.format());
+    img.layout = PixelLayout::Linear;
+}
+
+size_t raster_triangle_flat(const TriangleSetup& t, const PixelRect& clip, Image& img, const Vector3d& col) {
     uint8_t r = static_cast<uint8_t>(col[0] * 255);
     uint8_t g = static_cast<uint8_t>(col[1] * 255);
     uint8_t b = static_cast<uint8_t>(col[2] * 255);
 
-    int x_a = static_cast<int>(std::lround(verts[0].x));
-    int y_a = static_cast<int>(std::lround(verts[0].y));
-    double z_a = verts[0].z;
-    int x_b = static_cast<int>(std::lround(verts[1].x));
-    int y_b = static_cast<int>(std::lround(verts[1].y));
-    double z_b = verts[1].z;
-    int x_c = static_cast<int>(std::lround(verts[2].x));
-    int y_c = static_cast<int>(std::lround(verts[2].y));
-    double z_c = verts[2].z;
-
-    int x_min = static_cast<int>(std::min({x_a, x_b, x_c}));
-    int x_max = static_cast<int>(std::max({x_a, x_b, x_c}));
-    int y_min = static_cast<int>(std::min({y_a, y_b, y_c}));
-    int y_max = static_cast<int>(std::max({y_a, y_b, y_c}));
-
-    for (auto x = x_min; x <= x_max; ++x) {
-        for (auto y = y_min; y <= y_max; ++y) {
-            ComputeABGResult abg = compute_abg(x_a, x_b, x_c, y_a, y_b, y_c, x, y);
-            double alpha = abg.alpha;
-            double beta = abg.beta;
-            double gamma = abg.gamma;
-
-            if (alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1 && gamma >= 0 && gamma <= 1){
-                double z = alpha * z_a + beta * z_b + gamma * z_c;
-                put_pixel(x, y, z, r, g, b, img);
-            }
+    KernelTriangle kt;
+    const DepthKernels* kernels = depth_kernels(img);
+    if (kernels && make_kernel_triangle(t, clip, kt)) {
+        const uint8_t rgb[3] = {r, g, b};
+        return kernels->flat(kt, kernel_target(img), rgb);
+    }
+
+    size_t written = 0;
+    raster_triangle(t, clip, [&](int x, int y, double alpha, double beta, double gamma) {
+        double z = alpha * t.z[0] + beta * t.z[1] + gamma * t.z[2];
+        written += put_pixel(x, y, z, r, g, b, img);
+    });
+    return written;
+}
+
+size_t raster_triangle_gouraud(const TriangleSetup& t, const PixelRect& clip, Image& img,
+                               const Vector3d& col1, const Vector3d& col2, const Vector3d& col3) {
+    KernelTriangle kt;
+    const DepthKernels* kernels = depth_kernels(img);
+    if (kernels && make_kernel_triangle(t, clip, kt)) {
+        const double cols[3][3] = {{col1[0], col1[1], col1[2]}, {col2[0], col2[1], col2[2]}, {col3[0], col3[1], col3[2]}};
+        return kernels->gouraud(kt, kernel_target(img), cols);
+    }
+
+    size_t written = 0;
+    raster_triangle(t, clip, [&](int x, int y, double alpha, double beta, double gamma) {
+        double z = alpha * t.z[0] + beta * t.z[1] + gamma * t.z[2];
+        Vector3d col = alpha * col1 + beta * col2 + gamma * col3;
+        uint8_t r = static_cast<uint8_t>(col[0] * 255);
+        uint8_t g = static_cast<uint8_t>(col[1] * 255);
+        uint8_t b = static_cast<uint8_t>(col[2] * 255);
+        written += put_pixel(x, y, z, r, g, b, img);
+    });
+    return written;
+}
+
+size_t raster_triangle_phong(const TriangleSetup& t, const PixelRect& clip, Image& img,
+                             const Vector3d& v1, const Vector3d& v2, const Vector3d& v3,
+                             const Vector3d& n1, const Vector3d& n2, const Vector3d& n3,
+                             const std::vector<Light>& lights, const ObjectInstance& obj_inst, LightingPath path) {
+    KernelTriangle kt;
+    const DepthKernels* kernels = depth_kernels(img);
+    if (kernels && make_kernel_triangle(t, clip, kt)) {
+        const double attr[3][6] = {{v1[0], v1[1], v1[2], n1[0], n1[1], n1[2]},
+                                   {v2[0], v2[1], v2[2], n2[0], n2[1], n2[2]},
+                                   {v3[0], v3[1], v3[2], n3[0], n3[1], n3[2]}};
+        // One row of fragments, reused across calls on this thread
+        static thread_local std::vector<int> xs;
+        static thread_local std::vector<double> attrs;
+        const size_t width = size_t(kt.x_max - kt.x_min + 1);
+        if (xs.size() < width) {
+            xs.resize(width);
+            attrs.resize(6 * width);
+        }
+        const size_t stride = xs.size();
+        PhongFragments frags{0, xs.data(), {&attrs[0], &attrs[stride], &attrs[2 * stride]},
+                             {&attrs[3 * stride], &attrs[4 * stride], &attrs[5 * stride]}};
+        PhongShadeCtx ctx{&img, &lights, &obj_inst, path, 0};
+        kernels->phong(kt, kernel_target(img), attr, frags, shade_phong_fragments, &ctx);
+        return ctx.shaded;
+    }
+
+    size_t shaded = 0;
+    raster_triangle(t, clip, [&](int x, int y, double alpha, double beta, double gamma) {
+        double z = alpha * t.z[0] + beta * t.z[1] + gamma * t.z[2];
+        Vector3d v = alpha * v1 + beta * v2 + gamma * v3;
+        Vector3d n = alpha * n1 + beta * n2 + gamma * n3;
+        Vector3d col = lighting(v, n, obj_inst, lights);
+        ++shaded;
+        uint8_t r = static_cast<uint8_t>(col[0] * 255);
+        uint8_t g = static_cast<uint8_t>(col[1] * 255);
+        uint8_t b = static_cast<uint8_t>(col[2] * 255);
+        put_pixel(x, y, z, r, g, b, img);
+    });
+    return shaded;
+}
+
+size_t raster_triangle_visibility(const TriangleSetup& t, const PixelRect& clip, Image& img,
+                                  uint32_t id, std::vector<uint32_t>& ids) {
+    KernelTriangle kt;
+    const DepthKernels* kernels = depth_kernels(img);
+    if (kernels && make_kernel_triangle(t, clip, kt)) {
+        return kernels->visibility(kt, kernel_target(img), id, ids.data());
+    }
+
+    size_t written = 0;
+    raster_triangle(t, clip, [&](int x, int y, double alpha, double beta, double gamma) {
+        double z = alpha * t.z[0] + beta * t.z[1] + gamma * t.z[2];
+        // put_pixel's depth tests, keeping the triangle instead of a color
+        if (z < -1 || z > 1) return;
+        size_t buf_idx = img.pixel_index(x, y);
+        if (!img.z_buf.test_and_set(buf_idx, z)) return;
+        ids[buf_idx] = id;
+        ++written;
+    });
+    return written;
+}
+
+void triangle_barycentrics(const TriangleSetup& t, int x, int y, double& alpha, double& beta, double& gamma) {
+    int64_t e[3];
+    for (int k = 0; k < 3; ++k) {
+        e[k] = t.row[k] + t.step_x[k] * (x - t.x_min) + t.step_y[k] * (y - t.y_min);
+    }
+    alpha = e[0] / t.area_d[0];
+    beta = e[1] / t.area_d[1];
+    gamma = e[2] / t.area_d[2];
+}
+
+PixelRect full_rect(const Image& img) {
+    int y_max = static_cast<int>(img.yres - img.band_top) - 1;
+    return PixelRect{0, y_max - static_cast<int>(img.band_rows()) + 1, static_cast<int>(img.xres) - 1, y_max};
+}
+
+TileBins make_tile_bins(const Image& img) {
+    TileBins bins;
+    reset_tile_bins(bins, img);
+    return bins;
+}
+
+void reset_tile_bins(TileBins& bins, const Image& img) {
+    bins.area = full_rect(img);
+    bins.tiles_x = (bins.area.x_max - bins.area.x_min + kTileSize) / kTileSize;
+    bins.tiles_y = (bins.area.y_max - bins.area.y_min + kTileSize) / kTileSize;
+    bins.tris.resize(static_cast<size_t>(bins.tiles_x) * bins.tiles_y);
+    for (auto& tile : bins.tris) tile.clear();
+}
+
+void bin_triangle(TileBins& bins, const TriangleSetup& t, uint32_t index) {
+    // Conservative: every tile the clipped bounding box touches
+    bin_rect(bins, PixelRect{t.x_min, t.y_min, t.x_max, t.y_max}, index);
+}
+
+void bin_rect(TileBins& bins, const PixelRect& box, uint32_t index) {
+    const PixelRect& a = bins.area;
+    int x_min = std::max(box.x_min, a.x_min), x_max = std::min(box.x_max, a.x_max);
+    int y_min = std::max(box.y_min, a.y_min), y_max = std::min(box.y_max, a.y_max);
+    if (x_min > x_max || y_min > y_max) return;
+    for (int ty = (y_min - a.y_min) / kTileSize; ty <= (y_max - a.y_min) / kTileSize; ++ty) {
+        for (int tx = (x_min - a.x_min) / kTileSize; tx <= (x_max - a.x_min) / kTileSize; ++tx) {
+            bins.tris[static_cast<size_t>(ty) * bins.tiles_x + tx].push_back(index);
         }
     }
 }
 
-void raster_triangle_gouraud(std::vector<Vertex>& verts, Image& img, Vector3d col1, Vector3d col2, Vector3d col3) {
-    ndc_to_screen(img, verts);
-
-    int x_a = static_cast<int>(std::lround(verts[0].x));
-    int y_a = static_cast<int>(std::lround(verts[0].y));
-    double z_a = verts[0].z;
-    int x_b = static_cast<int>(std::lround(verts[1].x));
-    int y_b = static_cast<int>(std::lround(verts[1].y));
-    double z_b = verts[1].z;
-    int x_c = static_cast<int>(std::lround(verts[2].x));
-    int y_c = static_cast<int>(std::lround(verts[2].y));
-    double z_c = verts[2].z;
-
-    int x_min = static_cast<int>(std::min({x_a, x_b, x_c}));
-    int x_max = static_cast<int>(std::max({x_a, x_b, x_c}));
-    int y_min = static_cast<int>(std::min({y_a, y_b, y_c}));
-    int y_max = static_cast<int>(std::max({y_a, y_b, y_c}));
-
-    for (auto x = x_min; x <= x_max; ++x) {
-        for (auto y = y_min; y <= y_max; ++y) {
-            ComputeABGResult abg = compute_abg(x_a, x_b, x_c, y_a, y_b, y_c, x, y);
-            double alpha = abg.alpha;
-            double beta = abg.beta;
-            double gamma = abg.gamma;
-
-            if (alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1 && gamma >= 0 && gamma <= 1){
-                double z = alpha * z_a + beta * z_b + gamma * z_c;
-                Vector3d col = alpha * col1 + beta * col2 + gamma * col3;
-                uint8_t r = static_cast<uint8_t>(col[0] * 255);
-                uint8_t g = static_cast<uint8_t>(col[1] * 255);
-                uint8_t b = static_cast<uint8_t>(col[2] * 255);
-                put_pixel(x, y, z, r, g, b, img);
+PixelRect tile_rect(const TileBins& bins, size_t tile) {
+    int x = bins.area.x_min + static_cast<int>(tile % bins.tiles_x) * kTileSize;
+    int y = bins.area.y_min + static_cast<int>(tile / bins.tiles_x) * kTileSize;
+    return PixelRect{x, y, std::min(x + kTileSize - 1, bins.area.x_max), std::min(y + kTileSize - 1, bins.area.y_max)};
+}
+
+namespace {
+
+// Block range of area within the tile; false if they do not meet
+bool hiz_blocks(const TileHiZ& hiz, const PixelRect& area, int& bx0, int& by0, int& bx1, int& by1) {
+    const PixelRect& r = hiz.rect;
+    int x0 = std::max(area.x_min, r.x_min), x1 = std::min(area.x_max, r.x_max);
+    int y0 = std::max(area.y_min, r.y_min), y1 = std::min(area.y_max, r.y_max);
+    if (x0 > x1 || y0 > y1) return false;
+    bx0 = (x0 - r.x_min) / kHiZBlock;
+    bx1 = (x1 - r.x_min) / kHiZBlock;
+    by0 = (y0 - r.y_min) / kHiZBlock;
+    by1 = (y1 - r.y_min) / kHiZBlock;
+    return true;
+}
+
+// Whether node (nx, ny) of level l is behind z_min wherever it meets blocks [bx0, bx1] x [by0, by1]
+bool hiz_node_occluded(const TileHiZ& hiz, int l, int nx, int ny, int bx0, int by0, int bx1, int by1,
+                       double z_min) {
+    if (z_min > hiz.level[l][ny * (kHiZSide >> l) + nx] + kDepthSlack) return true;
+    if (l == 0) return false;
+    for (int cy = 2 * ny; cy <= 2 * ny + 1; ++cy) {
+        for (int cx = 2 * nx; cx <= 2 * nx + 1; ++cx) {
+            int s = 1 << (l - 1); // blocks per child side
+            if (cx * s > bx1 || (cx + 1) * s <= bx0 || cy * s > by1 || (cy + 1) * s <= by0) continue;
+            if (!hiz_node_occluded(hiz, l - 1, cx, cy, bx0, by0, bx1, by1, z_min)) return false;
+        }
+    }
+    return true;
+}
+
+// Sets the level 0 bound of each dirty block to the farthest of its pixels' depths, read
+// from img's depth buffer as T and decoded to NDC depth (see kDepthSlack). A clear Double
+// pixel is +infinity, as is a stored NaN, which every depth passes.
+template <class T, class Decode>
+void hiz_read_blocks(TileHiZ& hiz, const Image& img, Decode decode) {
+    const T* z_buf = static_cast<const T*>(img.z_buf.data());
+    const PixelRect& r = hiz.rect;
+    for (uint64_t dirty = hiz.dirty; dirty; dirty &= dirty - 1) {
+        int b = __builtin_ctzll(dirty);
+        int x0 = r.x_min + (b % kHiZSide) * kHiZBlock, y0 = r.y_min + (b / kHiZSide) * kHiZBlock;
+        int w = std::min(kHiZBlock, r.x_max - x0 + 1), h = std::min(kHiZBlock, r.y_max - y0 + 1);
+        double far = -std::numeric_limits<double>::infinity();
+        for (int y = y0; y < y0 + h; ++y) {
+            // A block row is consecutive in either layout
+            const T* row = z_buf + img.pixel_index(x0, y);
+            for (int x = 0; x < w; ++x) {
+                double d = decode(row[x]);
+                // NaN passes every test, so nothing is behind it
+                far = d > far || d != d ? d : far;
             }
         }
+        hiz.level[0][b] = far == far ? far : std::numeric_limits<double>::infinity();
+    }
+}
+
+} // namespace
+
+TileHiZ make_tile_hiz(const PixelRect& rect) {
+    TileHiZ hiz;
+    hiz.rect = rect;
+    for (auto& level : hiz.level) std::fill(std::begin(level), std::end(level), std::numeric_limits<double>::infinity());
+    return hiz;
+}
+
+bool hiz_occluded(const TileHiZ& hiz, const PixelRect& area, double z_min) {
+    int bx0, by0, bx1, by1;
+    if (!hiz_blocks(hiz, area, bx0, by0, bx1, by1)) return false;
+    if ((bx1 - bx0 + 1) * (by1 - by0 + 1) > 4) {
+        return hiz_node_occluded(hiz, kHiZLevels - 1, 0, 0, bx0, by0, bx1, by1, z_min);
+    }
+    // Small areas, most triangles: the few blocks directly
+    for (int by = by0; by <= by1; ++by) {
+        for (int bx = bx0; bx <= bx1; ++bx) {
+            if (!(z_min > hiz.level[0][by * kHiZSide + bx] + kDepthSlack)) return false;
+        }
     }
+    return true;
 }
 
-void raster_triangle_phong(std::vector<Vertex>& verts, Image& img, 
-                            Vector3d v1, Vector3d v2, Vector3d v3, 
-                            Vector3d n1, Vector3d n2, Vector3d n3, 
-                            const Scene& scene, const ObjectInstance& obj_inst) {
-    ndc_to_screen(img, verts);
-
-    int x_a = static_cast<int>(std::lround(verts[0].x));
-    int y_a = static_cast<int>(std::lround(verts[0].y));
-    double z_a = verts[0].z;
-    int x_b = static_cast<int>(std::lround(verts[1].x));
-    int y_b = static_cast<int>(std::lround(verts[1].y));
-    double z_b = verts[1].z;
-    int x_c = static_cast<int>(std::lround(verts[2].x));
-    int y_c = static_cast<int>(std::lround(verts[2].y));
-    double z_c = verts[2].z;
-
-    int x_min = static_cast<int>(std::min({x_a, x_b, x_c}));
-    int x_max = static_cast<int>(std::max({x_a, x_b, x_c}));
-    int y_min = static_cast<int>(std::min({y_a, y_b, y_c}));
-    int y_max = static_cast<int>(std::max({y_a, y_b, y_c}));
-
-    for (auto x = x_min; x <= x_max; ++x) {
-        for (auto y = y_min; y <= y_max; ++y) {
-            ComputeABGResult abg = compute_abg(x_a, x_b, x_c, y_a, y_b, y_c, x, y);
-            double alpha = abg.alpha;
-            double beta = abg.beta;
-            double gamma = abg.gamma;
-
-            if (alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1 && gamma >= 0 && gamma <= 1){
-                double z = alpha * z_a + beta * z_b + gamma * z_c;
-                Vector3d v = alpha * v1 + beta * v2 + gamma * v3;
-                Vector3d n = alpha * n1 + beta * n2 + gamma * n3;
-                Vector3d col = lighting(v, n, obj_inst, scene.lights);
-                uint8_t r = static_cast<uint8_t>(col[0] * 255);
-                uint8_t g = static_cast<uint8_t>(col[1] * 255);
-                uint8_t b = static_cast<uint8_t>(col[2] * 255);
-                put_pixel(x, y, z, r, g, b, img);
+void hiz_mark(TileHiZ& hiz, const PixelRect& area) {
+    int bx0, by0, bx1, by1;
+    if (!hiz_blocks(hiz, area, bx0, by0, bx1, by1)) return;
+    uint64_t row = ((uint64_t(1) << (bx1 - bx0 + 1)) - 1) << bx0;
+    for (int by = by0; by <= by1; ++by) hiz.dirty |= row << (by * kHiZSide);
+}
+
+void hiz_refresh(TileHiZ& hiz, const Image& img) {
+    if (!hiz.dirty) return;
+    switch (img.z_buf.format()) {
+        case DepthFormat::Float:
+            hiz_read_blocks<float>(hiz, img, [](float e) { return 1.0 - e; });
+            break;
+        case DepthFormat::Unorm24:
+            hiz_read_blocks<uint32_t>(hiz, img, [](uint32_t u) { return 1.0 - u / kUnorm24Half; });
+            break;
+        default:
+            hiz_read_blocks<double>(hiz, img, [](double d) { return d; });
+            break;
+    }
+    hiz.dirty = 0;
+    for (int l = 1; l < kHiZLevels; ++l) {
+        int side = kHiZSide >> l;
+        for (int ny = 0; ny < side; ++ny) {
+            for (int nx = 0; nx < side; ++nx) {
+                const double* c = &hiz.level[l - 1][2 * ny * 2 * side + 2 * nx];
+                hiz.level[l][ny * side + nx] = std::max(std::max(c[0], c[1]), std::max(c[2 * side], c[2 * side + 1]));
             }
         }
     }
-}
\ No newline at end of file
+}
@@ -2,28 +2,162 @@
 #define RASTER_UTILS_H
 
 #include "scene_types.h"
+#include "lighting_kernel.h"
 
 #include <cmath>
+#include <cstdint>
+#include <string>
 #include <vector>
 #include <Eigen/Dense>
 
 using Eigen::Vector3d;
 
 
-void put_pixel(int x,int y, double z, uint8_t r,uint8_t g,uint8_t b,
+// Returns whether the pixel passed the depth test and was written.
+bool put_pixel(int x,int y, double z, uint8_t r,uint8_t g,uint8_t b,
                          Image& img, float a=1.0);
 
-void draw_line(int x0,int y0,int x1,int y1,
-               uint8_t r,uint8_t g,uint8_t b,
-               Image& img);
+// Instruction sets the triangle rasterizers can run on. All of them produce identical images.
+enum class RasterIsa { Scalar, SSE2, AVX2 };
 
-void raster_triangle_flat(std::vector<Vertex>& verts, Image& img, Vector3d col);
+// The widest instruction set both this build and the CPU support.
+RasterIsa best_raster_isa();
 
-void raster_triangle_gouraud(std::vector<Vertex>& verts, Image& img, Vector3d col1, Vector3d col2, Vector3d col3);
+// Selects the rasterizer kernels, process-wide; call between frames. Returns false and
+// leaves the selection alone if isa is not available here.
+bool set_raster_isa(RasterIsa isa);
+RasterIsa raster_isa();
 
-void raster_triangle_phong(std::vector<Vertex>& verts, Image& img, 
-                            Vector3d v1, Vector3d v2, Vector3d v3, 
-                            Vector3d n1, Vector3d n2, Vector3d n3, 
-                            const Scene& scene, const ObjectInstance& obj_inst);
+const char* raster_isa_name(RasterIsa isa);
+bool parse_raster_isa(const std::string& name, RasterIsa& isa);
+
+const char* depth_format_name(DepthFormat format);
+bool parse_depth_format(const std::string& name, DepthFormat& format);
+
+const char* pixel_layout_name(PixelLayout layout);
+bool parse_pixel_layout(const std::string& name, PixelLayout& layout);
+
+const char* lighting_path_name(LightingPath path);
+bool parse_lighting_path(const std::string& name, LightingPath& path);
+
+// Lights count points of obj_inst, from SoA view-space positions v[0..2] and normals
+// n[0..2], writing point i's color to rgb[3 * i..3 * i + 2] as lighting() and a cast to
+// 8 bits would, or within the error of path's approximations: with the selected ISA's
+// lighting kernel, or lighting() under the scalar ISA or path.
+void light_fragments(LightingPath path, const ObjectInstance& obj_inst, const std::vector<Light>& lights,
+                     const double* const v[3], const double* const n[3], size_t count, uint8_t* rgb);
+
+// Rewrites the color plane of a finished Tiled image in Linear order, without the padding,
+// for the writers, and frees the depth plane, which nothing reads after rasterization.
+// Linear images are left alone.
+void linearize(Image& img);
+
+// Edge functions of a screen-space triangle, set up once and stepped per pixel.
+// Edge k is the one opposite vertex k, so edge k over area[k] is that vertex's barycentric.
+// Vertices are integer pixels, so the edge functions are exact integers and stepping them
+// by a constant per column and row introduces no error.
+struct TriangleSetup {
+    int x_min, x_max, y_min, y_max; // bounding box clipped to the image
+    int64_t step_x[3], step_y[3];
+    int64_t row[3]; // edge functions at (x_min, y_min)
+    int64_t area[3]; // edge function at the opposite vertex, made positive
+    double area_d[3];
+    double z[3]; // NDC depth of each vertex
+};
+
+// Inclusive pixel bounds that rasterization is restricted to.
+struct PixelRect {
+    int x_min, y_min, x_max, y_max;
+};
+
+// Draws an antialiased line between pixels (x0, y0) and (x1, y1), blended into the color
+// plane at depth 0 through put_pixel's depth test. Each step along the major axis lights
+// the pixel nearest the line on the near side and its neighbor across it, weighted by the
+// line's exact fractional position in 1/256ths, in integers only. Only pixels inside clip
+// (by default the rows img holds) are touched, and the walk covers only the steps that can
+// reach it, so a line costs its visible length; the pixels it lights are those the whole
+// line would, so lines drawn in order into tiles that cover the image draw the same image.
+void draw_line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, Image& img);
+void draw_line(int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b, const PixelRect& clip, Image& img);
+
+// Returns false if the triangle is degenerate or misses the image entirely.
+bool setup_triangle(const ScreenVertex& sa, const ScreenVertex& sb, const ScreenVertex& sc,
+                    const Image& img, TriangleSetup& t);
+
+// The pixels img holds: the whole frame, or its band.
+PixelRect full_rect(const Image& img);
+
+// The flat, Gouraud and visibility rasterizers return the number of pixels that passed
+// the depth test and were written.
+size_t raster_triangle_flat(const TriangleSetup& t, const PixelRect& clip, Image& img, const Vector3d& col);
+
+size_t raster_triangle_gouraud(const TriangleSetup& t, const PixelRect& clip, Image& img,
+                               const Vector3d& col1, const Vector3d& col2, const Vector3d& col3);
+
+// Returns the number of pixels lit, which are those that passed the depth test. The
+// kernels light each row's pixels in one light_fragments batch; the scalar loop calls
+// lighting() per pixel whatever the path. lights are the scene's, or those of them that
+// reach the tile being drawn.
+size_t raster_triangle_phong(const TriangleSetup& t, const PixelRect& clip, Image& img,
+                             const Vector3d& v1, const Vector3d& v2, const Vector3d& v3,
+                             const Vector3d& n1, const Vector3d& n2, const Vector3d& n3,
+                             const std::vector<Light>& lights, const ObjectInstance& obj_inst, LightingPath path);
+
+// Marks pixels of a visibility buffer that no triangle covers.
+const uint32_t kNoTriangle = 0xffffffffu;
+
+// Depth pass for deferred shading. Where the triangle passes put_pixel's depth test, writes
+// its z and stores id in ids, which is laid out like img.z_buf. Colors are left alone.
+size_t raster_triangle_visibility(const TriangleSetup& t, const PixelRect& clip, Image& img,
+                                  uint32_t id, std::vector<uint32_t>& ids);
+
+// The barycentrics the rasterizer computes for pixel (x, y) of t, bit for bit.
+void triangle_barycentrics(const TriangleSetup& t, int x, int y, double& alpha, double& beta, double& gamma);
+
+// Screen tiles for binned rasterization. Each tile lists the triangles (or lines) whose
+// bounding box touches it, in submission order, so a tile rasterized on its own produces
+// the same pixels as the whole frame drawn serially.
+const int kTileSize = 64;
+
+struct TileBins {
+    PixelRect area; // the pixels binned, tiled from its (x_min, y_min) corner
+    int tiles_x = 0, tiles_y = 0;
+    std::vector<std::vector<uint32_t>> tris; // row-major tiles
+};
+
+// Empty bins covering full_rect(img), so a band is binned on its own.
+TileBins make_tile_bins(const Image& img);
+// The same in place: bins are emptied but keep their memory for the next frame.
+void reset_tile_bins(TileBins& bins, const Image& img);
+// Adds index to every tile t's bounding box touches; does nothing if it misses the area.
+void bin_triangle(TileBins& bins, const TriangleSetup& t, uint32_t index);
+// Adds index to every tile the inclusive pixel box touches.
+void bin_rect(TileBins& bins, const PixelRect& box, uint32_t index);
+PixelRect tile_rect(const TileBins& bins, size_t tile);
+
+// Hierarchical depth for one tile: a bound on the farthest depth each 8x8-pixel block of it
+// holds, with a max pyramid over the blocks up to the whole tile, so that triangles or
+// objects lying entirely behind what the tile already holds can be skipped before any
+// per-pixel work. Bounds are NDC depths that never underestimate the buffer, so culling
+// never changes the image. They start at +infinity and come down only in hiz_refresh,
+// which re-reads the blocks drawn on since the last refresh from the depth buffer.
+const int kHiZBlock = 8;
+const int kHiZSide = kTileSize / kHiZBlock; // blocks per tile side, 8 so a uint64_t maps them
+const int kHiZLevels = 4; // 8x8, 4x4, 2x2 and 1x1 nodes
+
+struct TileHiZ {
+    PixelRect rect; // the tile; block (0, 0) is at its (x_min, y_min) corner
+    double level[kHiZLevels][kHiZSide * kHiZSide]; // level l is row-major, kHiZSide >> l nodes wide
+    uint64_t dirty = 0; // blocks drawn on since the last refresh, bit by * kHiZSide + bx
+};
+
+TileHiZ make_tile_hiz(const PixelRect& rect);
+// True when every pixel of area inside the tile would fail the depth test of any depth
+// z_min or beyond, so nothing within area at those depths can be drawn. False for NaN.
+bool hiz_occluded(const TileHiZ& hiz, const PixelRect& area, double z_min);
+// Notes that the pixels of area inside the tile may have been drawn on.
+void hiz_mark(TileHiZ& hiz, const PixelRect& area);
+// Re-reads the blocks marked since the last refresh from img's depth buffer.
+void hiz_refresh(TileHiZ& hiz, const Image& img);
 
 #endif
\ No newline at end of file
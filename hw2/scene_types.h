@@ -1,44 +1,90 @@
 #ifndef SCENE_TYPES_H
 #define SCENE_TYPES_H
 
+#include "depth_format.h"
+#include "pixel_layout.h"
+#include "precision.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <Eigen/Dense>
 #include <cstdint>
+#include <memory>
 
 using Eigen::Vector3d;
 using Eigen::Map;
 
 
-struct Vertex {
-    double x, y, z;
+template <class T>
+struct BasicVertex {
+    T x, y, z;
 };
 
-struct Normal {
-    double x, y, z;
+template <class T>
+struct BasicNormal {
+    T x, y, z;
+};
+
+// In the pipeline's precision, see precision.h
+typedef BasicVertex<Real> Vertex;
+typedef BasicNormal<Real> Normal;
+
+// Maps to view vertices and normals as Eigen 3-vectors of their scalar, useful for math,
+// with const handling. Mixing them with Vector3d needs a .cast<double>().
+template <class T> Map<const Eigen::Matrix<T, 3, 1>> as_vec3(const BasicVertex<T>& v) { return Map<const Eigen::Matrix<T, 3, 1>>(&v.x); }
+template <class T> Map<Eigen::Matrix<T, 3, 1>>       as_vec3(      BasicVertex<T>& v) { return Map<Eigen::Matrix<T, 3, 1>>(&v.x); }
+template <class T> Map<const Eigen::Matrix<T, 3, 1>> as_vec3(const BasicNormal<T>& n) { return Map<const Eigen::Matrix<T, 3, 1>>(&n.x); }
+template <class T> Map<Eigen::Matrix<T, 3, 1>>       as_vec3(      BasicNormal<T>& n) { return Map<Eigen::Matrix<T, 3, 1>>(&n.x); }
+// Copies in double, for math on them whatever their precision.
+template <class T> Vector3d as_vec3d(const BasicVertex<T>& v) { return Vector3d(v.x, v.y, v.z); }
+template <class T> Vector3d as_vec3d(const BasicNormal<T>& n) { return Vector3d(n.x, n.y, n.z); }
+
+// Outcode bits for a projected vertex. The x/y bits mean its rounded pixel lies off that side
+// of the image; near/far mean it is outside the clip volume in depth. Guard means it lies
+// outside the guard band (or behind the camera), so its pixel coordinates are not usable
+// and any triangle using it must be clipped first.
+enum ClipFlags : uint8_t {
+    CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_BOTTOM = 4, CLIP_TOP = 8, CLIP_NEAR = 16, CLIP_FAR = 32,
+    CLIP_GUARD = 64,
+    CLIP_XY = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP,
+    CLIP_NEEDS_CLIPPING = CLIP_NEAR | CLIP_GUARD
 };
 
-// Maps to convert vertices and normals to Vector3d, useful for math, with const handling.
-inline Map<const Vector3d> as_vec3(const Vertex& v) { return Map<const Vector3d>(&v.x); }
-inline Map<Vector3d>       as_vec3(      Vertex& v) { return Map<Vector3d>(&v.x); }
-inline Map<const Vector3d> as_vec3(const Normal& n) { return Map<const Vector3d>(&n.x); }
-inline Map<Vector3d>       as_vec3(      Normal& n) { return Map<Vector3d>(&n.x); }
+// A vertex after projection and viewport mapping, computed once per mesh vertex per instance.
+struct ScreenVertex {
+    double ndc_x, ndc_y; // kept for the backface test
+    double z; // NDC depth
+    int x, y; // pixel coordinates, only meaningful without CLIP_NEEDS_CLIPPING bits
+    uint8_t clip; // ClipFlags
+};
 
 struct Face {
     unsigned int v1, v2, v3;
     unsigned int vn1, vn2, vn3;
 };
 
+// A mesh edge between vertices a and b, as the first face to use it runs.
+struct Edge {
+    unsigned int a, b;
+};
+
 struct Object {
     std::string filename;
     std::vector<Vertex> vertices;
     std::vector<Normal> normals;
     std::vector<Face> faces;
+    std::vector<Edge> edges; // each vertex pair the faces join, once, if loaded with LoadOptions::edges
 };
 
 struct ObjectInstance {
-    Object obj;
+    std::shared_ptr<const Object> mesh; // shared by every instance of the same obj file, never modified
+    Eigen::Matrix4d transform; // object to world, object to view after world_to_view
     std::string name;
     Eigen::Vector3d ambient;
     Eigen::Vector3d diffuse;
@@ -52,11 +98,170 @@ struct Light {
     double atten;
 };
 
+// The color plane of an Image, 3 bytes per pixel in the Image's layout. Normally heap memory;
+// map_ppm_output instead points it at the pixel area of a mapped output file, so frames
+// are rasterized straight into the page cache. Copies always land on the heap.
+class PixelBuffer {
+public:
+    PixelBuffer() = default;
+    explicit PixelBuffer(size_t size, uint8_t fill = 0) : heap_(size, fill), data_(heap_.data()), size_(size) {}
+    // size bytes at data, kept valid for as long as the buffer holds owner
+    PixelBuffer(uint8_t* data, size_t size, std::shared_ptr<void> owner)
+        : owner_(std::move(owner)), data_(data), size_(size) {}
+
+    PixelBuffer(const PixelBuffer& o) : heap_(o.begin(), o.end()), data_(heap_.data()), size_(o.size_) {}
+    PixelBuffer(PixelBuffer&& o) noexcept
+        : heap_(std::move(o.heap_)), owner_(std::move(o.owner_)), data_(o.data_), size_(o.size_) {
+        o.data_ = nullptr;
+        o.size_ = 0;
+    }
+    PixelBuffer& operator=(PixelBuffer o) noexcept {
+        heap_.swap(o.heap_);
+        owner_.swap(o.owner_);
+        std::swap(data_, o.data_);
+        std::swap(size_, o.size_);
+        return *this;
+    }
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    uint8_t* begin() { return data_; }
+    uint8_t* end() { return data_ + size_; }
+    const uint8_t* begin() const { return data_; }
+    const uint8_t* end() const { return data_ + size_; }
+    uint8_t& operator[](size_t i) { return data_[i]; }
+    const uint8_t& operator[](size_t i) const { return data_[i]; }
+    bool mapped() const { return owner_ != nullptr; }
+
+    bool operator==(const PixelBuffer& o) const { return size_ == o.size_ && std::equal(begin(), end(), o.begin()); }
+    bool operator!=(const PixelBuffer& o) const { return !(*this == o); }
+
+private:
+    std::vector<uint8_t> heap_;
+    std::shared_ptr<void> owner_;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// The depth plane of an Image, one value per pixel laid out like its color plane, in one of
+// the DepthFormats. Starts out cleared.
+class DepthBuffer {
+public:
+    DepthBuffer() = default;
+    explicit DepthBuffer(size_t size, DepthFormat format = DepthFormat::Double) : format_(format), size_(size) {
+        // Zeroed memory is already clear in the compact formats, and large blocks come from
+        // untouched pages, so they cost nothing until drawn on
+        data_.reset(size ? std::calloc(size, bytes_per_pixel(format)) : nullptr);
+        if (size && !data_) throw std::bad_alloc();
+        if (format == DepthFormat::Double) clear();
+    }
+    DepthBuffer(const DepthBuffer& o) : DepthBuffer(o.size_, o.format_) {
+        if (size_) std::memcpy(data_.get(), o.data_.get(), size_ * bytes_per_pixel(format_));
+    }
+    DepthBuffer(DepthBuffer&& o) noexcept : format_(o.format_), size_(o.size_), data_(std::move(o.data_)) {
+        o.size_ = 0;
+    }
+    DepthBuffer& operator=(DepthBuffer o) noexcept {
+        std::swap(format_, o.format_);
+        std::swap(size_, o.size_);
+        data_.swap(o.data_);
+        return *this;
+    }
+
+    static size_t bytes_per_pixel(DepthFormat format) { return format == DepthFormat::Double ? 8 : 4; }
+
+    DepthFormat format() const { return format_; }
+    size_t size() const { return size_; }
+    void* data() { return data_.get(); }
+    const void* data() const { return data_.get(); }
+
+    void clear() {
+        if (format_ == DepthFormat::Double) {
+            std::fill_n(static_cast<double*>(data_.get()), size_, std::numeric_limits<double>::infinity());
+        } else if (size_) {
+            std::memset(data_.get(), 0, size_ * bytes_per_pixel(format_));
+        }
+    }
+
+    // put_pixel's depth test of z, already known to be in [-1, 1] or NaN, against pixel i;
+    // stores z when it passes. The raster kernels encode and compare exactly the same way.
+    bool test_and_set(size_t i, double z) {
+        switch (format_) {
+            case DepthFormat::Float: {
+                float* d = static_cast<float*>(data_.get()) + i;
+                float e = static_cast<float>(1.0 - z);
+                if (e < *d) return false;
+                *d = e;
+                return true;
+            }
+            case DepthFormat::Unorm24: {
+                uint32_t* d = static_cast<uint32_t*>(data_.get()) + i;
+                double q = (1.0 - z) * kUnorm24Half + 0.5;
+                if (!(q >= 0) || static_cast<uint32_t>(q) < *d) return false; // NaN never passes
+                *d = static_cast<uint32_t>(q);
+                return true;
+            }
+            default: {
+                double* d = static_cast<double*>(data_.get()) + i;
+                if (z > *d) return false;
+                *d = z;
+                return true;
+            }
+        }
+    }
+
+    bool operator==(const DepthBuffer& o) const {
+        return format_ == o.format_ && size_ == o.size_ &&
+               (!size_ || std::memcmp(data_.get(), o.data_.get(), size_ * bytes_per_pixel(format_)) == 0);
+    }
+    bool operator!=(const DepthBuffer& o) const { return !(*this == o); }
+
+private:
+    struct Free {
+        void operator()(void* p) const { std::free(p); }
+    };
+    DepthFormat format_ = DepthFormat::Double;
+    size_t size_ = 0;
+    std::unique_ptr<void, Free> data_;
+};
+
+// Pixels a plane of an xres x yres frame holds in layout, padding included.
+inline size_t layout_pixels(size_t xres, size_t yres, PixelLayout layout) {
+    if (layout == PixelLayout::Linear) return xres * yres;
+    size_t b = kLayoutBlock;
+    return (xres + b - 1) / b * b * ((yres + b - 1) / b * b);
+}
+
+// Offset of pixel x of frame row r (counted from the top) in a Tiled plane whose rows
+// hold blocks_x blocks. The raster kernels compute the same thing.
+inline size_t tiled_pixel_offset(size_t x, size_t r, size_t blocks_x) {
+    size_t block = (r / kLayoutBlock) * blocks_x + x / kLayoutBlock;
+    size_t micro = kMortonSpread3[(x / kMicroTile) % 8] | kMortonSpread3[(r / kMicroTile) % 8] << 1;
+    return (block * 64 + micro) * 64 + (r % kMicroTile) * kMicroTile + x % kMicroTile;
+}
+
+// A frame, or one horizontal band of it when the frame is rendered in pieces. xres and yres
+// are always the whole frame's; img and z_buf hold the rows from band_top (counted from the
+// top of the frame) down, band_rows() of them. Tiled images always hold the whole frame.
 struct Image {
-    std::vector<uint8_t> img;
-    std::vector<double> z_buf;
+    PixelBuffer img;
+    DepthBuffer z_buf;
     size_t xres;
     size_t yres;
+    size_t band_top = 0;
+    PixelLayout layout = PixelLayout::Linear;
+
+    size_t band_rows() const {
+        if (layout == PixelLayout::Tiled) return yres;
+        return xres ? z_buf.size() / xres : 0;
+    }
+    // Index into z_buf of pixel (x, y), with y counted up from the bottom of the frame
+    size_t pixel_index(int x, int y) const {
+        size_t r = yres - 1 - band_top - size_t(y);
+        if (layout == PixelLayout::Linear) return r * xres + size_t(x);
+        return tiled_pixel_offset(size_t(x), r, (xres + kLayoutBlock - 1) / kLayoutBlock);
+    }
 };
 
 struct CameraParams {
@@ -2,109 +2,1024 @@
 #include "io_utils.h"
 #include "transform_utils.h"
 #include "raster_utils.h"
+#include "thread_utils.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <Eigen/Dense>
 
 using Eigen::Vector3d;
 
 
-Vector3d lighting (const Vector3d& P, const Vector3d& n_in, const ObjectInstance& mat, const std::vector<Light>& lights, Vector3d e) {
+template <class T>
+Eigen::Matrix<T, 3, 1> lighting(const Eigen::Matrix<T, 3, 1>& P, const Eigen::Matrix<T, 3, 1>& n_in, const ObjectInstance& mat,
+                                const std::vector<Light>& lights, Eigen::Matrix<T, 3, 1> e) {
     // Returns RGB coloring for a single point using diffuse, specular, and ambient lighting
+    typedef Eigen::Matrix<T, 3, 1> Vec3;
 
-    Eigen::Vector3d diff_sum = Vector3d::Zero();
-    Eigen::Vector3d spec_sum = Vector3d::Zero();
+    Vec3 diff_sum = Vec3::Zero();
+    Vec3 spec_sum = Vec3::Zero();
 
-    Vector3d n = n_in;
+    Vec3 n = n_in;
     if (n.squaredNorm() > 0) n.normalize();
-    Vector3d e_dir = (e - P).normalized();
+    Vec3 e_dir = (e - P).normalized();
 
     for (const auto& lt : lights) {
-        Vector3d l_p(lt.x, lt.y, lt.z);
-        Vector3d l_c(lt.r, lt.g, lt.b);
-        Vector3d l_dir = (l_p - P);
-        double d = l_dir.norm();
-        if (d > 0.0) l_dir /= d;
-        double atten = 1.0 / (1.0 + lt.atten * d * d);
+        Vec3 l_p(T(lt.x), T(lt.y), T(lt.z));
+        Vec3 l_c(T(lt.r), T(lt.g), T(lt.b));
+        Vec3 l_dir = (l_p - P);
+        T d = l_dir.norm();
+        if (d > T(0)) l_dir /= d;
+        T atten = T(1) / (T(1) + T(lt.atten) * d * d);
 
-        diff_sum += atten * l_c * std::max(0.0, n.dot(l_dir));
-        spec_sum += atten * l_c * std::pow(std::max(0.0, (e_dir + l_dir).normalized().dot(n)), mat.shininess);
+        diff_sum += atten * l_c * std::max(T(0), n.dot(l_dir));
+        spec_sum += atten * l_c * std::pow(std::max(T(0), (e_dir + l_dir).normalized().dot(n)), T(mat.shininess));
     }
 
-    Vector3d col = mat.ambient.array() + diff_sum.array() * mat.diffuse.array() + spec_sum.array() * mat.specular.array();
-    return col.array().min(1.0);
+    Vec3 col = mat.ambient.cast<T>().array() + diff_sum.array() * mat.diffuse.cast<T>().array() +
+               spec_sum.array() * mat.specular.cast<T>().array();
+    return col.array().min(T(1));
 }
 
-bool is_backface(const std::vector<Vertex>& verts) {
-    Vector3d v1 = as_vec3(verts[0]);
-    Vector3d v2 = as_vec3(verts[1]);
-    Vector3d v3 = as_vec3(verts[2]);
+template Eigen::Vector3f lighting(const Eigen::Vector3f&, const Eigen::Vector3f&, const ObjectInstance&,
+                                  const std::vector<Light>&, Eigen::Vector3f);
+template Eigen::Vector3d lighting(const Eigen::Vector3d&, const Eigen::Vector3d&, const ObjectInstance&,
+                                  const std::vector<Light>&, Eigen::Vector3d);
 
-    return ((v3 - v2).cross(v1 - v2)[2] < 0);
+bool is_backface(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c) {
+    return ((c.ndc_x - b.ndc_x) * (a.ndc_y - b.ndc_y) - (c.ndc_y - b.ndc_y) * (a.ndc_x - b.ndc_x) < 0);
 }
 
-void draw_wireframe(Image& img, Scene& scene) {
-    world_to_view(scene);
-    view_to_ndc(scene);
-    ndc_to_screen(img, scene);
+namespace {
 
-    for (const auto& obj_inst: scene.scene_objects){
-        Object obj = obj_inst.obj;
-        for (const auto& face: obj.faces){
-            int x1 = static_cast<int>(std::lround(obj.vertices[face.v1].x));
-            int y1 = static_cast<int>(std::lround(obj.vertices[face.v1].y));
-            int x2 = static_cast<int>(std::lround(obj.vertices[face.v2].x));
-            int y2 = static_cast<int>(std::lround(obj.vertices[face.v2].y));
-            int x3 = static_cast<int>(std::lround(obj.vertices[face.v3].x));
-            int y3 = static_cast<int>(std::lround(obj.vertices[face.v3].y));
+// View- and screen-space copies of one instance's mesh for the current frame.
+struct InstanceVertices {
+    std::vector<Vertex> view;
+    std::vector<Normal> normals;
+    std::vector<ScreenVertex> screen;
+    // Screen box and nearest depth of every vertex, when none needs clipping: all of the
+    // instance's triangles lie within them
+    bool bounded = false;
+    PixelRect bounds;
+    double z_min;
+};
 
-            draw_line(x1, y1, x2, y2, 255, 255, 255, img);
-            draw_line(x2, y2, x3, y3, 255, 255, 255, img);
-            draw_line(x3, y3, x1, y1, 255, 255, 255, img);
+// A front-facing, on-screen triangle ready to rasterize.
+struct FrameTriangle {
+    TriangleSetup setup;
+    uint32_t instance;
+    uint32_t face;
+    uint32_t clipped; // index into the frame's ClippedCorners, or kNoTriangle for a whole mesh face
+    Vector3d col[3]; // flat: col[0], Gouraud: one per vertex
+};
+
+// View-space corners of a triangle cut from a mesh face by clipping.
+struct ClippedCorners {
+    Vector3d view[3];
+    Vector3d normal[3];
+};
+
+// Triangles a worker made by clipping, in face order, with their corners.
+struct ClippedBatch {
+    std::vector<FrameTriangle> tris;
+    std::vector<ClippedCorners> corners;
+};
+
+// Everything about a frame that does not depend on which rows are drawn: the instances'
+// vertices in view and screen space, and every triangle culled, clipped, set up and lit.
+struct FrameGeometry {
+    std::vector<InstanceVertices> stages;
+    std::vector<size_t> first_face; // frame-wide number of each instance's first face
+    size_t n_faces = 0;
+    std::vector<FrameTriangle> tris; // one per face, then the triangles cut by clipping
+    std::vector<uint8_t> keep; // per face: tris[face] is a whole face to draw
+    std::vector<ClippedCorners> clipped;
+    std::vector<uint32_t> order; // faces in the order to draw them, or empty for face order
+};
+
+// A mesh's faces bucketed into a coarse object-space grid: cluster c is faces
+// [start[c], start[c + 1]) in file order, around center[c].
+struct MeshClusters {
+    std::vector<uint32_t> faces;
+    std::vector<uint32_t> start;
+    std::vector<Vector3d> center;
+};
+
+// A mesh's face corners numbered by distinct (vertex, normal) pair: corner k of face f is
+// pair pair[3 * f + k], which is vertex[p] with normal normal[p].
+struct MeshCorners {
+    std::vector<uint32_t> pair;
+    std::vector<uint32_t> vertex;
+    std::vector<uint32_t> normal;
+};
+
+const uint32_t kNoPair = 0xffffffffu;
+
+// Faces handed to a worker at a time in the triangle stage
+const size_t kSetupBatch = 1024;
+
+// Triangles a tile draws between Hi-Z refreshes within one instance
+const size_t kHiZRefresh = 256;
+
+// Faces per cluster the front-to-back order aims for
+const size_t kClusterFaces = 256;
+
+// Squared view-space distance within which lt's color times its attenuation
+// 1 / (1 + atten d^2) is at least cutoff in some channel: infinite for a light that does
+// not fade, negative for one too dim to ever reach it.
+double light_reach2(const Light& lt, double cutoff) {
+    double brightest = std::max(std::max(lt.r, lt.g), lt.b);
+    if (brightest < cutoff) return -1.0;
+    if (!(lt.atten > 0)) return std::numeric_limits<double>::infinity();
+    return (brightest / cutoff - 1.0) / lt.atten;
+}
+
+// lighting() in the pipeline's precision, as Gouraud corners and flat faces are lit
+Vector3d light_point(const Vector3d& p, const Vector3d& n, const ObjectInstance& mat, const std::vector<Light>& lights) {
+    return lighting<Real>(p.cast<Real>(), n.cast<Real>(), mat, lights).cast<double>();
+}
+
+uint8_t face_clip_union(const Face& face, const InstanceVertices& iv) {
+    return iv.screen[face.v1].clip | iv.screen[face.v2].clip | iv.screen[face.v3].clip;
+}
+
+// True when every vertex is outside the same plane of the view volume.
+bool outside_view_volume(const Face& face, const InstanceVertices& iv) {
+    return iv.screen[face.v1].clip & iv.screen[face.v2].clip & iv.screen[face.v3].clip &
+           (CLIP_XY | CLIP_NEAR | CLIP_FAR);
+}
+
+// Copies the view-space corners of tri into v and n.
+void triangle_corners(const FrameTriangle& tri, const std::vector<ObjectInstance>& objects,
+                      const std::vector<InstanceVertices>& stages, const std::vector<ClippedCorners>& clipped,
+                      Vector3d v[3], Vector3d n[3]) {
+    if (tri.clipped != kNoTriangle) {
+        const ClippedCorners& c = clipped[tri.clipped];
+        for (int k = 0; k < 3; ++k) {
+            v[k] = c.view[k];
+            n[k] = c.normal[k];
         }
+        return;
     }
+    const InstanceVertices& iv = stages[tri.instance];
+    const Face& face = objects[tri.instance].mesh->faces[tri.face];
+    v[0] = as_vec3d(iv.view[face.v1]);
+    v[1] = as_vec3d(iv.view[face.v2]);
+    v[2] = as_vec3d(iv.view[face.v3]);
+    n[0] = as_vec3d(iv.normals[face.vn1]);
+    n[1] = as_vec3d(iv.normals[face.vn2]);
+    n[2] = as_vec3d(iv.normals[face.vn3]);
 }
 
-void shade_by_mode(Image& img, Scene& scene, size_t mode) {
-    if (mode == 3) {
-        draw_wireframe(img, scene);
-        return;
+// A face that crosses the near plane or leaves the guard band: clips it in homogeneous
+// space and appends the fan of triangles that is left to out, each with its own corners.
+// Returns the number of lighting() calls made, or -1 if nothing is left.
+int setup_clipped_face(const Scene& scene, const ObjectInstance& obj_inst, const Face& face,
+                       const InstanceVertices& iv, const Image& img, size_t mode, const FrameTriangle& proto,
+                       ClippedBatch& out) {
+    const unsigned int vi[3] = {face.v1, face.v2, face.v3};
+    const unsigned int ni[3] = {face.vn1, face.vn2, face.vn3};
+    ClipVertex poly[kMaxClipVertices];
+    for (int k = 0; k < 3; ++k) {
+        ClipVertex& c = poly[k];
+        c.view = as_vec3d(iv.view[vi[k]]);
+        c.normal = as_vec3d(iv.normals[ni[k]]);
+        c.h = scene.cam_transforms.P * Eigen::Vector4d(c.view[0], c.view[1], c.view[2], 1.0);
+    }
+    // Faces inside the guard band only need the near plane: the band is a convex cone in
+    // clip space, so the new vertices stay inside it too.
+    bool guard = (face_clip_union(face, iv) & CLIP_GUARD) != 0;
+    int n = clip_polygon(poly, 3, guard);
+    if (n < 3) return -1;
+
+    ScreenVertex sv[kMaxClipVertices];
+    double area = 0;
+    for (int k = 0; k < n; ++k) sv[k] = clip_to_screen(poly[k].h, img);
+    for (int k = 0; k < n; ++k) {
+        const ScreenVertex& p = sv[k];
+        const ScreenVertex& q = sv[(k + 1) % n];
+        area += p.ndc_x * q.ndc_y - q.ndc_x * p.ndc_y;
+    }
+    // The clipped polygon is planar and convex, so its winding is that of every fan triangle
+    if (area < 0) return -1;
+
+    int shaded = 0;
+    Vector3d col[kMaxClipVertices];
+    if (mode == 0) {
+        // Gouraud: light each polygon corner once, shared by the fan
+        for (int k = 0; k < n; ++k) col[k] = light_point(poly[k].view, poly[k].normal, obj_inst, scene.lights);
+        shaded = n;
+    } else if (mode == 2) {
+        // Flat: the whole face keeps the color of its unclipped centroid
+        Vector3d v_avg = (as_vec3d(iv.view[face.v1]) + as_vec3d(iv.view[face.v2]) + as_vec3d(iv.view[face.v3])) / 3.0;
+        Vector3d n_avg = (as_vec3d(iv.normals[face.vn1]) + as_vec3d(iv.normals[face.vn2]) + as_vec3d(iv.normals[face.vn3])) / 3.0;
+        col[0] = light_point(v_avg, n_avg, obj_inst, scene.lights);
+        shaded = 1;
+    }
+
+    bool any = false;
+    for (int k = 1; k + 1 < n; ++k) {
+        const int corner[3] = {0, k, k + 1};
+        FrameTriangle tri = proto;
+        if (!setup_triangle(sv[0], sv[k], sv[k + 1], img, tri.setup)) continue;
+        ClippedCorners c;
+        for (int j = 0; j < 3; ++j) {
+            c.view[j] = poly[corner[j]].view;
+            c.normal[j] = poly[corner[j]].normal;
+            tri.col[j] = mode == 0 ? col[corner[j]] : col[0];
+        }
+        tri.clipped = static_cast<uint32_t>(out.corners.size());
+        out.tris.push_back(tri);
+        out.corners.push_back(c);
+        any = true;
+    }
+    return any ? shaded : -1;
+}
+
+// Returns the number of lighting() calls made, or -1 if the face is culled.
+int setup_face(const Scene& scene, const ObjectInstance& obj_inst, const Face& face,
+               const InstanceVertices& iv, const Image& img, size_t mode, FrameTriangle& tri) {
+    const ScreenVertex& sa = iv.screen[face.v1];
+    const ScreenVertex& sb = iv.screen[face.v2];
+    const ScreenVertex& sc = iv.screen[face.v3];
+    if (is_backface(sa, sb, sc)) return -1;
+    if (!setup_triangle(sa, sb, sc, img, tri.setup)) return -1;
+
+    // Gouraud corners are lit afterwards, once per vertex, by light_corners
+    if (mode == 2) {
+        // Flat
+        Vector3d v_avg = (as_vec3d(iv.view[face.v1]) + as_vec3d(iv.view[face.v2]) + as_vec3d(iv.view[face.v3])) / 3.0;
+        Vector3d n_avg = (as_vec3d(iv.normals[face.vn1]) + as_vec3d(iv.normals[face.vn2]) + as_vec3d(iv.normals[face.vn3])) / 3.0;
+        tri.col[0] = light_point(v_avg, n_avg, obj_inst, scene.lights);
+        return 1;
+    }
+    return 0;
+}
+
+// Numbers obj's face corners by (vertex, normal) pair, in order of first use.
+MeshCorners corner_pairs(const Object& obj) {
+    // A vertex's pairs are chained from first[v]; most vertices have just one normal
+    MeshCorners mc;
+    mc.pair.resize(3 * obj.faces.size());
+    std::vector<uint32_t> first(obj.vertices.size(), kNoPair), next;
+    for (size_t f = 0; f < obj.faces.size(); ++f) {
+        const Face& face = obj.faces[f];
+        const unsigned int vi[3] = {face.v1, face.v2, face.v3};
+        const unsigned int ni[3] = {face.vn1, face.vn2, face.vn3};
+        for (int k = 0; k < 3; ++k) {
+            uint32_t p = first[vi[k]];
+            while (p != kNoPair && mc.normal[p] != ni[k]) p = next[p];
+            if (p == kNoPair) {
+                p = static_cast<uint32_t>(mc.vertex.size());
+                mc.vertex.push_back(vi[k]);
+                mc.normal.push_back(ni[k]);
+                next.push_back(first[vi[k]]);
+                first[vi[k]] = p;
+            }
+            mc.pair[3 * f + k] = p;
+        }
+    }
+    return mc;
+}
+
+// Light culling for Phong, one tile at a time: the scene lights that reach any of the
+// tile's triangles, then of those the ones that reach the triangle being shaded. A light
+// reaches a triangle when it is within reach2 of the view-space box around its corners;
+// every position Phong interpolates is a mix of the corners, so it lies in that box
+// wherever on screen the interpolation puts it. Each triangle's lights depend only on the
+// triangle, never on which tile or band draws it, so neither changes the image.
+struct LightCulling {
+    const Scene* scene = nullptr; // null when culling is off and every light is used
+    std::vector<double> reach2; // per scene light, from light_reach2
+    std::vector<uint32_t> tile; // scene lights reaching the current tile, in scene order
+    uint32_t triangle = kNoTriangle; // the triangle lights is for
+    std::vector<Light> lights;
+};
+
+void init_light_culling(LightCulling& lc, const Scene& scene, double cutoff) {
+    lc.scene = nullptr;
+    lc.reach2.clear();
+    lc.tile.clear();
+    lc.triangle = kNoTriangle;
+    lc.lights.clear();
+    if (cutoff <= 0) return;
+    lc.scene = &scene;
+    for (const Light& lt : scene.lights) lc.reach2.push_back(light_reach2(lt, cutoff));
+}
+
+void grow_box(const Vector3d v[3], Vector3d& lo, Vector3d& hi) {
+    for (int k = 0; k < 3; ++k) {
+        lo = lo.cwiseMin(v[k]);
+        hi = hi.cwiseMax(v[k]);
     }
-    
-    world_to_view(scene);
-
-    for (auto& obj_inst : scene.scene_objects) {
-        for (auto& face : obj_inst.obj.faces) {
-            Object& obj = obj_inst.obj;
-
-            std::vector<Vertex> verts = {obj.vertices[face.v1], obj.vertices[face.v2], obj.vertices[face.v3]};
-            view_to_ndc(verts, scene);
-            if (is_backface(verts)) {continue;}
-
-            Vector3d v1 = as_vec3(obj.vertices[face.v1]);
-            Vector3d n1 = as_vec3(obj.normals[face.vn1]);
-            Vector3d v2 = as_vec3(obj.vertices[face.v2]);
-            Vector3d n2 = as_vec3(obj.normals[face.vn2]);
-            Vector3d v3 = as_vec3(obj.vertices[face.v3]);
-            Vector3d n3 = as_vec3(obj.normals[face.vn3]);
-
-            if (mode == 0) {
-                // Gouraud
-                Vector3d col1 = lighting(v1, n1, obj_inst, scene.lights);
-                Vector3d col2 = lighting(v2, n2, obj_inst, scene.lights);
-                Vector3d col3 = lighting(v3, n3, obj_inst, scene.lights);
-                raster_triangle_gouraud(verts, img, col1, col2, col3);
-            } else if (mode == 1) {
-                // Phong
-                raster_triangle_phong(verts, img, v1, v2, v3, n1, n2, n3, scene, obj_inst);
+}
+
+bool within_reach(const Light& lt, double reach2, const Vector3d& lo, const Vector3d& hi) {
+    const double p[3] = {lt.x, lt.y, lt.z};
+    double d2 = 0;
+    for (int c = 0; c < 3; ++c) {
+        double d = std::max(std::max(lo[c] - p[c], p[c] - hi[c]), 0.0);
+        d2 += d * d;
+    }
+    return d2 <= reach2;
+}
+
+// Lists the lights reaching the triangles of bin in lc.tile; returns how many.
+size_t cull_tile_lights(LightCulling& lc, const std::vector<uint32_t>& bin, const std::vector<FrameTriangle>& tris,
+                        const std::vector<InstanceVertices>& stages, const std::vector<ClippedCorners>& clipped) {
+    lc.tile.clear();
+    lc.triangle = kNoTriangle;
+    if (!lc.scene || bin.empty()) return 0;
+    Vector3d lo = Vector3d::Constant(std::numeric_limits<double>::infinity()), hi = -lo;
+    for (uint32_t fi : bin) {
+        Vector3d v[3], n[3];
+        triangle_corners(tris[fi], lc.scene->scene_objects, stages, clipped, v, n);
+        grow_box(v, lo, hi);
+    }
+    const std::vector<Light>& lights = lc.scene->lights;
+    for (size_t i = 0; i < lights.size(); ++i) {
+        if (within_reach(lights[i], lc.reach2[i], lo, hi)) lc.tile.push_back(static_cast<uint32_t>(i));
+    }
+    return lc.tile.size();
+}
+
+// The lights to shade triangle id, with view-space corners v, by: all of scene's when
+// culling is off, else those of the tile's that reach it.
+const std::vector<Light>& triangle_lights(LightCulling& lc, const Scene& scene, uint32_t id, const Vector3d v[3]) {
+    if (!lc.scene) return scene.lights;
+    if (id == lc.triangle) return lc.lights;
+    Vector3d lo = Vector3d::Constant(std::numeric_limits<double>::infinity()), hi = -lo;
+    grow_box(v, lo, hi);
+    lc.lights.clear();
+    for (uint32_t i : lc.tile) {
+        if (within_reach(scene.lights[i], lc.reach2[i], lo, hi)) lc.lights.push_back(scene.lights[i]);
+    }
+    lc.triangle = id;
+    return lc.lights;
+}
+
+// Second pass of deferred Phong: lights every pixel of rect whose visibility id names a
+// triangle, from the same interpolated position and normal the forward path would use.
+// Pixels are lit in batches: the runs of each row that belong to one instance, or under
+// light culling to one triangle.
+size_t shade_visible_pixels(const PixelRect& rect, const std::vector<uint32_t>& ids,
+                            const std::vector<FrameTriangle>& tris, const std::vector<InstanceVertices>& stages,
+                            const std::vector<ClippedCorners>& clipped, const Scene& scene, LightCulling& lc,
+                            LightingPath path, Image& img) {
+    const size_t width = size_t(rect.x_max - rect.x_min + 1);
+    // One row's batch, reused across calls on this thread
+    static thread_local std::vector<double> attrs;
+    static thread_local std::vector<size_t> pixel;
+    static thread_local std::vector<uint8_t> rgb;
+    if (pixel.size() < width) {
+        attrs.resize(6 * width);
+        pixel.resize(width);
+        rgb.resize(3 * width);
+    }
+    double* v[3] = {&attrs[0], &attrs[width], &attrs[2 * width]};
+    double* n[3] = {&attrs[3 * width], &attrs[4 * width], &attrs[5 * width]};
+
+    size_t shaded = 0;
+    size_t count = 0;
+    uint32_t instance = kNoTriangle, batch_id = kNoTriangle;
+    const std::vector<Light>* lights = &scene.lights;
+    auto flush = [&] {
+        if (!count) return;
+        light_fragments(path, scene.scene_objects[instance], *lights, v, n, count, rgb.data());
+        for (size_t k = 0; k < count; ++k) {
+            std::copy(&rgb[3 * k], &rgb[3 * k] + 3, &img.img[3 * pixel[k]]);
+        }
+        shaded += count;
+        count = 0;
+    };
+    for (int y = rect.y_min; y <= rect.y_max; ++y) {
+        for (int x = rect.x_min; x <= rect.x_max; ++x) {
+            size_t i = img.pixel_index(x, y);
+            uint32_t id = ids[i];
+            if (id == kNoTriangle) continue;
+
+            const FrameTriangle& tri = tris[id];
+            Vector3d cv[3], cn[3];
+            triangle_corners(tri, scene.scene_objects, stages, clipped, cv, cn);
+            if (tri.instance != instance || (lc.scene && id != batch_id)) {
+                flush();
+                instance = tri.instance;
+                batch_id = id;
+                lights = &triangle_lights(lc, scene, id, cv);
+            }
+            double alpha, beta, gamma;
+            triangle_barycentrics(tri.setup, x, y, alpha, beta, gamma);
+
+            Vector3d pv = alpha * cv[0] + beta * cv[1] + gamma * cv[2];
+            Vector3d pn = alpha * cn[0] + beta * cn[1] + gamma * cn[2];
+            for (int c = 0; c < 3; ++c) {
+                v[c][count] = pv[c];
+                n[c][count] = pn[c];
+            }
+            pixel[count++] = i;
+        }
+        flush();
+    }
+    return shaded;
+}
+
+// Vertex stage: every mesh vertex is transformed and projected once per instance, through
+// the viewport of frame. Normals are only needed for shading.
+// Fills in iv.bounded, bounds and z_min from its screen vertices.
+void screen_bounds(InstanceVertices& iv) {
+    iv.bounded = iv.screen.size() > 1;
+    iv.bounds = PixelRect{std::numeric_limits<int>::max(), std::numeric_limits<int>::max(),
+                          std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
+    iv.z_min = std::numeric_limits<double>::infinity();
+    // Index 0 is the obj dummy vertex, in no face
+    for (size_t i = 1; i < iv.screen.size(); ++i) {
+        const ScreenVertex& v = iv.screen[i];
+        if ((v.clip & CLIP_NEEDS_CLIPPING) || std::isnan(v.z)) {
+            iv.bounded = false;
+            return;
+        }
+        iv.bounds.x_min = std::min(iv.bounds.x_min, v.x);
+        iv.bounds.y_min = std::min(iv.bounds.y_min, v.y);
+        iv.bounds.x_max = std::max(iv.bounds.x_max, v.x);
+        iv.bounds.y_max = std::max(iv.bounds.y_max, v.y);
+        iv.z_min = std::min(iv.z_min, v.z);
+    }
+}
+
+// Nearest depth of t's corners, or NaN if any of them is NaN.
+double nearest_depth(const TriangleSetup& t) {
+    if (std::isnan(t.z[0]) || std::isnan(t.z[1]) || std::isnan(t.z[2])) return std::nan("");
+    return std::min(std::min(t.z[0], t.z[1]), t.z[2]);
+}
+
+void project_instances(const Scene& scene, const Image& frame, unsigned threads, bool normals,
+                       std::vector<InstanceVertices>& stages) {
+    const std::vector<ObjectInstance>& objects = scene.scene_objects;
+    stages.resize(objects.size());
+    parallel_for(objects.size(), threads, [&](size_t i) {
+        const Object& obj = *objects[i].mesh;
+        transform_vertices(obj.vertices, objects[i].transform, stages[i].view);
+        if (normals) transform_normals(obj.normals, objects[i].transform, stages[i].normals);
+        project_to_screen(stages[i].view, scene.cam_transforms.P, frame, stages[i].screen);
+        screen_bounds(stages[i]);
+    });
+}
+
+// Per-tile counters of the raster stage
+struct TileCounts {
+    size_t shaded = 0, written = 0, culled_triangles = 0, culled_objects = 0, lights = 0;
+};
+
+// A line to draw, in screen pixels
+struct ScreenLine {
+    int x0, y0, x1, y1;
+};
+
+} // namespace
+
+// Everything a frame is drawn with besides the image. Buffers are cleared or resized
+// rather than freed, so once the arena has drawn a frame it draws another of the same
+// scene without touching the heap. A mesh's corner numbering, face clusters and (when it
+// was loaded without them) unique edges depend only on the mesh, which is never modified,
+// so they are made the first time it is drawn and kept with a reference to it.
+struct FrameArena::Buffers {
+    Scene view; // the frame's scene in view space; the caller's is never modified
+    FrameGeometry g;
+    std::vector<size_t> batch_shaded;
+    std::vector<ClippedBatch> batch_clipped;
+
+    // Gouraud corner lighting
+    std::map<std::shared_ptr<const Object>, MeshCorners> corners;
+    std::vector<const MeshCorners*> instance_corners;
+    std::vector<size_t> first_pair;
+    std::vector<uint8_t> used;
+    std::vector<Vector3d> color;
+
+    // Front-to-back order
+    std::map<std::shared_ptr<const Object>, MeshClusters> clusters;
+    std::vector<double> nearest;
+    std::vector<uint32_t> instances;
+    std::vector<std::pair<double, uint32_t>> depth;
+
+    // Raster stage
+    std::vector<size_t> clipped_start;
+    TileBins bins;
+    std::vector<TileCounts> counts; // per tile
+    LightCulling culling;
+    std::vector<LightCulling> tile_culling; // per tile, copies of culling
+    std::vector<uint32_t> ids; // deferred Phong's visibility buffer
+    std::vector<ScreenLine> lines; // wireframe
+    std::map<std::shared_ptr<const Object>, std::vector<Edge>> edges; // meshes loaded without edges
+};
+
+FrameArena::FrameArena() : buffers(new Buffers) {}
+
+FrameArena::~FrameArena() {}
+
+namespace {
+
+// Buckets obj's faces by centroid into a grid of about kClusterFaces faces per cell.
+MeshClusters cluster_faces(const Object& obj) {
+    const std::vector<Vertex>& v = obj.vertices;
+    const size_t n = obj.faces.size();
+    std::vector<Vector3d> centroid(n);
+    Vector3d lo = Vector3d::Constant(std::numeric_limits<double>::infinity()), hi = -lo;
+    for (size_t f = 0; f < n; ++f) {
+        const Face& face = obj.faces[f];
+        centroid[f] = (as_vec3d(v[face.v1]) + as_vec3d(v[face.v2]) + as_vec3d(v[face.v3])) / 3.0;
+        lo = lo.cwiseMin(centroid[f]);
+        hi = hi.cwiseMax(centroid[f]);
+    }
+
+    // Counting sort of the faces by cell, file order within each cell
+    const int side = std::max(1, static_cast<int>(std::cbrt(double(n) / kClusterFaces)));
+    const Vector3d scale = (side / (hi - lo).array().max(1e-300)).matrix();
+    std::vector<uint32_t> cell(n), count(size_t(side) * side * side + 1, 0);
+    for (size_t f = 0; f < n; ++f) {
+        int c[3];
+        for (int k = 0; k < 3; ++k) {
+            c[k] = std::min(side - 1, std::max(0, static_cast<int>((centroid[f][k] - lo[k]) * scale[k])));
+        }
+        cell[f] = static_cast<uint32_t>((c[2] * side + c[1]) * side + c[0]);
+        ++count[cell[f] + 1];
+    }
+    for (size_t c = 1; c < count.size(); ++c) count[c] += count[c - 1];
+    MeshClusters mc;
+    mc.faces.resize(n);
+    std::vector<uint32_t> next(count.begin(), count.end() - 1);
+    for (size_t f = 0; f < n; ++f) mc.faces[next[cell[f]]++] = static_cast<uint32_t>(f);
+
+    // Empty cells are dropped
+    for (size_t c = 0; c + 1 < count.size(); ++c) {
+        if (count[c] == count[c + 1]) continue;
+        Vector3d sum = Vector3d::Zero();
+        for (uint32_t i = count[c]; i < count[c + 1]; ++i) sum += centroid[mc.faces[i]];
+        mc.start.push_back(count[c]);
+        mc.center.push_back(sum / double(count[c + 1] - count[c]));
+    }
+    mc.start.push_back(static_cast<uint32_t>(n));
+    return mc;
+}
+
+// Fills in g.order front to back: instances by their nearest vertex, and within each
+// instance its mesh's clusters by their centers' view-space depth. Ties keep file order.
+void sort_front_to_back(const Scene& scene, FrameArena::Buffers& b) {
+    const std::vector<ObjectInstance>& objects = scene.scene_objects;
+    FrameGeometry& g = b.g;
+    std::vector<double>& nearest = b.nearest;
+    nearest.assign(objects.size(), -std::numeric_limits<double>::infinity());
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const std::vector<Vertex>& view = g.stages[i].view;
+        // Index 0 is the obj dummy vertex; the camera looks down -z
+        for (size_t k = 1; k < view.size(); ++k) nearest[i] = std::max(nearest[i], double(view[k].z));
+    }
+    std::vector<uint32_t>& instances = b.instances;
+    instances.resize(objects.size());
+    for (size_t i = 0; i < instances.size(); ++i) instances[i] = static_cast<uint32_t>(i);
+    // Ties in file order, as a stable sort would leave them without its buffer
+    std::sort(instances.begin(), instances.end(), [&](uint32_t a, uint32_t b) {
+        return nearest[a] > nearest[b] || (nearest[a] == nearest[b] && a < b);
+    });
+
+    // Instances share their mesh's clusters
+    g.order.clear();
+    g.order.reserve(g.n_faces);
+    std::vector<std::pair<double, uint32_t>>& depth = b.depth;
+    for (uint32_t inst : instances) {
+        const ObjectInstance& obj = objects[inst];
+        auto it = b.clusters.find(obj.mesh);
+        if (it == b.clusters.end()) it = b.clusters.emplace(obj.mesh, cluster_faces(*obj.mesh)).first;
+        const MeshClusters& mc = it->second;
+
+        depth.clear();
+        for (size_t c = 0; c < mc.center.size(); ++c) {
+            const Vector3d& p = mc.center[c];
+            Vector3d q = (obj.transform * Eigen::Vector4d(p[0], p[1], p[2], 1.0)).hnormalized();
+            double z = q[2];
+            depth.emplace_back(-z, static_cast<uint32_t>(c));
+        }
+        std::sort(depth.begin(), depth.end());
+        const uint32_t first = static_cast<uint32_t>(g.first_face[inst]);
+        for (const auto& d : depth) {
+            for (uint32_t i = mc.start[d.second]; i < mc.start[d.second + 1]; ++i) g.order.push_back(first + mc.faces[i]);
+        }
+    }
+}
+
+// Gouraud lighting of the whole faces g keeps: every (vertex, normal) pair they use is lit
+// once, in batches across threads, and each face takes its corners' colors from those.
+// lighting() sees the same position and normal as it would per corner, so the colors are
+// the same. Returns the number of lighting() calls.
+size_t light_corners(const Scene& scene, unsigned threads, FrameArena::Buffers& b) {
+    const std::vector<ObjectInstance>& objects = scene.scene_objects;
+    FrameGeometry& g = b.g;
+    // Pairs are numbered across instances like faces; instances share their mesh's numbering
+    std::vector<const MeshCorners*>& corners = b.instance_corners;
+    std::vector<size_t>& first_pair = b.first_pair;
+    corners.resize(objects.size());
+    first_pair.assign(objects.size() + 1, 0);
+    for (size_t i = 0; i < objects.size(); ++i) {
+        auto it = b.corners.find(objects[i].mesh);
+        if (it == b.corners.end()) it = b.corners.emplace(objects[i].mesh, corner_pairs(*objects[i].mesh)).first;
+        corners[i] = &it->second;
+        first_pair[i + 1] = first_pair[i] + it->second.vertex.size();
+    }
+
+    std::vector<uint8_t>& used = b.used;
+    used.assign(first_pair.back(), 0);
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const std::vector<uint32_t>& pair = corners[i]->pair;
+        for (size_t fi = g.first_face[i]; fi < g.first_face[i + 1]; ++fi) {
+            if (!g.keep[fi]) continue;
+            const size_t c = 3 * (fi - g.first_face[i]);
+            used[first_pair[i] + pair[c]] = used[first_pair[i] + pair[c + 1]] = used[first_pair[i] + pair[c + 2]] = 1;
+        }
+    }
+
+    // Only the colors of used pairs are read
+    std::vector<Vector3d>& color = b.color;
+    color.resize(first_pair.back());
+    size_t n_batches = (color.size() + kSetupBatch - 1) / kSetupBatch;
+    std::vector<size_t>& batch_shaded = b.batch_shaded;
+    batch_shaded.assign(n_batches, 0);
+    parallel_for(n_batches, threads, [&](size_t batch) {
+        size_t begin = batch * kSetupBatch;
+        size_t end = std::min(color.size(), begin + kSetupBatch);
+        size_t inst = std::upper_bound(first_pair.begin(), first_pair.end(), begin) - first_pair.begin() - 1;
+        for (size_t p = begin; p < end; ++p) {
+            while (p >= first_pair[inst + 1]) ++inst;
+            if (!used[p]) continue;
+            const MeshCorners& mc = *corners[inst];
+            const InstanceVertices& iv = g.stages[inst];
+            size_t local = p - first_pair[inst];
+            color[p] = light_point(as_vec3d(iv.view[mc.vertex[local]]), as_vec3d(iv.normals[mc.normal[local]]),
+                                objects[inst], scene.lights);
+            ++batch_shaded[batch];
+        }
+    });
+
+    n_batches = (g.n_faces + kSetupBatch - 1) / kSetupBatch;
+    parallel_for(n_batches, threads, [&](size_t batch) {
+        size_t begin = batch * kSetupBatch;
+        size_t end = std::min(g.n_faces, begin + kSetupBatch);
+        size_t inst = std::upper_bound(g.first_face.begin(), g.first_face.end(), begin) - g.first_face.begin() - 1;
+        for (size_t fi = begin; fi < end; ++fi) {
+            while (fi >= g.first_face[inst + 1]) ++inst;
+            if (!g.keep[fi]) continue;
+            const uint32_t* pair = &corners[inst]->pair[3 * (fi - g.first_face[inst])];
+            for (int k = 0; k < 3; ++k) g.tris[fi].col[k] = color[first_pair[inst] + pair[k]];
+        }
+    });
+
+    size_t shaded = 0;
+    for (size_t n : batch_shaded) shaded += n;
+    return shaded;
+}
+
+// Vertex and triangle stages for the whole frame; scene must already be in view space.
+void prepare_frame(const Scene& scene, const Image& frame, size_t mode, const RenderOptions& opts,
+                   FrameArena::Buffers& b, RenderStats& stats) {
+    const std::vector<ObjectInstance>& objects = scene.scene_objects;
+    FrameGeometry& g = b.g;
+    const unsigned threads = opts.threads;
+    project_instances(scene, frame, threads, true, g.stages);
+
+    // Triangle stage: cull, clip, set up and light every face. Faces are numbered across
+    // instances in submission order, which the tile bins preserve; triangles cut from a
+    // face by clipping follow the whole faces and are binned in their face's place.
+    g.first_face.assign(objects.size() + 1, 0);
+    for (size_t i = 0; i < objects.size(); ++i) {
+        g.first_face[i + 1] = g.first_face[i] + objects[i].mesh->faces.size();
+    }
+    const size_t n_faces = g.n_faces = g.first_face.back();
+    g.tris.assign(n_faces, FrameTriangle());
+    g.keep.assign(n_faces, 0);
+    size_t n_batches = (n_faces + kSetupBatch - 1) / kSetupBatch;
+    std::vector<size_t>& batch_shaded = b.batch_shaded;
+    std::vector<ClippedBatch>& batch_clipped = b.batch_clipped;
+    batch_shaded.assign(n_batches, 0);
+    batch_clipped.resize(n_batches);
+    for (ClippedBatch& c : batch_clipped) {
+        c.tris.clear();
+        c.corners.clear();
+    }
+
+    parallel_for(n_batches, threads, [&](size_t batch) {
+        size_t begin = batch * kSetupBatch;
+        size_t end = std::min(n_faces, begin + kSetupBatch);
+        size_t inst = std::upper_bound(g.first_face.begin(), g.first_face.end(), begin) - g.first_face.begin() - 1;
+        for (size_t fi = begin; fi < end; ++fi) {
+            while (fi >= g.first_face[inst + 1]) ++inst;
+            size_t local = fi - g.first_face[inst];
+            const Face& face = objects[inst].mesh->faces[local];
+            const InstanceVertices& iv = g.stages[inst];
+            if (outside_view_volume(face, iv)) continue;
+
+            FrameTriangle& tri = g.tris[fi];
+            tri.instance = static_cast<uint32_t>(inst);
+            tri.face = static_cast<uint32_t>(local);
+            tri.clipped = kNoTriangle;
+            int shaded;
+            if (face_clip_union(face, iv) & CLIP_NEEDS_CLIPPING) {
+                shaded = setup_clipped_face(scene, objects[inst], face, iv, frame, mode, tri, batch_clipped[batch]);
             } else {
-                // Flat (default)
-                Vector3d v_avg = (v1 + v2 + v3) / 3.0;
-                Vector3d n_avg = (n1 + n2 + n3) / 3.0;
-                Vector3d col = lighting(v_avg, n_avg, obj_inst, scene.lights);
-                raster_triangle_flat(verts, img, col);
+                shaded = setup_face(scene, objects[inst], face, iv, frame, mode, tri);
+                g.keep[fi] = shaded >= 0;
             }
-            
+            if (shaded > 0) batch_shaded[batch] += shaded;
         }
+    });
+    for (size_t shaded : batch_shaded) stats.shading_invocations += shaded;
+    if (mode == 0) stats.shading_invocations += light_corners(scene, threads, b);
+
+    // Clipped triangles go after the whole faces, with their corners renumbered frame-wide
+    g.clipped.clear();
+    for (ClippedBatch& c : batch_clipped) {
+        for (FrameTriangle& tri : c.tris) {
+            tri.clipped += static_cast<uint32_t>(g.clipped.size());
+            g.tris.push_back(tri);
+        }
+        g.clipped.insert(g.clipped.end(), c.corners.begin(), c.corners.end());
     }
-}
\ No newline at end of file
+    g.order.clear();
+    if (opts.front_to_back) sort_front_to_back(scene, b);
+}
+
+// Bins the triangles of g that touch the rows img holds, in submission order, and
+// rasterizes them into img.
+void raster_frame(FrameArena::Buffers& b, const Scene& scene, size_t mode, const RenderOptions& opts, Image& img,
+                  RenderStats& stats) {
+    const std::vector<ObjectInstance>& objects = scene.scene_objects;
+    const FrameGeometry& g = b.g;
+    const std::vector<FrameTriangle>& tris = g.tris;
+
+    // Triangles cut from face fi by clipping are tris[clipped_start[fi], clipped_start[fi + 1]),
+    // as they follow the whole faces in face order
+    std::vector<size_t>& clipped_start = b.clipped_start;
+    clipped_start.assign(g.n_faces + 1, 0);
+    for (size_t i = g.n_faces; i < tris.size(); ++i) ++clipped_start[g.first_face[tris[i].instance] + tris[i].face + 1];
+    clipped_start[0] = g.n_faces;
+    for (size_t fi = 0; fi < g.n_faces; ++fi) clipped_start[fi + 1] += clipped_start[fi];
+
+    TileBins& bins = b.bins;
+    reset_tile_bins(bins, img);
+    auto bin_face = [&](size_t fi) {
+        if (g.keep[fi]) bin_triangle(bins, tris[fi].setup, static_cast<uint32_t>(fi));
+        for (size_t i = clipped_start[fi]; i < clipped_start[fi + 1]; ++i) {
+            bin_triangle(bins, tris[i].setup, static_cast<uint32_t>(i));
+        }
+    };
+    if (g.order.empty()) {
+        for (size_t fi = 0; fi < g.n_faces; ++fi) bin_face(fi);
+    } else {
+        for (uint32_t fi : g.order) bin_face(fi);
+    }
+
+    // Raster stage: each tile is owned by one worker, so img and z_buf need no locks and
+    // the result does not depend on the thread count.
+    std::vector<TileCounts>& counts = b.counts;
+    counts.assign(bins.tris.size(), TileCounts());
+
+    // Phong lights each triangle with every light, or under light culling those of its
+    // tile's that reach it
+    init_light_culling(b.culling, scene, mode == 1 ? opts.light_cutoff : 0);
+    b.tile_culling.resize(bins.tris.size());
+
+    // Calls draw(fi) for each of tile's triangles, in order, unless opts.hiz finds it (or its
+    // whole instance) behind what the tile already holds. The tile's Hi-Z is refreshed at
+    // each change of instance and every kHiZRefresh triangles drawn.
+    auto draw_tile = [&](size_t tile, const PixelRect& rect, auto&& draw) {
+        if (!opts.hiz) {
+            for (uint32_t fi : bins.tris[tile]) draw(fi);
+            return;
+        }
+        TileCounts& c = counts[tile];
+        TileHiZ hiz = make_tile_hiz(rect);
+        uint32_t instance = kNoTriangle;
+        bool instance_hidden = false;
+        size_t drawn = 0;
+        for (uint32_t fi : bins.tris[tile]) {
+            const FrameTriangle& tri = tris[fi];
+            if (tri.instance != instance) {
+                instance = tri.instance;
+                hiz_refresh(hiz, img);
+                drawn = 0;
+                const InstanceVertices& iv = g.stages[instance];
+                instance_hidden = iv.bounded && hiz_occluded(hiz, iv.bounds, iv.z_min);
+                c.culled_objects += instance_hidden;
+            }
+            const TriangleSetup& t = tri.setup;
+            PixelRect box{t.x_min, t.y_min, t.x_max, t.y_max};
+            if (instance_hidden || hiz_occluded(hiz, box, nearest_depth(t))) {
+                ++c.culled_triangles;
+                continue;
+            }
+            draw(fi);
+            hiz_mark(hiz, box);
+            if (++drawn % kHiZRefresh == 0) hiz_refresh(hiz, img);
+        }
+    };
+
+    if (mode == 1 && opts.deferred) {
+        // Deferred Phong: the visibility pass leaves each pixel holding the last triangle to
+        // pass its depth test, which is the one whose color forward shading would keep.
+        // Position and normal are rebuilt from that triangle when the pixel is lit, so the
+        // buffer holds only a triangle id per pixel.
+        std::vector<uint32_t>& ids = b.ids;
+        ids.assign(img.z_buf.size(), kNoTriangle);
+        parallel_for(bins.tris.size(), opts.threads, [&](size_t tile) {
+            PixelRect rect = tile_rect(bins, tile);
+            draw_tile(tile, rect, [&](uint32_t fi) {
+                counts[tile].written += raster_triangle_visibility(tris[fi].setup, rect, img, fi, ids);
+            });
+            LightCulling& lc = b.tile_culling[tile];
+            lc = b.culling;
+            counts[tile].lights = cull_tile_lights(lc, bins.tris[tile], tris, g.stages, g.clipped);
+            counts[tile].shaded =
+                shade_visible_pixels(rect, ids, tris, g.stages, g.clipped, scene, lc, opts.lighting, img);
+        });
+    } else {
+        parallel_for(bins.tris.size(), opts.threads, [&](size_t tile) {
+            PixelRect rect = tile_rect(bins, tile);
+            LightCulling& lc = b.tile_culling[tile];
+            lc = b.culling;
+            counts[tile].lights = cull_tile_lights(lc, bins.tris[tile], tris, g.stages, g.clipped);
+            draw_tile(tile, rect, [&](uint32_t fi) {
+                const FrameTriangle& tri = tris[fi];
+                TileCounts& c = counts[tile];
+                if (mode == 0) {
+                    c.written += raster_triangle_gouraud(tri.setup, rect, img, tri.col[0], tri.col[1], tri.col[2]);
+                } else if (mode == 1) {
+                    Vector3d v[3], n[3];
+                    triangle_corners(tri, objects, g.stages, g.clipped, v, n);
+                    size_t lit = raster_triangle_phong(tri.setup, rect, img, v[0], v[1], v[2], n[0], n[1], n[2],
+                                                       triangle_lights(lc, scene, fi, v), objects[tri.instance],
+                                                       opts.lighting);
+                    c.shaded += lit;
+                    c.written += lit;
+                } else {
+                    c.written += raster_triangle_flat(tri.setup, rect, img, tri.col[0]);
+                }
+            });
+        });
+    }
+    for (const TileCounts& c : counts) {
+        stats.shading_invocations += c.shaded;
+        stats.depth_passes += c.written;
+        stats.culled_triangles += c.culled_triangles;
+        stats.culled_objects += c.culled_objects;
+        stats.tile_lights += c.lights;
+    }
+}
+
+// Draws each mesh edge once into img, from the unique edge lists built at load time, or
+// for meshes loaded without them from lists built on their first frame and kept in b. Lines are projected and clipped
+// to the view in file order, then binned by bounding box and drawn by tile, each tile
+// clipping its lines to itself, so that threads own disjoint pixels and the image is the
+// same for any thread count or band.
+void draw_wireframe_edges(Image& img, const Scene& scene, FrameArena::Buffers& b, unsigned threads) {
+    const Matrix4d& P = scene.cam_transforms.P;
+    const std::vector<InstanceVertices>& stages = b.g.stages;
+    std::vector<ScreenLine>& lines = b.lines;
+    lines.clear();
+    for (size_t inst = 0; inst < scene.scene_objects.size(); ++inst) {
+        const std::shared_ptr<const Object>& mesh = scene.scene_objects[inst].mesh;
+        const std::vector<Vertex>& verts = stages[inst].view;
+        const std::vector<ScreenVertex>& screen = stages[inst].screen;
+
+        auto edge = [&](unsigned int i, unsigned int j) {
+            const ScreenVertex& a = screen[i];
+            const ScreenVertex& b = screen[j];
+            if (a.clip & b.clip & (CLIP_XY | CLIP_NEAR)) return;
+            if (!((a.clip | b.clip) & CLIP_NEEDS_CLIPPING)) {
+                lines.push_back(ScreenLine{a.x, a.y, b.x, b.y});
+                return;
+            }
+            ClipVertex ca, cb;
+            ca.h = P * Eigen::Vector4d(verts[i].x, verts[i].y, verts[i].z, 1.0);
+            cb.h = P * Eigen::Vector4d(verts[j].x, verts[j].y, verts[j].z, 1.0);
+            ca.view = ca.normal = cb.view = cb.normal = Vector3d::Zero();
+            if (!clip_segment(ca, cb, ((a.clip | b.clip) & CLIP_GUARD) != 0)) return;
+            ScreenVertex sa = clip_to_screen(ca.h, img);
+            ScreenVertex sb = clip_to_screen(cb.h, img);
+            lines.push_back(ScreenLine{sa.x, sa.y, sb.x, sb.y});
+        };
+        const std::vector<Edge>* edges = &mesh->edges;
+        if (edges->empty() && !mesh->faces.empty()) {
+            auto it = b.edges.find(mesh);
+            if (it == b.edges.end()) it = b.edges.emplace(mesh, unique_edges(mesh->faces)).first;
+            edges = &it->second;
+        }
+        for (const Edge& e : *edges) edge(e.a, e.b);
+    }
+
+    // A line lights pixels up to one beyond its endpoints' box on the minor axis
+    TileBins& bins = b.bins;
+    reset_tile_bins(bins, img);
+    for (size_t k = 0; k < lines.size(); ++k) {
+        const ScreenLine& l = lines[k];
+        PixelRect box{std::min(l.x0, l.x1) - 1, std::min(l.y0, l.y1) - 1, std::max(l.x0, l.x1) + 1,
+                      std::max(l.y0, l.y1) + 1};
+        bin_rect(bins, box, static_cast<uint32_t>(k));
+    }
+    parallel_for(bins.tris.size(), threads, [&](size_t tile) {
+        PixelRect clip = tile_rect(bins, tile);
+        for (uint32_t k : bins.tris[tile]) {
+            const ScreenLine& l = lines[k];
+            draw_line(l.x0, l.y0, l.x1, l.y1, 255, 255, 255, clip, img);
+        }
+    });
+}
+
+} // namespace
+
+void draw_wireframe(Image& img, const Scene& scene, unsigned threads) {
+    FrameArena arena;
+    draw_wireframe(img, scene, arena, threads);
+}
+
+void draw_wireframe(Image& img, const Scene& scene, FrameArena& arena, unsigned threads) {
+    FrameArena::Buffers& b = *arena.buffers;
+    world_to_view(scene, b.view);
+    project_instances(b.view, img, threads, false, b.g.stages);
+    draw_wireframe_edges(img, b.view, b, threads);
+}
+
+void shade_by_mode(Image& img, const Scene& scene, size_t mode, const RenderOptions& opts, RenderStats* stats) {
+    FrameArena arena;
+    shade_by_mode(img, scene, mode, arena, opts, stats);
+}
+
+void shade_by_mode(Image& img, const Scene& scene, size_t mode, FrameArena& arena, const RenderOptions& opts,
+                   RenderStats* stats) {
+    RenderStats frame_stats;
+    if (!stats) stats = &frame_stats;
+    *stats = RenderStats();
+
+    if (mode == 3) {
+        draw_wireframe(img, scene, arena, opts.threads);
+        return;
+    }
+
+    FrameArena::Buffers& b = *arena.buffers;
+    world_to_view(scene, b.view);
+    prepare_frame(b.view, img, mode, opts, b, *stats);
+    raster_frame(b, b.view, mode, opts, img, *stats);
+}
+
+size_t band_row_bytes(size_t xres, size_t mode, const RenderOptions& opts) {
+    size_t per_pixel = 3 + DepthBuffer::bytes_per_pixel(opts.depth);
+    if (mode == 1 && opts.deferred) per_pixel += sizeof(uint32_t);
+    return xres * per_pixel;
+}
+
+void shade_in_bands(size_t xres, size_t yres, const Scene& scene, size_t mode, size_t max_bytes, const BandOutput& out,
+                    const RenderOptions& opts, RenderStats* stats) {
+    RenderStats frame_stats;
+    if (!stats) stats = &frame_stats;
+    *stats = RenderStats();
+
+    size_t row_bytes = band_row_bytes(xres, mode, opts);
+    size_t rows = row_bytes ? max_bytes / row_bytes : yres;
+    if (rows == 0) {
+        throw std::runtime_error("A band of " + std::to_string(max_bytes) + " bytes cannot hold one " +
+                                 std::to_string(xres) + "-pixel row, which needs " + std::to_string(row_bytes));
+    }
+    // Whole tile rows keep each band's bins as full as the frame's
+    if (rows > size_t(kTileSize)) rows -= rows % kTileSize;
+    rows = std::min(rows, yres);
+
+    // Setup sees the whole frame; only the buffers are cut into bands
+    Image band{PixelBuffer(), {}, xres, yres};
+    FrameArena arena;
+    FrameArena::Buffers& b = *arena.buffers;
+    world_to_view(scene, b.view);
+    if (mode == 3) {
+        project_instances(b.view, band, opts.threads, false, b.g.stages);
+    } else {
+        prepare_frame(b.view, band, mode, opts, b, *stats);
+    }
+
+    for (size_t top = 0; top < yres; top += rows) {
+        size_t n = std::min(rows, yres - top);
+        band.band_top = top;
+        band.img = out.pixels(top, n);
+        if (band.z_buf.size() == n * xres) {
+            band.z_buf.clear();
+        } else {
+            band.z_buf = DepthBuffer(n * xres, opts.depth);
+        }
+        if (mode == 3) {
+            draw_wireframe_edges(band, b.view, b, opts.threads);
+        } else {
+            raster_frame(b, b.view, mode, opts, band, *stats);
+        }
+        out.done(band);
+        band.img = PixelBuffer();
+    }
+}
@@ -2,13 +2,90 @@
 #define SHADING_UTILS_H
 
 #include "scene_types.h"
+#include "lighting_kernel.h"
+#include <functional>
+#include <memory>
 #include <Eigen/Dense>
 
 using Eigen::Vector3d;
 
 
-Vector3d lighting (const Vector3d& P, const Vector3d& n_in, const ObjectInstance& mat, const std::vector<Light>& lights, Vector3d e = Vector3d::Zero());
-void shade_by_mode(Image& img, Scene& scenes, size_t mode); 
-void draw_wireframe(Image& img, Scene& scene);
+// Options for rendering a frame.
+struct RenderOptions {
+    unsigned threads = 1; // raster threads, 0 = one per hardware thread
+    bool deferred = false; // Phong: resolve visibility first, then light each visible pixel once
+    DepthFormat depth = DepthFormat::Double; // for the buffers shade_in_bands allocates
+    bool hiz = true; // skip triangles and instances hidden behind each tile's Hi-Z pyramid
+    // Draw instances, and clusters of nearby faces within each mesh, nearest first rather
+    // than in file order, so that hidden surfaces fail the depth test before being shaded.
+    // Where two surfaces have exactly the same depth the later one drawn wins, so such pixels
+    // can differ from file order.
+    bool front_to_back = false;
+    LightingPath lighting = LightingPath::Exact; // how Phong pixels are lit, see lighting_kernel.h
+    // Phong: when positive, light culling. Each tile lists the lights that reach its
+    // triangles, and each triangle is lit only by those of them that reach it, a light
+    // reaching as far as its color times its attenuation is at least light_cutoff in some
+    // channel. A light left out adds less than light_cutoff times diffuse plus specular to
+    // a pixel's color. 0 lights every pixel with every light.
+    double light_cutoff = 0;
+};
+
+// Counters for one frame, filled in by shade_by_mode.
+struct RenderStats {
+    size_t shading_invocations = 0; // calls to lighting()
+    size_t depth_passes = 0; // pixels written by triangles, overdraw included
+    size_t culled_triangles = 0; // binned triangles skipped by Hi-Z, once per tile they touch
+    size_t culled_objects = 0; // instances skipped whole by Hi-Z, once per tile
+    size_t tile_lights = 0; // Phong with light_cutoff: lights listed for the tiles drawn, summed
+};
+
+// Scratch memory for drawing frames, kept from one frame to the next. Drawing a frame
+// through an arena that has already drawn one like it makes no heap allocations: every
+// buffer the pipeline needs is cleared and refilled in place, down to the view-space copy of
+// the scene's transforms and lights, so the same const Scene can be drawn frame after frame.
+// Meshes it has drawn are kept alive, along with data derived from them, until the arena is
+// destroyed.
+struct FrameArena {
+    FrameArena();
+    ~FrameArena();
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    struct Buffers;
+    std::unique_ptr<Buffers> buffers;
+};
+
+// Instantiated for float and double. The double one is the reference the Phong kernels'
+// exact path matches; Gouraud corners and flat faces are lit in the pipeline's Real.
+template <class T>
+Eigen::Matrix<T, 3, 1> lighting(const Eigen::Matrix<T, 3, 1>& P, const Eigen::Matrix<T, 3, 1>& n_in, const ObjectInstance& mat,
+                                const std::vector<Light>& lights, Eigen::Matrix<T, 3, 1> e = Eigen::Matrix<T, 3, 1>::Zero());
+void shade_by_mode(Image& img, const Scene& scene, size_t mode, const RenderOptions& opts = RenderOptions(),
+                   RenderStats* stats = nullptr);
+// The same, reusing arena's buffers, for rendering frame after frame.
+void shade_by_mode(Image& img, const Scene& scene, size_t mode, FrameArena& arena, const RenderOptions& opts = RenderOptions(),
+                   RenderStats* stats = nullptr);
+// Mode 3: every mesh edge once, drawn by tile on threads (0 = one per hardware thread).
+void draw_wireframe(Image& img, const Scene& scene, unsigned threads = 1);
+void draw_wireframe(Image& img, const Scene& scene, FrameArena& arena, unsigned threads = 1);
+
+// Where shade_in_bands puts a frame, one horizontal band at a time, top band first.
+struct BandOutput {
+    // The color plane, black, for rows [top, top + rows) counted from the top of the frame
+    std::function<PixelBuffer(size_t top, size_t rows)> pixels;
+    // Receives each band once it is finished, before the next band's pixels are asked for
+    std::function<void(const Image& band)> done;
+};
+
+// Bytes shade_in_bands needs per image row: color, depth in opts.depth, and for deferred
+// Phong the visibility buffer.
+size_t band_row_bytes(size_t xres, size_t mode, const RenderOptions& opts = RenderOptions());
+
+// Renders the frame shade_by_mode would, pixel for pixel, in horizontal bands of as many
+// rows as fit in max_bytes. Vertices and triangles are set up once for the whole frame;
+// each band is then binned and rasterized on its own, so only one band's buffers exist at
+// a time. Throws std::runtime_error if max_bytes cannot hold a single row.
+void shade_in_bands(size_t xres, size_t yres, const Scene& scene, size_t mode, size_t max_bytes, const BandOutput& out,
+                    const RenderOptions& opts = RenderOptions(), RenderStats* stats = nullptr);
 
 #endif
\ No newline at end of file
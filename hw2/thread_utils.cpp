@@ -0,0 +1,130 @@
+#include "thread_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Set on pool threads, and on a caller for as long as it is in parallel_for
+thread_local bool in_parallel_for = false;
+
+// Worker threads shared by every parallel_for. One job runs at a time: the first `wanted`
+// workers take indices alongside the caller until none are left. Exceptions are caught
+// where they are thrown and handed back by run, since one escaping a worker would end the
+// program and one escaping the caller would leave the workers running on its frame.
+class WorkerPool {
+public:
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& th : threads_) th.join();
+    }
+
+    // Returns the exception of the lowest index that threw, if any did.
+    std::exception_ptr run(size_t n, size_t helpers, const std::function<void(size_t)>& work) {
+        std::lock_guard<std::mutex> job_lock(job_mutex_);
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (threads_.size() < helpers) {
+                size_t index = threads_.size();
+                threads_.emplace_back([this, index] { worker(index); });
+            }
+            work_ = &work;
+            n_ = n;
+            next_ = 0;
+            wanted_ = helpers;
+            busy_ = helpers;
+            error_ = nullptr;
+            ++generation_;
+        }
+        wake_.notify_all();
+        take(work, n);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return busy_ == 0; });
+        work_ = nullptr;
+        std::exception_ptr error;
+        error.swap(error_);
+        return error;
+    }
+
+private:
+    void take(const std::function<void(size_t)>& work, size_t n) {
+        for (size_t i = next_++; i < n; i = next_++) {
+            try {
+                work(i);
+            } catch (...) {
+                fail(i, n, std::current_exception());
+            }
+        }
+    }
+
+    // Every index below i has been handed out already, so the lowest failing index is
+    // among those that run even though no more are started.
+    void fail(size_t i, size_t n, std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_ || i < error_index_) {
+            error_ = e;
+            error_index_ = i;
+        }
+        next_ = n;
+    }
+
+    void worker(size_t index) {
+        in_parallel_for = true;
+        unsigned long long seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [&] { return stop_ || (generation_ != seen && index < wanted_); });
+            if (stop_) return;
+            seen = generation_;
+            const std::function<void(size_t)>& work = *work_;
+            size_t n = n_;
+            lock.unlock();
+            take(work, n);
+            lock.lock();
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+
+    std::mutex job_mutex_; // held by the caller for a whole job
+    std::mutex mutex_;
+    std::mutex error_mutex_;
+    std::condition_variable wake_, done_;
+    std::vector<std::thread> threads_;
+    const std::function<void(size_t)>* work_ = nullptr;
+    size_t n_ = 0, wanted_ = 0, busy_ = 0;
+    std::atomic<size_t> next_{0};
+    unsigned long long generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    size_t error_index_ = 0;
+};
+
+} // namespace
+
+unsigned resolve_threads(unsigned threads) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return std::max(1u, threads);
+}
+
+void parallel_for(size_t n, unsigned threads, const std::function<void(size_t)>& work) {
+    size_t workers = std::min<size_t>(resolve_threads(threads), n);
+    if (workers <= 1 || in_parallel_for) {
+        for (size_t i = 0; i < n; ++i) work(i);
+        return;
+    }
+
+    static WorkerPool pool;
+    in_parallel_for = true;
+    std::exception_ptr error = pool.run(n, workers - 1, work);
+    in_parallel_for = false;
+    if (error) std::rethrow_exception(error);
+}
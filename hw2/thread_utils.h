@@ -0,0 +1,27 @@
+#ifndef THREAD_UTILS_H
+#define THREAD_UTILS_H
+
+#include <cstddef>
+#include <functional>
+
+// Worker count for a requested thread count, 0 meaning one per hardware thread.
+unsigned resolve_threads(unsigned threads);
+
+// Runs work(i) for every i in [0, n) on up to `threads` workers, the calling thread being
+// one of them. Indices are handed out one at a time, so uneven items balance out. The other
+// workers are threads kept from call to call, started the first time that many are asked
+// for, so a call allocates nothing once they exist. Calls made from within work run
+// serially on the thread that makes them. If work throws, no further indices are handed
+// out, and once every worker has stopped the exception of the lowest failing index, the
+// one a serial loop would have hit, is rethrown on the calling thread.
+void parallel_for(size_t n, unsigned threads, const std::function<void(size_t)>& work);
+
+// The same for any callable, passed by reference so that no std::function copy of a large
+// lambda is allocated.
+template <class Fn>
+void parallel_for(size_t n, unsigned threads, Fn&& work) {
+    const std::function<void(size_t)> fn(std::ref(work));
+    parallel_for(n, threads, fn);
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include <iostream>
 
@@ -40,42 +42,56 @@ Matrix4d make_rotation(double rx, double ry, double rz, double angle) {
     return R;
 }
 
-void apply_transform_to_object(Object& src, const Matrix4d& M, bool transform_normals) {
-    // Transform vertices
-    for (size_t vi = 1; vi < src.vertices.size(); ++vi) {
-        auto& v = src.vertices[vi];
-        Eigen::Vector4d p(v.x, v.y, v.z, 1.0);
-        Eigen::Vector3d q = (M * p).hnormalized();
-        v.x = q[0];
-        v.y = q[1];
-        v.z = q[2];
+template <class T>
+void transform_vertices(const std::vector<BasicVertex<T>>& src, const Matrix4d& M, std::vector<BasicVertex<T>>& dst) {
+    // Index 0 is the obj dummy vertex, copied through untouched
+    dst.resize(src.size());
+    if (src.empty()) return;
+    dst[0] = src[0];
+    const Eigen::Matrix<T, 4, 4> Mt = M.cast<T>();
+    for (size_t vi = 1; vi < src.size(); ++vi) {
+        const auto& v = src[vi];
+        Eigen::Matrix<T, 4, 1> p(v.x, v.y, v.z, T(1));
+        Eigen::Matrix<T, 3, 1> q = (Mt * p).hnormalized();
+        dst[vi] = {q[0], q[1], q[2]};
     }
+}
 
-    // Transform normals
-    if (transform_normals) {
-        // Ignore translations, take the upper-left 3x3 block
-        const Eigen::Matrix3d A = M.block<3,3>(0,0);
-        Eigen::Matrix3d N;
-        double det = A.determinant();
-        if (std::abs(det) < 1e-15) {
-            N = Eigen::Matrix3d::Identity();
-            std::cerr << "Warning: singular transform for normals. Using identity.\n";
-        } else {
-            N = A.inverse().transpose();
-        }
-        
-        for (size_t ni = 1; ni < src.normals.size(); ++ni) {
-            auto& vn = src.normals[ni];
-            Eigen::Vector3d n(vn.x, vn.y, vn.z);
-            n = N * n;
-            n.normalize();
-            vn.x = n.x();
-            vn.y = n.y();
-            vn.z = n.z();
-        }
+template <class T>
+void transform_normals(const std::vector<BasicNormal<T>>& src, const Matrix4d& M, std::vector<BasicNormal<T>>& dst) {
+    // Ignore translations, take the upper-left 3x3 block
+    const Eigen::Matrix3d A = M.block<3,3>(0,0);
+    Eigen::Matrix3d N;
+    double det = A.determinant();
+    if (std::abs(det) < 1e-15) {
+        N = Eigen::Matrix3d::Identity();
+        std::cerr << "Warning: singular transform for normals. Using identity.\n";
+    } else {
+        N = A.inverse().transpose();
+    }
+
+    dst.resize(src.size());
+    if (src.empty()) return;
+    dst[0] = src[0];
+    const Eigen::Matrix<T, 3, 3> Nt = N.cast<T>();
+    for (size_t ni = 1; ni < src.size(); ++ni) {
+        const auto& vn = src[ni];
+        Eigen::Matrix<T, 3, 1> n(vn.x, vn.y, vn.z);
+        n = Nt * n;
+        n.normalize();
+        dst[ni] = {n.x(), n.y(), n.z()};
     }
 }
 
+template void transform_vertices(const std::vector<BasicVertex<float>>&, const Matrix4d&,
+                                 std::vector<BasicVertex<float>>&);
+template void transform_vertices(const std::vector<BasicVertex<double>>&, const Matrix4d&,
+                                 std::vector<BasicVertex<double>>&);
+template void transform_normals(const std::vector<BasicNormal<float>>&, const Matrix4d&,
+                                std::vector<BasicNormal<float>>&);
+template void transform_normals(const std::vector<BasicNormal<double>>&, const Matrix4d&,
+                                std::vector<BasicNormal<double>>&);
+
 Camera make_cam_matrices(const CameraParams& cam){
     // Make transformation matrix
     Matrix4d T_C = make_translation(cam.px, cam.py, cam.pz);
@@ -101,8 +117,10 @@ Camera make_cam_matrices(const CameraParams& cam){
 }
 
 void world_to_view(Scene& scene) {
+    // Meshes are shared between instances, so only the instance transforms move to view space.
+    // Vertices are transformed per instance when they are drawn.
     for (auto& obj_inst : scene.scene_objects) {
-        apply_transform_to_object(obj_inst.obj, scene.cam_transforms.Cinv, true);
+        obj_inst.transform = scene.cam_transforms.Cinv * obj_inst.transform;
     }
     
     // Transform lights
@@ -115,47 +133,120 @@ void world_to_view(Scene& scene) {
     }
 }
 
-void view_to_ndc(Scene& scene) {
-    for (auto& obj_inst : scene.scene_objects) {
-        // Don't convert normals to NDC
-        apply_transform_to_object(obj_inst.obj, scene.cam_transforms.P, false);
-    }
+void world_to_view(const Scene& scene, Scene& view) {
+    view = scene;
+    world_to_view(view);
 }
 
-void view_to_ndc(std::vector<Vertex>& verts, const Scene& scene) {
-    for (auto& v : verts) {
-        Eigen::Vector4d p(v.x, v.y, v.z, 1.0);
-        Eigen::Vector3d q = (scene.cam_transforms.P * p).hnormalized();
-        v.x = q[0];
-        v.y = q[1];
-        v.z = q[2];
+ScreenVertex clip_to_screen(const Eigen::Vector4d& h, const Image& img) {
+    const double max_x = img.xres ? static_cast<double>(img.xres - 1) : 0.0;
+    const double max_y = img.yres ? static_cast<double>(img.yres - 1) : 0.0;
+    const int last_x = static_cast<int>(max_x);
+    const int last_y = static_cast<int>(max_y);
+    Eigen::Vector3d q = h.hnormalized();
+
+    ScreenVertex s;
+    s.ndc_x = q[0];
+    s.ndc_y = q[1];
+    s.z = q[2];
+    s.x = 0;
+    s.y = 0;
+
+    uint8_t clip = 0;
+    if (h[2] < -h[3]) clip |= CLIP_NEAR;
+    if (h[2] > h[3]) clip |= CLIP_FAR;
+    // The negated tests also catch NaN
+    const double band = kGuardBand * h[3];
+    if (!(h[3] > 0) || !(std::abs(h[0]) <= band) || !(std::abs(h[1]) <= band)) clip |= CLIP_GUARD;
+
+    if (clip & CLIP_NEEDS_CLIPPING) {
+        // Outcodes against the clip-space planes, which contain the pixel-based ones
+        if (h[0] < -h[3]) clip |= CLIP_LEFT;
+        if (h[0] > h[3]) clip |= CLIP_RIGHT;
+        if (h[1] < -h[3]) clip |= CLIP_BOTTOM;
+        if (h[1] > h[3]) clip |= CLIP_TOP;
+    }
+    // Clipping leaves vertices on the band's edge, which may round either side of it, so
+    // pixels are mapped with slack; only vertices far outside keep (0, 0).
+    if (std::abs(q[0]) <= 2 * kGuardBand && std::abs(q[1]) <= 2 * kGuardBand) {
+        s.x = static_cast<int>(std::lround((q[0] + 1.0) * 0.5 * max_x));
+        s.y = static_cast<int>(std::lround((q[1] + 1.0) * 0.5 * max_y));
+        if (!(clip & CLIP_NEEDS_CLIPPING)) {
+            if (s.x < 0) clip |= CLIP_LEFT;
+            if (s.x > last_x) clip |= CLIP_RIGHT;
+            if (s.y < 0) clip |= CLIP_BOTTOM;
+            if (s.y > last_y) clip |= CLIP_TOP;
+        }
     }
+    s.clip = clip;
+    return s;
 }
 
-void ndc_to_screen(const Image& img, Scene& scene){
-    if (img.xres == 0 || img.yres == 0) return;
+template <class T>
+void project_to_screen(const std::vector<BasicVertex<T>>& view, const Matrix4d& P, const Image& img,
+                       std::vector<ScreenVertex>& out) {
+    out.resize(view.size());
+    const Eigen::Matrix<T, 4, 4> Pt = P.cast<T>();
+    for (size_t i = 0; i < view.size(); ++i) {
+        const auto& v = view[i];
+        Eigen::Matrix<T, 4, 1> h = Pt * Eigen::Matrix<T, 4, 1>(v.x, v.y, v.z, T(1));
+        out[i] = clip_to_screen(h.template cast<double>(), img);
+    }
+}
 
-    const double max_x = static_cast<double>(img.xres - 1);
-    const double max_y = static_cast<double>(img.yres - 1);
+template void project_to_screen(const std::vector<BasicVertex<float>>&, const Matrix4d&, const Image&,
+                                std::vector<ScreenVertex>&);
+template void project_to_screen(const std::vector<BasicVertex<double>>&, const Matrix4d&, const Image&,
+                                std::vector<ScreenVertex>&);
+
+namespace {
+
+// Signed distance of h to clip plane k, inside when >= 0: near, then the four guard-band sides.
+double plane_distance(const Eigen::Vector4d& h, int k) {
+    switch (k) {
+    case 0: return h[2] + h[3];
+    case 1: return kGuardBand * h[3] + h[0];
+    case 2: return kGuardBand * h[3] - h[0];
+    case 3: return kGuardBand * h[3] + h[1];
+    default: return kGuardBand * h[3] - h[1];
+    }
+}
 
-    for (auto& obj_inst : scene.scene_objects) {
-        for (std::size_t vi = 1; vi < obj_inst.obj.vertices.size(); ++vi) {
-            auto& vert = obj_inst.obj.vertices[vi];
+ClipVertex lerp_clip_vertex(const ClipVertex& a, const ClipVertex& b, double t) {
+    return {a.h + t * (b.h - a.h), a.view + t * (b.view - a.view), a.normal + t * (b.normal - a.normal)};
+}
 
-            vert.x = (vert.x + 1.0) * 0.5 * max_x;
-            vert.y = (vert.y + 1.0) * 0.5 * max_y;
+} // namespace
+
+int clip_polygon(ClipVertex* poly, int n, bool guard) {
+    ClipVertex tmp[kMaxClipVertices];
+    int planes = guard ? 5 : 1;
+    for (int k = 0; k < planes && n >= 3; ++k) {
+        int m = 0;
+        for (int i = 0; i < n; ++i) {
+            const ClipVertex& a = poly[i];
+            const ClipVertex& b = poly[(i + 1) % n];
+            double da = plane_distance(a.h, k);
+            double db = plane_distance(b.h, k);
+            if (da >= 0) tmp[m++] = a;
+            // Always interpolate from the inside end so shared edges clip to the same point
+            if (da >= 0 && db < 0) tmp[m++] = lerp_clip_vertex(a, b, da / (da - db));
+            else if (da < 0 && db >= 0) tmp[m++] = lerp_clip_vertex(b, a, db / (db - da));
         }
+        std::copy(tmp, tmp + m, poly);
+        n = m;
     }
+    return n;
 }
 
-void ndc_to_screen(const Image& img, std::vector<Vertex>& verts) {
-    if (img.xres == 0 || img.yres == 0) return;
-
-    const double max_x = static_cast<double>(img.xres - 1);
-    const double max_y = static_cast<double>(img.yres - 1);
-
-    for (auto& v : verts) {
-        v.x = (v.x + 1.0) * 0.5 * max_x;
-        v.y = (v.y + 1.0) * 0.5 * max_y;
+bool clip_segment(ClipVertex& a, ClipVertex& b, bool guard) {
+    int planes = guard ? 5 : 1;
+    for (int k = 0; k < planes; ++k) {
+        double da = plane_distance(a.h, k);
+        double db = plane_distance(b.h, k);
+        if (da < 0 && db < 0) return false;
+        if (da < 0) a = lerp_clip_vertex(b, a, db / (db - da));
+        else if (db < 0) b = lerp_clip_vertex(a, b, da / (da - db));
     }
-}
\ No newline at end of file
+    return true;
+}
@@ -12,16 +12,54 @@ Matrix4d make_translation(double tx, double ty, double tz);
 Matrix4d make_scaling(double sx, double sy, double sz);
 Matrix4d make_rotation(double rx, double ry, double rz, double angle);
 
-void apply_transform_to_object(Object& src, const Matrix4d& M, bool transform_normals=true);
+// Write M applied to every vertex / normal of src into dst (resized to match).
+// Normals use the inverse transpose of M's upper 3x3 and are renormalized. M is rounded
+// to T and applied in T. Instantiated for float and double.
+template <class T>
+void transform_vertices(const std::vector<BasicVertex<T>>& src, const Matrix4d& M, std::vector<BasicVertex<T>>& dst);
+template <class T>
+void transform_normals(const std::vector<BasicNormal<T>>& src, const Matrix4d& M, std::vector<BasicNormal<T>>& dst);
 
 Camera make_cam_matrices(const CameraParams& cam);
 
 void world_to_view(Scene& scene);
+// Writes scene into view with its instance transforms and lights moved to view space, leaving
+// scene as it was. view's vectors are reused, so a view that has held the same scene
+// before takes no new memory.
+void world_to_view(const Scene& scene, Scene& view);
 
-void view_to_ndc(Scene& scene);
-void view_to_ndc(std::vector<Vertex>& verts, const Scene& scene);
+// Triangles may extend this far past the viewport, in NDC units, before they are clipped
+// to it. Inside the band pixel coordinates stay below 2^22 at 8K, so edge functions fit
+// the raster kernels' exact range; the bounding box is scissored to the image anyway.
+const double kGuardBand = 1024.0;
 
-void ndc_to_screen(const Image& img, Scene& scene);
-void ndc_to_screen(const Image& img, std::vector<Vertex>& verts);
+// Map one clip-space position through the viewport of img, with clip flags.
+ScreenVertex clip_to_screen(const Eigen::Vector4d& h, const Image& img);
+
+// Project each view-space vertex once through P and the viewport of img, with clip flags.
+// The clip-space position is computed in T, then mapped in double. Instantiated for float
+// and double.
+template <class T>
+void project_to_screen(const std::vector<BasicVertex<T>>& view, const Matrix4d& P, const Image& img,
+                       std::vector<ScreenVertex>& out);
+
+// A polygon vertex during clipping: clip-space position and the view-space attributes that
+// are interpolated along with it.
+struct ClipVertex {
+    Eigen::Vector4d h;
+    Eigen::Vector3d view;
+    Eigen::Vector3d normal;
+};
+
+// Each plane adds at most one vertex to a triangle: near plus four guard-band planes.
+const int kMaxClipVertices = 8;
+
+// Sutherland-Hodgman clip of the convex polygon poly[0..n) against the near plane, and the
+// guard band when guard is set, in place. poly needs room for kMaxClipVertices. Returns
+// the new vertex count, below 3 when nothing is left.
+int clip_polygon(ClipVertex* poly, int n, bool guard);
+
+// Clips the segment a-b against the same planes. Returns false when nothing is left.
+bool clip_segment(ClipVertex& a, ClipVertex& b, bool guard);
 
 #endif
\ No newline at end of file
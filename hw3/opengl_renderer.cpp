@@ -14,6 +14,7 @@
 #include <algorithm>
 #include <array>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -250,8 +251,15 @@ void keyboard(unsigned char key, int, int) {
 }
 
 int main(int argc, char** argv) {
+    // A trailing --no-cache disables the .meshcache sidecars next to the OBJ files
+    bool use_mesh_cache = true;
+    if (argc > 1 && std::strcmp(argv[argc - 1], "--no-cache") == 0) {
+        use_mesh_cache = false;
+        --argc;
+    }
+
     if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres]\n";
+        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres] [--no-cache]\n";
         return 1;
     }
 
@@ -265,7 +273,7 @@ int main(int argc, char** argv) {
     }
 
     try {
-        g_scene = parse_scene_file(fin, parse_parent_path(argv[1]));
+        g_scene = parse_scene_file(fin, parse_parent_path(argv[1]), use_mesh_cache);
     } catch (const std::exception& e) {
         std::cerr << "Error parsing scene: " << e.what() << "\n";
         return 1;
@@ -2,11 +2,21 @@
 
 #include <Eigen/Geometry>
 #include <cmath>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
 #include <unordered_map>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using Eigen::AngleAxisd;
 using Eigen::Matrix3d;
 using Eigen::Matrix4d;
@@ -133,61 +143,420 @@ std::size_t find_string_idx(
     return it->second;
 }
 
+// Read-only view of a whole file. Regular files are memory-mapped; anything that
+// cannot be mapped is read into an owned buffer instead.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            size_ = static_cast<std::size_t>(st.st_size);
+            if (size_ == 0) {
+                ok_ = true;
+            } else {
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    ::madvise(p, size_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(p);
+                    mapped_ = true;
+                    ok_ = true;
+                }
+            }
+        }
+
+        if (!ok_) {
+            char chunk[1 << 16];
+            ssize_t n;
+            while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+                fallback_.insert(fallback_.end(), chunk, chunk + n);
+            }
+            if (n == 0) {
+                data_ = fallback_.data();
+                size_ = fallback_.size();
+                ok_ = true;
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool ok() const { return ok_; }
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+    bool ok_ = false;
+    std::vector<char> fallback_;
+};
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool at_token_end(const char* p, const char* end) {
+    return p == end || is_blank(*p) || *p == '\n';
+}
+
+inline void skip_blanks(const char*& p, const char* end) {
+    while (p < end && is_blank(*p)) ++p;
+}
+
+inline void skip_line(const char*& p, const char* end) {
+    const void* nl = std::memchr(p, '\n', static_cast<std::size_t>(end - p));
+    p = nl ? static_cast<const char*>(nl) : end;
+}
+
+const double kPow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+bool scan_double_slow(const char*& p, const char* end, double& out) {
+    // The copy gives strtod its terminator; tokens of any length are accepted.
+    std::size_t len = 0;
+    while (!at_token_end(p + len, end)) ++len;
+    std::string token(p, len);
+    char* stop = nullptr;
+    out = std::strtod(token.c_str(), &stop);
+    if (stop != token.c_str() + len) return false;
+    p += len;
+    return true;
+}
+
+bool scan_double(const char*& p, const char* end, double& out) {
+    // Exact fast path (mantissa < 2^53, |exp| <= 22), strtod for everything else.
+    const char* start = p;
+    const char* q = p;
+    bool neg = false;
+    if (q < end && (*q == '-' || *q == '+')) { neg = (*q == '-'); ++q; }
+
+    uint64_t mant = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool overflow = false;
+    for (; q < end && *q >= '0' && *q <= '9'; ++q, ++digits) {
+        if (mant > (UINT64_MAX - 9) / 10) { overflow = true; ++exp10; continue; }
+        mant = mant * 10 + static_cast<uint64_t>(*q - '0');
+    }
+    if (q < end && *q == '.') {
+        ++q;
+        for (; q < end && *q >= '0' && *q <= '9'; ++q, ++digits) {
+            if (mant > (UINT64_MAX - 9) / 10) { overflow = true; continue; }
+            mant = mant * 10 + static_cast<uint64_t>(*q - '0');
+            --exp10;
+        }
+    }
+    if (digits == 0) return false;
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        ++q;
+        bool eneg = false;
+        if (q < end && (*q == '-' || *q == '+')) { eneg = (*q == '-'); ++q; }
+        if (q == end || *q < '0' || *q > '9') return false;
+        int e = 0;
+        for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+            if (e < 100000) e = e * 10 + (*q - '0');
+        }
+        exp10 += eneg ? -e : e;
+    }
+    if (!at_token_end(q, end)) return false;
+
+    if (overflow || mant > (uint64_t(1) << 53) || exp10 < -22 || exp10 > 22) {
+        p = start;
+        return scan_double_slow(p, end, out);
+    }
+
+    double v = static_cast<double>(mant);
+    v = exp10 < 0 ? v / kPow10[-exp10] : v * kPow10[exp10];
+    out = neg ? -v : v;
+    p = q;
+    return true;
+}
+
+bool scan_uint(const char*& p, const char* end, unsigned int& out) {
+    const char* q = p;
+    uint64_t v = 0;
+    for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+        v = v * 10 + static_cast<uint64_t>(*q - '0');
+        if (v > UINT_MAX) return false;
+    }
+    if (q == p) return false;
+    out = static_cast<unsigned int>(v);
+    p = q;
+    return true;
+}
+
+bool scan_vec3(const char*& p, const char* end, double& x, double& y, double& z) {
+    skip_blanks(p, end);
+    if (!scan_double(p, end, x)) return false;
+    skip_blanks(p, end);
+    if (!scan_double(p, end, y)) return false;
+    skip_blanks(p, end);
+    return scan_double(p, end, z);
+}
+
+// Binary sidecar cache ("<file>.meshcache") for parsed meshes, reused only when the
+// canonical source path, size, mtime and content hash all match. Same format as hw2,
+// tagged with this program's magic so loaders with different layouts never share one.
+const char kMeshCacheMagic[8] = {'H', 'W', '3', 'M', 'E', 'S', 'H', '\0'};
+const uint32_t kMeshCacheVersion = 1;
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t path_len;
+    uint32_t vertex_size, normal_size, face_size, reserved;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t source_hash;
+    uint64_t vertex_count, normal_count, face_count;
+};
+
+inline std::size_t align8(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read_u64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+
+inline uint64_t hash_round(uint64_t acc, uint64_t lane) {
+    return rotl64(acc + lane * kPrime2, 31) * kPrime1;
+}
+
+uint64_t hash_bytes(const char* data, std::size_t size) {
+    const char* p = data;
+    const char* end = data + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t a = kPrime1 + kPrime2, b = kPrime2, c = 0, d = 0 - kPrime1;
+        for (; end - p >= 32; p += 32) {
+            a = hash_round(a, read_u64(p));
+            b = hash_round(b, read_u64(p + 8));
+            c = hash_round(c, read_u64(p + 16));
+            d = hash_round(d, read_u64(p + 24));
+        }
+        h = rotl64(a, 1) + rotl64(b, 7) + rotl64(c, 12) + rotl64(d, 18);
+    } else {
+        h = kPrime3;
+    }
+    h += static_cast<uint64_t>(size);
+
+    for (; end - p >= 8; p += 8) {
+        h ^= hash_round(0, read_u64(p));
+        h = rotl64(h, 27) * kPrime1 + kPrime3;
+    }
+    for (; p < end; ++p) {
+        h ^= static_cast<uint8_t>(*p) * kPrime3;
+        h = rotl64(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string canonical_path(const std::string& path) {
+    char buf[PATH_MAX];
+    if (::realpath(path.c_str(), buf)) return buf;
+    return path;
+}
+
+bool stat_source(const std::string& path, uint64_t& size, int64_t& mtime_ns) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return false;
+    size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    mtime_ns = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+bool load_mesh_cache(const std::string& obj_path, const MappedFile& src, Object& obj) {
+    MappedFile cache(obj_path + ".meshcache");
+    if (!cache.ok() || cache.size() < sizeof(MeshCacheHeader)) return false;
+
+    MeshCacheHeader h;
+    std::memcpy(&h, cache.data(), sizeof(h));
+    if (std::memcmp(h.magic, kMeshCacheMagic, sizeof(h.magic)) != 0 || h.version != kMeshCacheVersion ||
+        h.vertex_size != sizeof(Vertex) || h.normal_size != sizeof(Normal) || h.face_size != sizeof(Face)) {
+        return false;
+    }
+
+    uint64_t size;
+    int64_t mtime_ns;
+    if (!stat_source(obj_path, size, mtime_ns)) return false;
+    if (h.source_size != size || h.source_size != src.size() || h.source_mtime_ns != mtime_ns) return false;
+
+    // The counts come from the file, so each is held to the bytes left before it is scaled
+    std::size_t vert_off = 0, norm_off = 0, face_off = 0;
+    std::size_t off = align8(sizeof(MeshCacheHeader) + h.path_len);
+    auto take = [&](uint64_t count, std::size_t elem_size, std::size_t& at) {
+        if (off > cache.size() || count > (cache.size() - off) / elem_size) return false;
+        at = off;
+        off += align8(std::size_t(count) * elem_size);
+        return true;
+    };
+    if (!take(h.vertex_count, sizeof(Vertex), vert_off) || !take(h.normal_count, sizeof(Normal), norm_off) ||
+        !take(h.face_count, sizeof(Face), face_off) || off != cache.size()) {
+        return false;
+    }
+
+    std::string key = canonical_path(obj_path);
+    if (key.size() != h.path_len || key.compare(0, key.size(), cache.data() + sizeof(h), h.path_len) != 0) {
+        return false;
+    }
+    if (h.source_hash != hash_bytes(src.data(), src.size())) return false;
+
+    const Vertex* v = reinterpret_cast<const Vertex*>(cache.data() + vert_off);
+    const Face* f = reinterpret_cast<const Face*>(cache.data() + face_off);
+    // The source hash says nothing of the arrays, so a face indexing past them rejects the file
+    for (std::size_t i = 0; i < h.face_count; ++i) {
+        if (f[i].v1 >= h.vertex_count || f[i].v2 >= h.vertex_count || f[i].v3 >= h.vertex_count ||
+            f[i].vn1 >= h.normal_count || f[i].vn2 >= h.normal_count || f[i].vn3 >= h.normal_count) {
+            return false;
+        }
+    }
+    obj.vertices.assign(v, v + h.vertex_count);
+    const Normal* n = reinterpret_cast<const Normal*>(cache.data() + norm_off);
+    obj.normals.assign(n, n + h.normal_count);
+    obj.faces.assign(f, f + h.face_count);
+    return true;
+}
+
+void write_mesh_cache(const std::string& obj_path, const MappedFile& src, const Object& obj) {
+    uint64_t size;
+    int64_t mtime_ns;
+    if (!stat_source(obj_path, size, mtime_ns) || size != src.size()) return;
+
+    std::string key = canonical_path(obj_path);
+    MeshCacheHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMeshCacheMagic, sizeof(h.magic));
+    h.version = kMeshCacheVersion;
+    h.path_len = static_cast<uint32_t>(key.size());
+    h.vertex_size = sizeof(Vertex);
+    h.normal_size = sizeof(Normal);
+    h.face_size = sizeof(Face);
+    h.source_size = size;
+    h.source_mtime_ns = mtime_ns;
+    h.source_hash = hash_bytes(src.data(), src.size());
+    h.vertex_count = obj.vertices.size();
+    h.normal_count = obj.normals.size();
+    h.face_count = obj.faces.size();
+
+    std::string path = obj_path + ".meshcache";
+    std::string tmp = path + ".tmp" + std::to_string(::getpid());
+    FILE* out = std::fopen(tmp.c_str(), "wb");
+    if (!out) return;
+
+    const char zeros[8] = {0};
+    auto write_block = [&](const void* data, std::size_t bytes) {
+        return std::fwrite(data, 1, bytes, out) == bytes &&
+               std::fwrite(zeros, 1, align8(bytes) - bytes, out) == align8(bytes) - bytes;
+    };
+    bool ok = write_block(&h, sizeof(h)) &&
+              write_block(key.data(), key.size()) &&
+              write_block(obj.vertices.data(), obj.vertices.size() * sizeof(Vertex)) &&
+              write_block(obj.normals.data(), obj.normals.size() * sizeof(Normal)) &&
+              write_block(obj.faces.data(), obj.faces.size() * sizeof(Face));
+    ok = (std::fclose(out) == 0) && ok;
+
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) std::remove(tmp.c_str());
+}
+
 std::vector<Object> load_objects(const std::vector<std::string>& fpaths,
-                                 const std::string& parent_path) {
+                                 const std::string& parent_path,
+                                 bool use_mesh_cache) {
     std::vector<Object> objects;
     for (const auto& filename : fpaths) {
         std::string file_path = join_path(parent_path, filename);
-        std::ifstream file(file_path);
-        if (!file) {
+        MappedFile file(file_path);
+        if (!file.ok()) {
             throw std::runtime_error("Error: Could not open file " + file_path);
         }
 
+        Object cached;
+        if (use_mesh_cache && load_mesh_cache(file_path, file, cached)) {
+            cached.filename = file_path;
+            objects.push_back(std::move(cached));
+            continue;
+        }
+
         std::vector<Vertex> vertices{{0.0, 0.0, 0.0}};
         std::vector<Normal> normals{{0.0, 0.0, 0.0}};
         std::vector<Face> faces;
-        std::string line;
 
-        while (std::getline(file, line)) {
-            auto first_non_ws = line.find_first_not_of(" \t\r\n");
-            if (first_non_ws == std::string::npos) continue;
-            if (line[first_non_ws] == '#') continue;
+        const char* p = file.data();
+        const char* end = p + file.size();
+        while (p < end) {
+            skip_blanks(p, end);
+            if (p == end) break;
+            if (*p == '\n') { ++p; continue; }
+            if (*p == '#') { skip_line(p, end); continue; }
 
-            std::istringstream line_stream(line.substr(first_non_ws));
-            std::string type;
-            line_stream >> type;
+            const char* type = p;
+            while (!at_token_end(p, end)) ++p;
+            std::size_t type_len = static_cast<std::size_t>(p - type);
 
-            if (type == "v") {
+            if (type_len == 1 && type[0] == 'v') {
                 double x, y, z;
-                if (!(line_stream >> x >> y >> z)) {
+                if (!scan_vec3(p, end, x, y, z)) {
                     throw std::runtime_error("Invalid vertex format");
                 }
                 vertices.push_back({x, y, z});
-            } else if (type == "vn") {
+            } else if (type_len == 2 && type[0] == 'v' && type[1] == 'n') {
                 double x, y, z;
-                if (!(line_stream >> x >> y >> z)) {
+                if (!scan_vec3(p, end, x, y, z)) {
                     throw std::runtime_error("Invalid normal format");
                 }
                 normals.push_back({x, y, z});
-            } else if (type == "f") {
+            } else if (type_len == 1 && type[0] == 'f') {
                 unsigned int v_idx[3], n_idx[3];
                 for (int i = 0; i < 3; ++i) {
-                    std::string token;
-                    if (!(line_stream >> token)) {
+                    skip_blanks(p, end);
+                    if (!scan_uint(p, end, v_idx[i])) {
                         throw std::runtime_error("Invalid face format");
                     }
-                    auto pos = token.find("//");
-                    if (pos == std::string::npos) {
+                    if (end - p < 2 || p[0] != '/' || p[1] != '/') {
                         throw std::runtime_error("Expected 'v//vn' format");
                     }
-                    v_idx[i] = static_cast<unsigned int>(std::stoul(token.substr(0, pos)));
-                    n_idx[i] = static_cast<unsigned int>(std::stoul(token.substr(pos + 2)));
+                    p += 2;
+                    if (!scan_uint(p, end, n_idx[i])) {
+                        throw std::runtime_error("Invalid face format");
+                    }
+                    while (!at_token_end(p, end)) ++p;
                 }
                 faces.push_back({v_idx[0], v_idx[1], v_idx[2], n_idx[0], n_idx[1], n_idx[2]});
             }
+            skip_line(p, end);
         }
 
         objects.push_back({file_path, std::move(vertices), std::move(normals), std::move(faces)});
+        if (use_mesh_cache) write_mesh_cache(file_path, file, objects.back());
     }
 
     return objects;
@@ -390,7 +759,7 @@ std::size_t parse_size_t(const char* str) {
     return static_cast<std::size_t>(std::stoul(str));
 }
 
-Scene parse_scene_file(std::ifstream& fin, const std::string& parent_path) {
+Scene parse_scene_file(std::ifstream& fin, const std::string& parent_path, bool use_mesh_cache) {
     CameraParams cam;
     std::vector<std::string> object_section_lines;
 
@@ -418,7 +787,7 @@ Scene parse_scene_file(std::ifstream& fin, const std::string& parent_path) {
     std::vector<std::string> object_names;
     std::vector<std::string> object_paths;
     std::size_t next_idx = parse_object_mappings(object_section_lines, object_names, object_paths);
-    std::vector<Object> objects = load_objects(object_paths, parent_path);
+    std::vector<Object> objects = load_objects(object_paths, parent_path, use_mesh_cache);
 
     std::unordered_map<std::string, std::size_t> name_to_idx;
     name_to_idx.reserve(object_names.size());
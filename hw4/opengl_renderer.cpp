@@ -18,11 +18,13 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #ifndef SHADER_DIR
@@ -38,10 +40,17 @@ enum class RunMode {
     NormalMap
 };
 
-struct Mesh {
+// GPU copy of one shared mesh, uploaded once no matter how many instances draw it
+struct MeshBuffer {
     GLuint vao = 0;
     GLuint vbo = 0;
     GLsizei vertex_count = 0;
+};
+
+// One drawable instance: a shared buffer plus its own transform and material
+struct Mesh {
+    std::size_t buffer = 0; // index into SceneState::buffers
+    Eigen::Matrix4f model = Eigen::Matrix4f::Identity();
     Eigen::Vector3f ambient = Eigen::Vector3f::Zero();
     Eigen::Vector3f diffuse = Eigen::Vector3f::Zero();
     Eigen::Vector3f specular = Eigen::Vector3f::Zero();
@@ -56,6 +65,7 @@ struct LightState {
 
 struct SceneState {
     Scene scene;
+    std::vector<MeshBuffer> buffers;
     std::vector<Mesh> meshes;
     std::vector<LightState> lights;
 };
@@ -219,61 +229,76 @@ Eigen::Matrix4f make_translation(float x, float y, float z) {
 //  Scene mode setup
 // #####################
 
+MeshBuffer upload_mesh_buffer(const Object& obj) {
+    std::vector<float> interleaved; // interleaved vectors and normals
+    interleaved.reserve(obj.faces.size() * 3 * 6);
+
+    for (const auto& face : obj.faces) {
+        const Vertex& v1 = obj.vertices.at(face.v1);
+        const Vertex& v2 = obj.vertices.at(face.v2);
+        const Vertex& v3 = obj.vertices.at(face.v3);
+        const Normal& n1 = obj.normals.at(face.vn1);
+        const Normal& n2 = obj.normals.at(face.vn2);
+        const Normal& n3 = obj.normals.at(face.vn3);
+
+        const Vertex* vertices[3] = {&v1, &v2, &v3};
+        const Normal* normals[3] = {&n1, &n2, &n3};
+        for (int i = 0; i < 3; ++i) {
+            interleaved.push_back(static_cast<float>(vertices[i]->x));
+            interleaved.push_back(static_cast<float>(vertices[i]->y));
+            interleaved.push_back(static_cast<float>(vertices[i]->z));
+            interleaved.push_back(static_cast<float>(normals[i]->x));
+            interleaved.push_back(static_cast<float>(normals[i]->y));
+            interleaved.push_back(static_cast<float>(normals[i]->z));
+        }
+    }
+
+    MeshBuffer buffer;
+    buffer.vertex_count = static_cast<GLsizei>(interleaved.size() / 6);
+
+    // Generate a vao location for this mesh
+    glGenVertexArrays(1, &buffer.vao);
+    glBindVertexArray(buffer.vao);
+
+    // Store the mesh in a vbo
+    glGenBuffers(1, &buffer.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(interleaved.size() * sizeof(float)),
+                 interleaved.data(), GL_STATIC_DRAW);
+
+    // Tell information needed to interpret our vbo
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void*>(0));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void*>(3 * sizeof(float)));
+
+    // Reset so we don't accidentally overwrite
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffer;
+}
+
 void build_scene_meshes() {
+    // Upload each unique mesh once; instances only keep their transform and material
+    g_scene_state.buffers.clear();
     g_scene_state.meshes.clear();
     g_scene_state.meshes.reserve(g_scene_state.scene.scene_objects.size());
+    std::unordered_map<const Object*, std::size_t> buffer_idx;
 
     for (const auto& inst : g_scene_state.scene.scene_objects) {
-        std::vector<float> interleaved; // interleaved vectors and normals
-        interleaved.reserve(inst.obj.faces.size() * 3 * 6);
-
-        for (const auto& face : inst.obj.faces) {
-            const Vertex& v1 = inst.obj.vertices.at(face.v1);
-            const Vertex& v2 = inst.obj.vertices.at(face.v2);
-            const Vertex& v3 = inst.obj.vertices.at(face.v3);
-            const Normal& n1 = inst.obj.normals.at(face.vn1);
-            const Normal& n2 = inst.obj.normals.at(face.vn2);
-            const Normal& n3 = inst.obj.normals.at(face.vn3);
-
-            const Vertex* vertices[3] = {&v1, &v2, &v3};
-            const Normal* normals[3] = {&n1, &n2, &n3};
-            for (int i = 0; i < 3; ++i) {
-                interleaved.push_back(static_cast<float>(vertices[i]->x));
-                interleaved.push_back(static_cast<float>(vertices[i]->y));
-                interleaved.push_back(static_cast<float>(vertices[i]->z));
-                interleaved.push_back(static_cast<float>(normals[i]->x));
-                interleaved.push_back(static_cast<float>(normals[i]->y));
-                interleaved.push_back(static_cast<float>(normals[i]->z));
-            }
+        auto it = buffer_idx.find(inst.mesh.get());
+        if (it == buffer_idx.end()) {
+            it = buffer_idx.emplace(inst.mesh.get(), g_scene_state.buffers.size()).first;
+            g_scene_state.buffers.push_back(upload_mesh_buffer(*inst.mesh));
         }
 
         Mesh mesh;
-        mesh.vertex_count = static_cast<GLsizei>(interleaved.size() / 6);
+        mesh.buffer = it->second;
+        mesh.model = inst.transform.cast<float>();
         mesh.ambient = inst.ambient.cast<float>();
         mesh.diffuse = inst.diffuse.cast<float>();
         mesh.specular = inst.specular.cast<float>();
         mesh.shininess = static_cast<float>(std::max(0.0, std::min(inst.shininess, 200.0)));
-
-        // Generate a vao location for this mesh
-        glGenVertexArrays(1, &mesh.vao);
-        glBindVertexArray(mesh.vao);
-
-        // Store the mesh in a vbo
-        glGenBuffers(1, &mesh.vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-        glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(interleaved.size() * sizeof(float)),
-                     interleaved.data(), GL_STATIC_DRAW);
-
-        // Tell information needed to interpret our vbo
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void*>(0));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), reinterpret_cast<void*>(3 * sizeof(float)));
-
-        // Reset so we don't accidentally overwrite
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
         g_scene_state.meshes.push_back(mesh);
     }
 }
@@ -413,15 +438,16 @@ Eigen::Matrix4f compute_scene_projection() {
     return P_map.cast<float>();
 }
 
-void upload_scene_globals(const Eigen::Matrix4f& model_view, const Eigen::Matrix4f& projection) {
-    // Upload camera, lighting, etc once per frame
+void upload_model_view(const Eigen::Matrix4f& model_view) {
     // Transform for normals: (MV_3x3)^{-T}
     Eigen::Matrix3f normal_matrix = model_view.block<3,3>(0,0).inverse().transpose();
-
-    // Camera transforms
     glUniformMatrix4fv(g_scene_uniforms.model_view, 1, GL_FALSE, model_view.data());
-    glUniformMatrix4fv(g_scene_uniforms.projection, 1, GL_FALSE, projection.data());
     glUniformMatrix3fv(g_scene_uniforms.normal_matrix, 1, GL_FALSE, normal_matrix.data());
+}
+
+void upload_scene_globals(const Eigen::Matrix4f& projection) {
+    // Upload camera, lighting, etc once per frame. Model-view is per instance.
+    glUniformMatrix4fv(g_scene_uniforms.projection, 1, GL_FALSE, projection.data());
 
     // Ambient light (scene constant)
     glUniform3fv(g_scene_uniforms.ambient_light, 1, g_ambient_light.data());
@@ -461,9 +487,11 @@ void render_scene_mode() {
 
     Eigen::Matrix4f model_view = compute_scene_model_view();
     Eigen::Matrix4f projection = compute_scene_projection();
-    upload_scene_globals(model_view, projection);
+    upload_scene_globals(projection);
 
     for (const auto& mesh : g_scene_state.meshes) {
+        upload_model_view(model_view * mesh.model);
+
         // Per-object material parameters
         glUniform3fv(g_scene_uniforms.material_ambient, 1, mesh.ambient.data());
         glUniform3fv(g_scene_uniforms.material_diffuse, 1, mesh.diffuse.data());
@@ -471,8 +499,9 @@ void render_scene_mode() {
         glUniform1f (g_scene_uniforms.material_shininess, mesh.shininess);
 
         // Draw
-        glBindVertexArray(mesh.vao);
-        glDrawArrays(GL_TRIANGLES, 0, mesh.vertex_count);
+        const MeshBuffer& buffer = g_scene_state.buffers[mesh.buffer];
+        glBindVertexArray(buffer.vao);
+        glDrawArrays(GL_TRIANGLES, 0, buffer.vertex_count);
     }
     glBindVertexArray(0);
 }
@@ -637,6 +666,13 @@ std::size_t parse_size(const char* text) {
 }
 
 int main(int argc, char** argv) {
+    // A trailing --no-cache disables the .meshcache sidecars next to the OBJ files
+    bool use_mesh_cache = true;
+    if (argc > 1 && std::strcmp(argv[argc - 1], "--no-cache") == 0) {
+        use_mesh_cache = false;
+        --argc;
+    }
+
     try {
         if (argc == 5) {
             g_mode = RunMode::Scene;
@@ -646,7 +682,7 @@ int main(int argc, char** argv) {
                 std::cerr << "Could not open scene file: " << g_scene_path << "\n";
                 return 1;
             }
-            g_scene_state.scene = parse_scene_file(fin, parse_parent_path(g_scene_path));
+            g_scene_state.scene = parse_scene_file(fin, parse_parent_path(g_scene_path), use_mesh_cache);
             g_window_width = static_cast<int>(parse_size(argv[2]));
             g_window_height = static_cast<int>(parse_size(argv[3]));
             g_shading_mode = std::atoi(argv[4]) == 0 ? 0 : 1;
@@ -659,7 +695,7 @@ int main(int argc, char** argv) {
             g_window_height = 600;
             g_arcball.set_window(g_window_width, g_window_height);
         } else {
-            std::cerr << "Usage: " << argv[0] << " [scene.txt] [xres] [yres] [mode]\n"
+            std::cerr << "Usage: " << argv[0] << " [scene.txt] [xres] [yres] [mode] [--no-cache]\n"
                         << " or: " << argv[0] << " [color.png] [normal.png]\n";
             return 1;
         }
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <memory>
 #include <Eigen/Dense>
 
 // Reused from hw2
@@ -29,7 +30,8 @@ struct Object {
 };
 
 struct ObjectInstance {
-    Object obj;
+    std::shared_ptr<const Object> mesh; // shared by every instance of the same obj file
+    Eigen::Matrix4d transform;          // object to world
     std::string name;
     Eigen::Vector3d ambient;
     Eigen::Vector3d diffuse;
@@ -10,6 +10,7 @@
 
 std::string parse_parent_path(const std::string& path);
 std::size_t parse_size_t(const char* str);
-Scene parse_scene_file(std::ifstream& fin, const std::string& parent_path);
+// Meshes are cached in "<file>.meshcache" sidecars unless use_mesh_cache is false.
+Scene parse_scene_file(std::ifstream& fin, const std::string& parent_path, bool use_mesh_cache = true);
 
 #endif
@@ -19,6 +19,7 @@
 #include <array>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -495,8 +496,15 @@ void build_render_objects() {
 } // namespace
 
 int main(int argc, char** argv) {
+    // A trailing --no-cache disables the .meshcache sidecars next to the OBJ files
+    bool use_mesh_cache = true;
+    if (argc > 1 && std::strcmp(argv[argc - 1], "--no-cache") == 0) {
+        use_mesh_cache = false;
+        --argc;
+    }
+
     if (argc != 5) {
-        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres] [h]\n";
+        std::cerr << "Usage: " << argv[0] << " [scene_description_file.txt] [xres] [yres] [h] [--no-cache]\n";
         return 1;
     }
 
@@ -511,7 +519,7 @@ int main(int argc, char** argv) {
     }
 
     try {
-        g_scene = parse_scene_file(fin, parse_parent_path(argv[1]));
+        g_scene = parse_scene_file(fin, parse_parent_path(argv[1]), use_mesh_cache);
     } catch (const std::exception& e) {
         std::cerr << "Error parsing scene: " << e.what() << "\n";
         return 1;